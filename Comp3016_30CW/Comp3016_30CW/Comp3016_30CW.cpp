@@ -1,9 +1,39 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <sstream>
+#include <unordered_set>
+#include <thread>
 #include <vector>
 #include <SDL.h>
 #include <SDL_mixer.h>
+#include <SDL_test_font.h>
 #include <json.hpp>
+// SSE2 is always available on x64, lightmap and hazards fall back to scalar code anywhere else
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 using json = nlohmann::json;
 using namespace std;
 
@@ -12,6 +42,7 @@ class Player;
 class Enemy;
 class MeleeEnemy;
 class FlyingEnemy;
+class World;
 class Game;
 
 // Define constants needed throughout code
@@ -19,6 +50,7 @@ struct Constants {
     static constexpr int WIN_WIDTH = 1400;
     static constexpr int WIN_HEIGHT = 800;
     static constexpr int LEVEL_WIDTH = 4250;
+    static constexpr int LEVEL_HEIGHT = 3200;
     static constexpr int FLOOR_LEVEL = 700;
     static constexpr float GRAVITY = 1800.0f;
     static constexpr float TERMINAL_VELOCITY = 1200.0f;
@@ -27,16 +59,23 @@ struct Constants {
     static constexpr float VERTICAL_KNOCKBACK = -200.0f;
     static constexpr float FADE_SPEED = 300.0f;
     static constexpr float FIXED_DT = 0.008f;
+    static constexpr int MAX_PLAYERS = 4;
+    static constexpr float MIN_ZOOM = 0.15f;
+    static constexpr float MAX_ZOOM = 2.0f;
+    // Below this zoom the level is drawn from one overview of the fixed level, so endless levels stop zooming here
+    static constexpr float LOD_ZOOM = 0.35f;
 };
 
 struct Vector2 {
     float x, y;
 };
 
+// w and h are the size of the view in level units, which is the viewport size divided by zoom
 struct Camera {
     float targetX, targetY;
     float x, y;
     int w, h;
+    float zoom;
 };
 
 struct PlayerData {
@@ -53,6 +92,339 @@ struct SoundEffect {
     Mix_Chunk* sound;
 };
 
+
+// Metric ids (enum class indexes are used instead of string names so recording a metric is just an array write)
+enum class Counter { FRAMES, SUBSTEPS, DRAW_CALLS, COUNT };
+enum class Gauge { ENEMIES_ACTIVE, COINS_REMAINING, DRAW_CALLS_PER_FRAME, COUNT };
+enum class Histogram { FRAME_TIME, COUNT };
+
+const char* const COUNTER_NAMES[] = { "frames", "substeps", "draw_calls" };
+const char* const GAUGE_NAMES[] = { "enemies_active", "coins_remaining", "draw_calls_per_frame" };
+const char* const HISTOGRAM_NAMES[] = { "frame_time_us" };
+
+// Histogram with power-of-two buckets (bucket 0 is < 128, bucket i is < 128 << i, last bucket catches the rest)
+struct HistogramData {
+    static constexpr int BUCKETS = 16;
+    uint64_t buckets[BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+// Write one line per metric, shared by the metrics watcher and the console's stats command
+void writeMetrics(ostream& out, const uint64_t* counters, const int64_t* gauges, const HistogramData* histograms) {
+    for (int i = 0; i < (int)Counter::COUNT; i++) {
+        out << COUNTER_NAMES[i] << " = " << counters[i] << "\n";
+    }
+    for (int i = 0; i < (int)Gauge::COUNT; i++) {
+        out << GAUGE_NAMES[i] << " = " << gauges[i] << "\n";
+    }
+    for (int i = 0; i < (int)Histogram::COUNT; i++) {
+        const HistogramData& data = histograms[i];
+        out << HISTOGRAM_NAMES[i] << " count = " << data.count
+            << ", mean = " << (data.count ? data.sum / data.count : 0)
+            << ", max = " << data.max << "\n";
+    }
+}
+
+// Layout of the shared memory segment, readers must check magic and version before trusting the contents
+struct MetricsBlock {
+    static constexpr uint32_t MAGIC = 0x43334d31;
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    // Seqlock sequence number, odd while the game is writing
+    atomic<uint32_t> sequence;
+    uint32_t padding;
+
+    uint64_t counters[(int)Counter::COUNT];
+    int64_t gauges[(int)Gauge::COUNT];
+    HistogramData histograms[(int)Histogram::COUNT];
+};
+
+const char* const METRICS_SHM_NAME =
+#ifdef _WIN32
+    "Local\\Comp3016Metrics";
+#else
+    "/comp3016_metrics";
+#endif
+
+// Metrics registry, recorded into process-local memory then published to shared memory once per frame
+class MetricsRegistry {
+public:
+    MetricsRegistry() :
+        counters{},
+        gauges{},
+        histograms{},
+        block(nullptr)
+#ifdef _WIN32
+        , mapping(nullptr)
+#endif
+    {
+    };
+
+    ~MetricsRegistry() {
+        if (!block) { return; }
+#ifdef _WIN32
+        UnmapViewOfFile(block);
+        CloseHandle(mapping);
+#else
+        munmap(block, sizeof(MetricsBlock));
+        shm_unlink(METRICS_SHM_NAME);
+#endif
+    }
+
+    // Create the shared memory segment (only called once at startup, publishing afterwards makes no syscalls)
+    void OpenSharedMemory() {
+        void* memory = nullptr;
+#ifdef _WIN32
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(MetricsBlock), METRICS_SHM_NAME);
+        if (mapping) {
+            memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(MetricsBlock));
+        }
+#else
+        int fd = shm_open(METRICS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+        if (fd >= 0) {
+            if (ftruncate(fd, sizeof(MetricsBlock)) == 0) {
+                memory = mmap(nullptr, sizeof(MetricsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (memory == MAP_FAILED) {
+                    memory = nullptr;
+                }
+            }
+            close(fd);
+        }
+#endif
+        if (!memory) {
+            cerr << "Metrics shared memory could not be created, metrics will not be exported." << endl;
+            return;
+        }
+
+        memset(memory, 0, sizeof(MetricsBlock));
+        block = new (memory) MetricsBlock();
+        block->magic = MetricsBlock::MAGIC;
+        block->version = MetricsBlock::VERSION;
+    }
+
+    void Increment(Counter counter, uint64_t amount = 1) { counters[(int)counter] += amount; }
+    uint64_t Get(Counter counter) { return counters[(int)counter]; }
+    void Set(Gauge gauge, int64_t value) { gauges[(int)gauge] = value; }
+
+    void Record(Histogram histogram, uint64_t value) {
+        HistogramData& data = histograms[(int)histogram];
+        int bucket = 0;
+        while (bucket < HistogramData::BUCKETS - 1 && value >= (128ull << bucket)) {
+            bucket++;
+        }
+        data.buckets[bucket]++;
+        data.count++;
+        data.sum += value;
+        if (value > data.max) { data.max = value; }
+    }
+
+    // Copy local values into shared memory, readers retry if the sequence changed whilst they were copying
+    void Publish() {
+        if (!block) { return; }
+
+        uint32_t sequence = block->sequence.load(memory_order_relaxed);
+        block->sequence.store(sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        memcpy(block->counters, counters, sizeof(counters));
+        memcpy(block->gauges, gauges, sizeof(gauges));
+        memcpy(block->histograms, histograms, sizeof(histograms));
+
+        block->sequence.store(sequence + 2, memory_order_release);
+    }
+
+    // Write this process's current values, whether or not they are being published
+    void Write(ostream& out) {
+        writeMetrics(out, counters, gauges, histograms);
+    }
+
+private:
+    uint64_t counters[(int)Counter::COUNT];
+    int64_t gauges[(int)Gauge::COUNT];
+    HistogramData histograms[(int)Histogram::COUNT];
+
+    MetricsBlock* block;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+};
+
+// Global so that any object can record metrics without needing a pointer back to the game
+MetricsRegistry metrics;
+
+// Draw a filled rect and count the draw call
+void renderFillRect(SDL_Renderer* renderer, const SDL_Rect* rect) {
+    SDL_RenderFillRect(renderer, rect);
+    metrics.Increment(Counter::DRAW_CALLS);
+}
+
+// Draw text in the current draw colour with SDL's built in test font, which copies one texture per character
+void renderText(SDL_Renderer* renderer, int x, int y, const string& text) {
+    SDLTest_DrawString(renderer, x, y, text.c_str());
+    metrics.Increment(Counter::DRAW_CALLS, text.size());
+}
+
+// Attach to a running game's metrics and print them until closed (run with "--metrics")
+int watchMetrics() {
+    const void* memory = nullptr;
+#ifdef _WIN32
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, METRICS_SHM_NAME);
+    if (mapping) {
+        memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(MetricsBlock));
+    }
+#else
+    int fd = shm_open(METRICS_SHM_NAME, O_RDONLY, 0);
+    if (fd >= 0) {
+        memory = mmap(nullptr, sizeof(MetricsBlock), PROT_READ, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED) {
+            memory = nullptr;
+        }
+        close(fd);
+    }
+#endif
+    if (!memory) {
+        cerr << "No running game found to read metrics from." << endl;
+        return EXIT_FAILURE;
+    }
+
+    const MetricsBlock* shared = (const MetricsBlock*)memory;
+    if (shared->magic != MetricsBlock::MAGIC || shared->version != MetricsBlock::VERSION) {
+        cerr << "Metrics segment has an unexpected layout." << endl;
+        return EXIT_FAILURE;
+    }
+
+    while (true) {
+        // Seqlock read, retry until a consistent snapshot is copied
+        uint64_t counters[(int)Counter::COUNT];
+        int64_t gauges[(int)Gauge::COUNT];
+        HistogramData histograms[(int)Histogram::COUNT];
+        uint32_t before, after;
+        do {
+            before = shared->sequence.load(memory_order_acquire);
+            memcpy(counters, shared->counters, sizeof(counters));
+            memcpy(gauges, shared->gauges, sizeof(gauges));
+            memcpy(histograms, shared->histograms, sizeof(histograms));
+            atomic_thread_fence(memory_order_acquire);
+            after = shared->sequence.load(memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        writeMetrics(cout, counters, gauges, histograms);
+        cout << endl;
+
+        this_thread::sleep_for(chrono::milliseconds(500));
+    }
+}
+
+// Gameplay heatmaps over the whole level, fixed size grids so memory never grows however long the game runs
+enum class Heatmap { POSITION, DEATH, DAMAGE, COIN_PICKUP, COUNT };
+
+class Telemetry {
+public:
+    static constexpr int CELL_SIZE = 50;
+    static constexpr int GRID_WIDTH = (Constants::LEVEL_WIDTH + CELL_SIZE - 1) / CELL_SIZE;
+    static constexpr int GRID_HEIGHT = (Constants::LEVEL_HEIGHT + CELL_SIZE - 1) / CELL_SIZE;
+    static constexpr int CELLS = GRID_WIDTH * GRID_HEIGHT;
+    static constexpr uint32_t MAGIC = 0x544d4830;
+    static constexpr float FLUSH_INTERVAL = 10.0f;
+
+    Telemetry() :
+        grids(new atomic<uint32_t>[(int)Heatmap::COUNT * CELLS]),
+        coinPickupTimes(new atomic<float>[CELLS]),
+        runTime(0.0f),
+        stopFlushing(false)
+    {
+        for (int i = 0; i < (int)Heatmap::COUNT * CELLS; i++) { grids[i].store(0, memory_order_relaxed); }
+        for (int i = 0; i < CELLS; i++) { coinPickupTimes[i].store(0.0f, memory_order_relaxed); }
+    };
+
+    ~Telemetry() {
+        Stop();
+    }
+
+    // Start background thread that periodically writes the heatmaps to disk
+    void Start(const string& fileName) {
+        flushThread = thread([this, fileName]() {
+            unique_lock<mutex> lock(flushMutex);
+            while (!stopFlushing) {
+                flushCondition.wait_for(lock, chrono::duration<float>(FLUSH_INTERVAL));
+                Flush(fileName);
+            }
+        });
+    }
+
+    // Stop background thread (it flushes one last time before exiting)
+    void Stop() {
+        if (!flushThread.joinable()) { return; }
+        {
+            lock_guard<mutex> lock(flushMutex);
+            stopFlushing = true;
+        }
+        flushCondition.notify_one();
+        flushThread.join();
+    }
+
+    // Add one event to a heatmap, the game thread is the only writer so a relaxed load and store is enough
+    void Record(Heatmap heatmap, Vector2 pos) {
+        int cell = CellIndex(pos);
+        if (cell < 0) { return; }
+
+        atomic<uint32_t>& count = grids[(int)heatmap * CELLS + cell];
+        count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+
+        // Coin pickups also accumulate the time taken to reach them, divide by the count to get the average
+        if (heatmap == Heatmap::COIN_PICKUP) {
+            atomic<float>& time = coinPickupTimes[cell];
+            time.store(time.load(memory_order_relaxed) + runTime, memory_order_relaxed);
+        }
+    }
+
+    void AdvanceTime(float deltaTime) { runTime += deltaTime; }
+    void ResetRunTime() { runTime = 0.0f; }
+
+    // Convert world position to grid cell, -1 if outside the level
+    static int CellIndex(Vector2 pos) {
+        int cellX = (int)floorf(pos.x / CELL_SIZE);
+        int cellY = (int)floorf((pos.y - (Constants::FLOOR_LEVEL - Constants::LEVEL_HEIGHT)) / CELL_SIZE);
+        if (cellX < 0 || cellX >= GRID_WIDTH || cellY < 0 || cellY >= GRID_HEIGHT) {
+            return -1;
+        }
+        return cellY * GRID_WIDTH + cellX;
+    }
+
+private:
+    // Write header then each grid as raw little-endian arrays
+    void Flush(const string& fileName) {
+        vector<uint32_t> counts((int)Heatmap::COUNT * CELLS);
+        vector<float> times(CELLS);
+        for (int i = 0; i < (int)counts.size(); i++) { counts[i] = grids[i].load(memory_order_relaxed); }
+        for (int i = 0; i < CELLS; i++) { times[i] = coinPickupTimes[i].load(memory_order_relaxed); }
+
+        ofstream file(fileName, ios::binary | ios::trunc);
+        if (!file.is_open()) {
+            cerr << "Telemetry failed to save." << endl;
+            return;
+        }
+
+        uint32_t header[] = { MAGIC, (uint32_t)GRID_WIDTH, (uint32_t)GRID_HEIGHT, (uint32_t)CELL_SIZE, (uint32_t)Heatmap::COUNT };
+        file.write((const char*)header, sizeof(header));
+        file.write((const char*)counts.data(), counts.size() * sizeof(uint32_t));
+        file.write((const char*)times.data(), times.size() * sizeof(float));
+    }
+
+    unique_ptr<atomic<uint32_t>[]> grids;
+    unique_ptr<atomic<float>[]> coinPickupTimes;
+    float runTime;
+
+    thread flushThread;
+    mutex flushMutex;
+    condition_variable flushCondition;
+    bool stopFlushing;
+};
+
 // Axis-aligned bounding box collision
 bool AABB(const SDL_Rect& a, const SDL_Rect& b) {
     return (
@@ -81,6 +453,347 @@ void calcKnockback(Vector2 pos, Vector2& vel, Vector2 damageLocation) {
     }
 }
 
+// Smallest rect containing both rects
+SDL_Rect unionRect(const SDL_Rect& a, const SDL_Rect& b) {
+    int left = min(a.x, b.x);
+    int top = min(a.y, b.y);
+    int right = max(a.x + a.w, b.x + b.w);
+    int bottom = max(a.y + a.h, b.y + b.h);
+    return SDL_Rect{ left, top, right - left, bottom - top };
+}
+
+// True if 'inner' is entirely inside 'outer'
+bool containsRect(const SDL_Rect& outer, const SDL_Rect& inner) {
+    return (
+        inner.x >= outer.x && inner.x + inner.w <= outer.x + outer.w &&
+        inner.y >= outer.y && inner.y + inner.h <= outer.y + outer.h
+    );
+}
+
+// True if the segment from 'a' to 'b' passes through the inside of rect (slab test, grazing an edge doesnt count)
+bool segmentIntersectsRect(Vector2 a, Vector2 b, const SDL_Rect& rect) {
+    float tMin = 0.0f, tMax = 1.0f;
+    float start[2] = { a.x, a.y };
+    float delta[2] = { b.x - a.x, b.y - a.y };
+    float low[2] = { (float)rect.x, (float)rect.y };
+    float high[2] = { (float)(rect.x + rect.w), (float)(rect.y + rect.h) };
+
+    for (int axis = 0; axis < 2; axis++) {
+        if (fabsf(delta[axis]) < 1e-6f) {
+            if (start[axis] <= low[axis] || start[axis] >= high[axis]) { return false; }
+            continue;
+        }
+
+        float t1 = (low[axis] - start[axis]) / delta[axis];
+        float t2 = (high[axis] - start[axis]) / delta[axis];
+        if (t1 > t2) { swap(t1, t2); }
+        tMin = max(tMin, t1);
+        tMax = min(tMax, t2);
+        if (tMin >= tMax) { return false; }
+    }
+    return true;
+}
+
+// Dynamic bounding volume tree (AVL balanced), leaves store fattened rects so small movements dont change the tree
+class DynamicTree {
+public:
+    static constexpr int NULL_NODE = -1;
+    static constexpr int FAT_MARGIN = 16;
+    // How many ticks of movement to extend fat rects by in the direction of travel
+    static constexpr float DISPLACEMENT_MULTIPLIER = 8.0f;
+
+    DynamicTree() :
+        root(NULL_NODE),
+        freeList(NULL_NODE)
+    {
+    };
+
+    // Add a rect to the tree, returning its proxy id (static rects should use a margin of 0)
+    int CreateProxy(const SDL_Rect& rect, int userData, int margin = FAT_MARGIN) {
+        int proxy = AllocateNode();
+        nodes[proxy].rect = { rect.x - margin, rect.y - margin, rect.w + margin * 2, rect.h + margin * 2 };
+        nodes[proxy].userData = userData;
+        nodes[proxy].height = 0;
+        InsertLeaf(proxy);
+        return proxy;
+    }
+
+    void DestroyProxy(int proxy) {
+        RemoveLeaf(proxy);
+        FreeNode(proxy);
+    }
+
+    // Point a leaf at different data without touching the tree
+    void SetUserData(int proxy, int userData) {
+        nodes[proxy].userData = userData;
+    }
+
+    // Only reinsert if the rect has escaped its fat rect, returns true if the tree changed
+    bool MoveProxy(int proxy, const SDL_Rect& rect, Vector2 displacement) {
+        if (containsRect(nodes[proxy].rect, rect)) {
+            return false;
+        }
+
+        RemoveLeaf(proxy);
+
+        // Fatten then extend in the direction of travel, so steady movement rarely escapes again
+        SDL_Rect fat = { rect.x - FAT_MARGIN, rect.y - FAT_MARGIN, rect.w + FAT_MARGIN * 2, rect.h + FAT_MARGIN * 2 };
+        int dx = (int)ceilf(fabsf(displacement.x) * DISPLACEMENT_MULTIPLIER);
+        int dy = (int)ceilf(fabsf(displacement.y) * DISPLACEMENT_MULTIPLIER);
+        if (displacement.x < 0.0f) { fat.x -= dx; }
+        fat.w += dx;
+        if (displacement.y < 0.0f) { fat.y -= dy; }
+        fat.h += dy;
+
+        nodes[proxy].rect = fat;
+        InsertLeaf(proxy);
+        return true;
+    }
+
+    // Move every rect by the same amount, a translation keeps every node's bounds valid so nothing is reinserted
+    void Translate(int dx, int dy) {
+        for (auto& node : nodes) {
+            if (node.height < 0) { continue; }
+            node.rect.x += dx;
+            node.rect.y += dy;
+        }
+    }
+
+    // Call callback(userData) for every leaf whose fat rect overlaps rect
+    template<typename Callback>
+    void Query(const SDL_Rect& rect, Callback callback) const {
+        if (root == NULL_NODE) { return; }
+
+        // Balanced tree is never deep, so a fixed stack avoids allocating
+        int stack[128];
+        int count = 0;
+        stack[count++] = root;
+
+        while (count > 0) {
+            const Node& node = nodes[stack[--count]];
+            if (!AABB(node.rect, rect)) { continue; }
+
+            if (node.IsLeaf()) {
+                callback(node.userData);
+            }
+            else {
+                stack[count++] = node.child1;
+                stack[count++] = node.child2;
+            }
+        }
+    }
+
+    // Call callback(userData) for every leaf whose fat rect the segment passes through, until callback returns true
+    template<typename Callback>
+    bool RayCast(Vector2 from, Vector2 to, Callback callback) const {
+        if (root == NULL_NODE) { return false; }
+
+        int stack[128];
+        int count = 0;
+        stack[count++] = root;
+
+        while (count > 0) {
+            const Node& node = nodes[stack[--count]];
+            if (!segmentIntersectsRect(from, to, node.rect)) { continue; }
+
+            if (node.IsLeaf()) {
+                if (callback(node.userData)) { return true; }
+            }
+            else {
+                stack[count++] = node.child1;
+                stack[count++] = node.child2;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Node {
+        SDL_Rect rect;
+        int parent;     // Doubles as next free node when in the free list
+        int child1;
+        int child2;
+        int height;     // Leaf is 0, free node is -1
+        int userData;
+
+        bool IsLeaf() const { return child1 == NULL_NODE; }
+    };
+
+    static int Perimeter(const SDL_Rect& rect) { return 2 * (rect.w + rect.h); }
+
+    int AllocateNode() {
+        if (freeList == NULL_NODE) {
+            nodes.push_back(Node{ SDL_Rect{ 0, 0, 0, 0 }, NULL_NODE, NULL_NODE, NULL_NODE, -1, 0 });
+            freeList = (int)nodes.size() - 1;
+        }
+
+        int node = freeList;
+        freeList = nodes[node].parent;
+        nodes[node].parent = NULL_NODE;
+        nodes[node].child1 = NULL_NODE;
+        nodes[node].child2 = NULL_NODE;
+        nodes[node].height = 0;
+        return node;
+    }
+
+    void FreeNode(int node) {
+        nodes[node].parent = freeList;
+        nodes[node].height = -1;
+        freeList = node;
+    }
+
+    // Find the cheapest sibling by perimeter (surface area heuristic) then walk back up refitting and rebalancing
+    void InsertLeaf(int leaf) {
+        if (root == NULL_NODE) {
+            root = leaf;
+            nodes[root].parent = NULL_NODE;
+            return;
+        }
+
+        SDL_Rect leafRect = nodes[leaf].rect;
+        int index = root;
+        while (!nodes[index].IsLeaf()) {
+            int child1 = nodes[index].child1;
+            int child2 = nodes[index].child2;
+
+            int area = Perimeter(nodes[index].rect);
+            int combinedArea = Perimeter(unionRect(nodes[index].rect, leafRect));
+
+            // Cost of making a new parent for this node and the new leaf
+            int cost = 2 * combinedArea;
+            // Minimum cost of pushing the leaf further down the tree
+            int inheritanceCost = 2 * (combinedArea - area);
+
+            int cost1 = Perimeter(unionRect(leafRect, nodes[child1].rect)) + inheritanceCost;
+            if (!nodes[child1].IsLeaf()) { cost1 -= Perimeter(nodes[child1].rect); }
+            int cost2 = Perimeter(unionRect(leafRect, nodes[child2].rect)) + inheritanceCost;
+            if (!nodes[child2].IsLeaf()) { cost2 -= Perimeter(nodes[child2].rect); }
+
+            if (cost < cost1 && cost < cost2) { break; }
+            index = cost1 < cost2 ? child1 : child2;
+        }
+
+        int sibling = index;
+        int oldParent = nodes[sibling].parent;
+        int newParent = AllocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].rect = unionRect(leafRect, nodes[sibling].rect);
+        nodes[newParent].height = nodes[sibling].height + 1;
+        nodes[newParent].child1 = sibling;
+        nodes[newParent].child2 = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+
+        if (oldParent != NULL_NODE) {
+            if (nodes[oldParent].child1 == sibling) { nodes[oldParent].child1 = newParent; }
+            else { nodes[oldParent].child2 = newParent; }
+        }
+        else {
+            root = newParent;
+        }
+
+        Refit(nodes[leaf].parent);
+    }
+
+    void RemoveLeaf(int leaf) {
+        if (leaf == root) {
+            root = NULL_NODE;
+            return;
+        }
+
+        int parent = nodes[leaf].parent;
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+        // Replace parent with sibling
+        if (grandParent != NULL_NODE) {
+            if (nodes[grandParent].child1 == parent) { nodes[grandParent].child1 = sibling; }
+            else { nodes[grandParent].child2 = sibling; }
+            nodes[sibling].parent = grandParent;
+            FreeNode(parent);
+            Refit(grandParent);
+        }
+        else {
+            root = sibling;
+            nodes[sibling].parent = NULL_NODE;
+            FreeNode(parent);
+        }
+    }
+
+    // Walk up from a node, rebalancing and recomputing rects and heights
+    void Refit(int index) {
+        while (index != NULL_NODE) {
+            index = Balance(index);
+
+            Node& node = nodes[index];
+            node.height = 1 + max(nodes[node.child1].height, nodes[node.child2].height);
+            node.rect = unionRect(nodes[node.child1].rect, nodes[node.child2].rect);
+
+            index = node.parent;
+        }
+    }
+
+    // Rotate 'a' if its children heights differ by more than one, returns the node now in its place
+    int Balance(int a) {
+        Node& nodeA = nodes[a];
+        if (nodeA.IsLeaf() || nodeA.height < 2) {
+            return a;
+        }
+
+        int b = nodeA.child1;
+        int c = nodeA.child2;
+        int balance = nodes[c].height - nodes[b].height;
+
+        // Rotate C up
+        if (balance > 1) {
+            return Rotate(a, c, b, true);
+        }
+        // Rotate B up
+        if (balance < -1) {
+            return Rotate(a, b, c, false);
+        }
+        return a;
+    }
+
+    // Make 'up' (a child of 'a') the parent of 'a', 'a' keeps 'other' and the shorter grandchild
+    int Rotate(int a, int up, int other, bool upIsChild2) {
+        int f = nodes[up].child1;
+        int g = nodes[up].child2;
+
+        nodes[up].child1 = a;
+        nodes[up].parent = nodes[a].parent;
+        nodes[a].parent = up;
+
+        int upParent = nodes[up].parent;
+        if (upParent != NULL_NODE) {
+            if (nodes[upParent].child1 == a) { nodes[upParent].child1 = up; }
+            else { nodes[upParent].child2 = up; }
+        }
+        else {
+            root = up;
+        }
+
+        // Taller grandchild stays with 'up', shorter one moves to 'a'
+        int keep = nodes[f].height > nodes[g].height ? f : g;
+        int move = keep == f ? g : f;
+        nodes[up].child2 = keep;
+        if (upIsChild2) { nodes[a].child2 = move; }
+        else { nodes[a].child1 = move; }
+        nodes[move].parent = a;
+
+        nodes[a].rect = unionRect(nodes[other].rect, nodes[move].rect);
+        nodes[up].rect = unionRect(nodes[a].rect, nodes[keep].rect);
+        nodes[a].height = 1 + max(nodes[other].height, nodes[move].height);
+        nodes[up].height = 1 + max(nodes[a].height, nodes[keep].height);
+
+        return up;
+    }
+
+    vector<Node> nodes;
+    int root;
+    int freeList;
+};
+
 // Load sound effects from ogg file
 vector<SoundEffect> loadSoundEffects() {
     vector<SoundEffect> sfxList;
@@ -92,8 +805,8 @@ vector<SoundEffect> loadSoundEffects() {
     return sfxList;
 }
 
-// Load platforms from json file
-vector<SDL_Rect> loadPlatforms(const string& fileName) {
+// Load platforms from json file, also filling in which ones can be broken by attacks
+vector<SDL_Rect> loadPlatforms(const string& fileName, vector<bool>& breakable) {
     ifstream file(fileName);
     if (!file.is_open()) {
         cerr << "File '" << fileName << "' could not be opened. Closing program..." << endl;
@@ -105,6 +818,8 @@ vector<SDL_Rect> loadPlatforms(const string& fileName) {
 
     vector<SDL_Rect> platforms;
     platforms.reserve(data.size());
+    breakable.clear();
+    breakable.reserve(data.size());
 
     for (auto& entry : data) {
         int x = entry["x"].get<int>();
@@ -122,6 +837,7 @@ vector<SDL_Rect> loadPlatforms(const string& fileName) {
         }
 
         platforms.push_back(SDL_Rect{ x, y, w, h });
+        breakable.push_back(entry.value("breakable", false));
     }
 
     return platforms;
@@ -151,768 +867,6838 @@ vector<Coin> loadCoins(const string& fileName) {
     return coins;
 }
 
-// Load enemies from json file
-vector<unique_ptr<Enemy>> loadEnemies(const string& fileName, Game* game);
-
-// Load player data from json file
-PlayerData loadPlayerFile(const string& fileName) {
-    ifstream file(fileName);
-    if (!file.is_open()) {
-        cerr << "File '" << fileName << "' could not be opened." << endl;
-        // Restore default player data
-        return PlayerData{ 100, 250, 10 };
-    }
-
-    json data;
-    file >> data;
-
-    int x = data[0]["x"].get<int>();
-    int y = data[0]["y"].get<int>();
-    int health = data[0]["health"].get<int>();
-
-    return PlayerData{ x, y, health };
-}
-
-// Save player data to json file
-void savePlayerFile(const string& fileName, Vector2 pos, int health) {
-    json data = json::array();
-    data.push_back({ {"x", (int)pos.x}, {"y", (int)pos.y}, {"health", health} });
-
-    ofstream file(fileName);
-    if (!file.is_open()) {
-        cerr << "Player data failed to save." << endl;
-        return;
-    }
 
-    file << data.dump(4);
-}
+// Behaviour script instructions, each one is run across a whole batch of enemies before the next
+enum class BehaviourOp : uint8_t {
+    LOAD_CONSTANT, MOVE, ADD, SUBTRACT, MULTIPLY, DIVIDE, MIN, MAX, LESS, LESS_EQUAL, GREATER, GREATER_EQUAL, NEGATE, ABS, SELECT
+};
 
-// Use enum class to store attack direction, as it is more efficient than a string
-enum class AttackDirection { UP, DOWN, LEFT, RIGHT };
+// Registers filled in for every enemy before a script runs, vx and vy are also read back afterwards
+enum class BehaviourInput { X, Y, W, H, VX, VY, HEALTH, PLAYER_X, PLAYER_Y, PLAYER_W, PLAYER_H, COUNT };
+static const char* const BEHAVIOUR_INPUT_NAMES[(int)BehaviourInput::COUNT] = {
+    "x", "y", "w", "h", "vx", "vy", "health", "player_x", "player_y", "player_w", "player_h"
+};
 
+struct BehaviourInstruction {
+    BehaviourOp op;
+    uint8_t dst;
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+    float constant;     // Only used by LOAD_CONSTANT
+};
 
-// Player class
-class Player {
+// Enemy behaviour compiled from a script of assignments, one per line, such as
+//     vx = select(player_x > x, 150, -150)
+// using + - * / < <= > >=, brackets, min, max, abs, select(condition, ifTrue, ifFalse), numbers, the inputs and any
+// names assigned earlier. Comparisons give 1 or 0 and there are no branches, so the same instructions run for every
+// enemy and each one is a plain loop over a batch of registers. Setting vy makes the enemy fly, otherwise it falls
+class BehaviourScript {
 public:
-    Player(int width, int height, Game* game) :
-        pos{ 0.0f, 0.0f },
-        previousPos{ 0.0f, 0.0f },
-        vel{ 0.0f, 0.0f },
-        body{ 0, 0, width, height },
-        attackHitbox{ 0, 0, width, width },
-        game(game),
-        canDash{ true },
-        isDashing{ false },
-        dashPressedLastFrame{ false },
-        dashTimer{ 0.0f },
-        dashCooldown{ 0.0f },
-        isAttacking{ false },
-        attackPressedLastFrame{ false },
-        attackDirection{ AttackDirection::RIGHT },
-        attackTimer{ 0.0f },
-        attackCooldown{ 0.0f },
-        isGrounded{ false },
-        coyoteTimer{ 0.0f },
-        damageCooldown{ 0.0f },
-        knockbackTimer{ 0.0f },
-        isJumping(false),
-        facingLeft(false),
-        speed(300.0f),
-        jumpVelocity(-960.0f),
-        health(10)
+    static constexpr int MAX_REGISTERS = 64;
+    // Most enemies run together at once, small enough that the registers in use stay in cache
+    static constexpr int BATCH_SIZE = 256;
+
+    // Name is the script file relative to the level directory, which is how enemies.json refers to it
+    BehaviourScript(const string& name) :
+        scriptName(name),
+        registerCount((int)BehaviourInput::COUNT),
+        flying(false),
+        namedRegisters((int)BehaviourInput::COUNT),
+        position(0),
+        nextRegister(0)
     {
     };
 
-    void HandleInput(const Uint8* keystate, SDL_GameController* controller) {
-        bool dashPressed = keystate[SDL_SCANCODE_LSHIFT];
-        bool attackPressed = keystate[SDL_SCANCODE_E];
+    // Compile source into instructions, returns false with an error naming the line if it cant be compiled
+    bool Compile(const string& source, string& error) {
+        istringstream lines(source);
+        string line;
+        int lineNumber = 0;
+        while (getline(lines, line)) {
+            lineNumber++;
+            text = line.substr(0, line.find('#'));
+            position = 0;
+            if (!SkipSpace()) { continue; }
+
+            string name;
+            if (!ReadName(name) || !Expect('=')) {
+                error = "line " + to_string(lineNumber) + ": expected 'name = expression'";
+                return false;
+            }
+            int input = FindInput(name);
+            if (input != -1 && input != (int)BehaviourInput::VX && input != (int)BehaviourInput::VY) {
+                error = "line " + to_string(lineNumber) + ": '" + name + "' can only be read";
+                return false;
+            }
 
-        float leftStickXAxis = 0.0f;
-        float leftStickYAxis = 0.0f;
-        if (controller) {
-            leftStickXAxis = SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTX) / 32767.0f;
-            leftStickYAxis = SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTY) / 32767.0f;
+            // Temporaries are only live for one statement, so they start after the named registers every time
+            nextRegister = namedRegisters;
+            int value = Expression(error);
+            if (value < 0 || SkipSpace()) {
+                if (error.empty()) { error = "unexpected '" + text.substr(position) + "'"; }
+                error = "line " + to_string(lineNumber) + ": " + error;
+                return false;
+            }
 
-            // Leave slight deadzone on stick input
-            if (fabs(leftStickXAxis) < 0.2f) {
-                leftStickXAxis = 0.0f;
+            int target = input != -1 ? input : FindLocal(name);
+            if (target == -1) {
+                // A copy like 'b = a' uses no temporary, so locals have to be checked against the limit as well
+                if (namedRegisters >= MAX_REGISTERS) {
+                    error = "line " + to_string(lineNumber) + ": needs more than " + to_string(MAX_REGISTERS) + " registers";
+                    return false;
+                }
+                target = namedRegisters++;
+                locals.push_back({ name, target });
+                registerCount = max(registerCount, namedRegisters);
             }
-            if (fabs(leftStickYAxis) < 0.5f) {
-                leftStickYAxis = 0.0f;
+            if (target != value) {
+                Emit(BehaviourOp::MOVE, target, value);
             }
+            flying = flying || target == (int)BehaviourInput::VY;
+        }
+        return true;
+    }
 
-            if (!dashPressed) {
-                dashPressed = SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_TRIGGERRIGHT);
+    // Run every instruction over count enemies (at most BATCH_SIZE), register r of enemy i is at registers[r * BATCH_SIZE + i]
+    void Run(float* registers, int count) const {
+        for (auto& instruction : code) {
+            float* dst = registers + instruction.dst * BATCH_SIZE;
+            const float* a = registers + instruction.a * BATCH_SIZE;
+            const float* b = registers + instruction.b * BATCH_SIZE;
+            const float* c = registers + instruction.c * BATCH_SIZE;
+
+            switch (instruction.op) {
+            case BehaviourOp::LOAD_CONSTANT: {
+                float value = instruction.constant;
+                for (int i = 0; i < count; i++) { dst[i] = value; }
+                break;
             }
-            if (!attackPressed) {
-                attackPressed = SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_X);
+            case BehaviourOp::MOVE:          for (int i = 0; i < count; i++) { dst[i] = a[i]; } break;
+            case BehaviourOp::ADD:           for (int i = 0; i < count; i++) { dst[i] = a[i] + b[i]; } break;
+            case BehaviourOp::SUBTRACT:      for (int i = 0; i < count; i++) { dst[i] = a[i] - b[i]; } break;
+            case BehaviourOp::MULTIPLY:      for (int i = 0; i < count; i++) { dst[i] = a[i] * b[i]; } break;
+            case BehaviourOp::DIVIDE:        for (int i = 0; i < count; i++) { dst[i] = a[i] / b[i]; } break;
+            case BehaviourOp::MIN:           for (int i = 0; i < count; i++) { dst[i] = b[i] < a[i] ? b[i] : a[i]; } break;
+            case BehaviourOp::MAX:           for (int i = 0; i < count; i++) { dst[i] = a[i] < b[i] ? b[i] : a[i]; } break;
+            case BehaviourOp::LESS:          for (int i = 0; i < count; i++) { dst[i] = a[i] < b[i] ? 1.0f : 0.0f; } break;
+            case BehaviourOp::LESS_EQUAL:    for (int i = 0; i < count; i++) { dst[i] = a[i] <= b[i] ? 1.0f : 0.0f; } break;
+            case BehaviourOp::GREATER:       for (int i = 0; i < count; i++) { dst[i] = a[i] > b[i] ? 1.0f : 0.0f; } break;
+            case BehaviourOp::GREATER_EQUAL: for (int i = 0; i < count; i++) { dst[i] = a[i] >= b[i] ? 1.0f : 0.0f; } break;
+            case BehaviourOp::NEGATE:        for (int i = 0; i < count; i++) { dst[i] = -a[i]; } break;
+            case BehaviourOp::ABS:           for (int i = 0; i < count; i++) { dst[i] = fabsf(a[i]); } break;
+            case BehaviourOp::SELECT:        for (int i = 0; i < count; i++) { dst[i] = a[i] != 0.0f ? b[i] : c[i]; } break;
             }
         }
+    }
 
-        // Dash
-        if (dashPressed && !dashPressedLastFrame && canDash && dashCooldown <= 0.0f) {
-            isDashing = true;
-            canDash = false;
-            dashTimer = 0.3f;
-            dashCooldown = 0.75f;
-        }
+    // Getters
+    const string& getName() const { return scriptName; }
+    int getRegisterCount() const { return registerCount; }
+    int getInstructionCount() const { return (int)code.size(); }
+    bool getFlying() const { return flying; }
 
-        // Stop player from jumping or changing direction whilst dashing
-        if (!isDashing && knockbackTimer <= 0.0f) {
-            // Reset horizontal velocity
-            vel.x = 0.0f;
+private:
+    // Recursive descent over the current line, each function returns the register holding its result or -1 on error
+    // Precedence from lowest: comparisons, + and -, * and /, unary minus
+
+    int Expression(string& error) {
+        int left = Sum(error);
+        if (left < 0) { return -1; }
+        SkipSpace();
+        BehaviourOp op;
+        if (Match("<=")) { op = BehaviourOp::LESS_EQUAL; }
+        else if (Match(">=")) { op = BehaviourOp::GREATER_EQUAL; }
+        else if (Match("<")) { op = BehaviourOp::LESS; }
+        else if (Match(">")) { op = BehaviourOp::GREATER; }
+        else { return left; }
+
+        int right = Sum(error);
+        return right < 0 ? -1 : EmitTemporary(op, left, right, error);
+    }
+
+    int Sum(string& error) {
+        int left = Product(error);
+        while (left >= 0) {
+            SkipSpace();
+            BehaviourOp op;
+            if (Match("+")) { op = BehaviourOp::ADD; }
+            else if (Match("-")) { op = BehaviourOp::SUBTRACT; }
+            else { break; }
+
+            int right = Product(error);
+            left = right < 0 ? -1 : EmitTemporary(op, left, right, error);
+        }
+        return left;
+    }
+
+    int Product(string& error) {
+        int left = Unary(error);
+        while (left >= 0) {
+            SkipSpace();
+            BehaviourOp op;
+            if (Match("*")) { op = BehaviourOp::MULTIPLY; }
+            else if (Match("/")) { op = BehaviourOp::DIVIDE; }
+            else { break; }
+
+            int right = Unary(error);
+            left = right < 0 ? -1 : EmitTemporary(op, left, right, error);
+        }
+        return left;
+    }
+
+    int Unary(string& error) {
+        SkipSpace();
+        if (Match("-")) {
+            // Negative numbers are constants rather than a negated constant
+            SkipSpace();
+            if (position < text.size() && (isdigit((unsigned char)text[position]) || text[position] == '.')) {
+                return Number(true, error);
+            }
+            int value = Unary(error);
+            return value < 0 ? -1 : EmitTemporary(BehaviourOp::NEGATE, value, 0, error);
+        }
+        return Primary(error);
+    }
+
+    int Primary(string& error) {
+        SkipSpace();
+        if (Match("(")) {
+            int value = Expression(error);
+            if (value < 0) { return -1; }
+            if (!Expect(')')) {
+                error = "expected ')'";
+                return -1;
+            }
+            return value;
+        }
+        if (position < text.size() && (isdigit((unsigned char)text[position]) || text[position] == '.')) {
+            return Number(false, error);
+        }
+
+        string name;
+        if (!ReadName(name)) {
+            error = position < text.size() ? "unexpected '" + text.substr(position, 1) + "'" : "expected a value";
+            return -1;
+        }
+        SkipSpace();
+        if (Match("(")) {
+            return Call(name, error);
+        }
+
+        int input = FindInput(name);
+        if (input != -1) { return input; }
+        int value = FindLocal(name);
+        if (value == -1) {
+            error = "unknown name '" + name + "'";
+        }
+        return value;
+    }
+
+    int Call(const string& name, string& error) {
+        vector<int> arguments;
+        SkipSpace();
+        if (!Match(")")) {
+            do {
+                int argument = Expression(error);
+                if (argument < 0) { return -1; }
+                arguments.push_back(argument);
+                SkipSpace();
+            } while (Match(","));
+            if (!Expect(')')) {
+                error = "expected ')' after the arguments to '" + name + "'";
+                return -1;
+            }
+        }
+
+        size_t expected = name == "select" ? 3 : name == "abs" ? 1 : name == "min" || name == "max" ? 2 : 0;
+        if (expected == 0) {
+            error = "unknown function '" + name + "'";
+            return -1;
+        }
+        if (arguments.size() != expected) {
+            error = "'" + name + "' takes " + to_string(expected) + " arguments";
+            return -1;
+        }
+
+        if (name == "select") { return EmitTemporary(BehaviourOp::SELECT, arguments[0], arguments[1], error, arguments[2]); }
+        if (name == "abs") { return EmitTemporary(BehaviourOp::ABS, arguments[0], 0, error); }
+        return EmitTemporary(name == "min" ? BehaviourOp::MIN : BehaviourOp::MAX, arguments[0], arguments[1], error);
+    }
+
+    int Number(bool negative, string& error) {
+        const char* start = text.c_str() + position;
+        char* end = nullptr;
+        float value = strtof(start, &end);
+        if (end == start) {
+            error = "expected a number";
+            return -1;
+        }
+        position += end - start;
+        return EmitTemporary(BehaviourOp::LOAD_CONSTANT, 0, 0, error, 0, negative ? -value : value);
+    }
+
+    // Result of an instruction goes into the next free temporary register
+    int EmitTemporary(BehaviourOp op, int a, int b, string& error, int c = 0, float constant = 0.0f) {
+        if (nextRegister >= MAX_REGISTERS) {
+            error = "needs more than " + to_string(MAX_REGISTERS) + " registers";
+            return -1;
+        }
+        Emit(op, nextRegister, a, b, c, constant);
+        registerCount = max(registerCount, nextRegister + 1);
+        return nextRegister++;
+    }
+
+    void Emit(BehaviourOp op, int dst, int a, int b = 0, int c = 0, float constant = 0.0f) {
+        code.push_back(BehaviourInstruction{ op, (uint8_t)dst, (uint8_t)a, (uint8_t)b, (uint8_t)c, constant });
+    }
+
+    static int FindInput(const string& name) {
+        for (int i = 0; i < (int)BehaviourInput::COUNT; i++) {
+            if (name == BEHAVIOUR_INPUT_NAMES[i]) { return i; }
+        }
+        return -1;
+    }
+
+    int FindLocal(const string& name) {
+        for (auto& local : locals) {
+            if (local.first == name) { return local.second; }
+        }
+        return -1;
+    }
+
+    // Skip spaces, returns true if anything is left on the line
+    bool SkipSpace() {
+        while (position < text.size() && isspace((unsigned char)text[position])) { position++; }
+        return position < text.size();
+    }
+
+    bool Match(const char* token) {
+        size_t length = strlen(token);
+        if (text.compare(position, length, token) != 0) { return false; }
+        position += length;
+        return true;
+    }
+
+    bool Expect(char token) {
+        SkipSpace();
+        if (position == text.size() || text[position] != token) { return false; }
+        position++;
+        return true;
+    }
+
+    bool ReadName(string& name) {
+        SkipSpace();
+        size_t start = position;
+        while (position < text.size() && (isalnum((unsigned char)text[position]) || text[position] == '_')) { position++; }
+        name = text.substr(start, position - start);
+        return !name.empty() && !isdigit((unsigned char)name[0]);
+    }
+
+    string scriptName;
+    vector<BehaviourInstruction> code;
+    int registerCount;
+    bool flying;
+
+    // Only used while compiling, inputs and assigned names get fixed registers and temporaries come after them
+    int namedRegisters;
+    vector<pair<string, int>> locals;
+    string text;
+    size_t position;
+    int nextRegister;
+};
+
+// Load and compile a behaviour script, exiting with the error if it cant be (like a missing level file)
+shared_ptr<const BehaviourScript> loadBehaviourScript(const string& directory, const string& name) {
+    string fileName = directory + name;
+    ifstream file(fileName);
+    if (!file.is_open()) {
+        cerr << "File '" << fileName << "' could not be opened. Closing program..." << endl;
+        exit(EXIT_FAILURE);
+    }
+    stringstream source;
+    source << file.rdbuf();
+
+    auto script = make_shared<BehaviourScript>(name);
+    string error;
+    if (!script->Compile(source.str(), error)) {
+        cerr << "Behaviour script '" << fileName << "' could not be compiled, " << error << ". Closing program..." << endl;
+        exit(EXIT_FAILURE);
+    }
+    return script;
+}
+
+struct EnemySpawn {
+    string type;
+    int x, y, w, h, health;
+    // Chases the player with this script instead of the built in behaviour for its type
+    shared_ptr<const BehaviourScript> behaviour;
+};
+
+// Load enemy spawns from json file (enemies themselves are created per world), type picks the built in behaviour
+// unless a behaviour script is given
+vector<EnemySpawn> loadEnemySpawns(const string& fileName) {
+    ifstream file(fileName);
+    if (!file.is_open()) {
+        cerr << "File '" << fileName << "' could not be opened. Closing program..." << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    json data;
+    file >> data;
+
+    vector<EnemySpawn> spawns;
+    spawns.reserve(data.size());
+
+    // Scripts are relative to the level directory, and each is only compiled once so enemies using it run together
+    string directory = fileName.substr(0, fileName.find_last_of('/') + 1);
+    vector<shared_ptr<const BehaviourScript>> scripts;
+
+    for (auto& entry : data) {
+        string type = entry["type"].get<string>();
+        int x = entry["x"].get<int>();
+        int y = Constants::FLOOR_LEVEL - entry["y"].get<int>();
+        int w = entry["w"].get<int>();
+        int h = entry["h"].get<int>();
+        int health = entry["health"].get<int>();
+        // Enemies keep their health in 16 bits
+        if (health < 1 || health > INT16_MAX) {
+            int clamped = max(1, min((int)INT16_MAX, health));
+            cerr << "Enemy health " << health << " in '" << fileName << "' is out of range, using " << clamped << "." << endl;
+            health = clamped;
+        }
+
+        shared_ptr<const BehaviourScript> behaviour;
+        if (entry.contains("behaviour")) {
+            string name = entry["behaviour"].get<string>();
+            for (auto& script : scripts) {
+                if (script->getName() == name) { behaviour = script; }
+            }
+            if (!behaviour) {
+                behaviour = loadBehaviourScript(directory, name);
+                scripts.push_back(behaviour);
+            }
+        }
+
+        spawns.push_back(EnemySpawn{ type, x, y, w, h, health, behaviour });
+    }
+
+    return spawns;
+}
+
+// Moving platform that loops through a list of waypoints (two waypoints make an elevator or back and forth patrol)
+struct MovingPlatformPath {
+    int w, h;
+    float speed;
+    vector<Vector2> waypoints;
+};
+
+// Load moving platforms from json file (optional, levels without one have no moving platforms)
+vector<MovingPlatformPath> loadMovingPlatforms(const string& fileName) {
+    vector<MovingPlatformPath> paths;
+
+    ifstream file(fileName);
+    if (!file.is_open()) {
+        return paths;
+    }
+
+    json data;
+    file >> data;
+    paths.reserve(data.size());
+
+    for (auto& entry : data) {
+        MovingPlatformPath path = { entry["w"].get<int>(), entry["h"].get<int>(), entry["speed"].get<float>(), {} };
+        for (auto& point : entry["path"]) {
+            path.waypoints.push_back(Vector2{ point["x"].get<float>(), (float)(Constants::FLOOR_LEVEL - point["y"].get<int>()) });
+        }
+
+        if (path.waypoints.empty()) {
+            cerr << "Moving platform in '" << fileName << "' has no path, skipping." << endl;
+            continue;
+        }
+        paths.push_back(path);
+    }
+
+    return paths;
+}
+
+// Trigger volume types, kill zones kill anything entering them, the rest only react to the player
+enum class TriggerType { KILL, CHECKPOINT, MUSIC, SPAWNER, GOAL, COUNT };
+
+const char* const TRIGGER_TYPE_NAMES[] = { "Kill", "Checkpoint", "Music", "Spawner", "Goal" };
+
+struct TriggerVolume {
+    TriggerType type;
+    SDL_Rect area;
+    string music;           // Music file to play whilst inside (music regions)
+    vector<int> enemies;    // Enemies kept dormant until the player enters (spawner activators)
+    bool coins;             // Every coin must be collected before the level is won (goals)
+};
+
+// Load trigger volumes from json file (optional, levels without one have no triggers)
+vector<TriggerVolume> loadTriggers(const string& fileName) {
+    vector<TriggerVolume> triggers;
+
+    ifstream file(fileName);
+    if (!file.is_open()) {
+        return triggers;
+    }
+
+    json data;
+    file >> data;
+    triggers.reserve(data.size());
+
+    for (auto& entry : data) {
+        TriggerVolume trigger;
+        string type = entry["type"].get<string>();
+        if (type == "Kill") { trigger.type = TriggerType::KILL; }
+        else if (type == "Checkpoint") { trigger.type = TriggerType::CHECKPOINT; }
+        else if (type == "Music") { trigger.type = TriggerType::MUSIC; }
+        else if (type == "Spawner") { trigger.type = TriggerType::SPAWNER; }
+        else if (type == "Goal") { trigger.type = TriggerType::GOAL; }
+        else {
+            cerr << "Unknown trigger type '" << type << "' in '" << fileName << "', skipping." << endl;
+            continue;
+        }
+
+        int x = entry["x"].get<int>();
+        int y = Constants::FLOOR_LEVEL - entry["y"].get<int>();
+        trigger.area = { x, y, entry["w"].get<int>(), entry["h"].get<int>() };
+        trigger.music = entry.value("music", "");
+        trigger.enemies = entry.value("enemies", vector<int>());
+        trigger.coins = entry.value("coins", false);
+
+        triggers.push_back(trigger);
+    }
+
+    return triggers;
+}
+
+// Background layer scrolled at a fraction of the camera's speed, either a bmp image or a generated hill silhouette
+struct BackgroundLayer {
+    string image;
+    float factor;           // 0 is fixed to the screen, 1 moves with the level
+    int y;                  // Screen position of the top of the layer when the camera is at the start
+    int height;             // Generated layers only
+    int amplitude;          // Generated layers only, height of the hills
+    int seed;               // Generated layers only
+    SDL_Color colour;       // Generated layers only, also fills the screen below the layer
+};
+
+// Load background layers from json file, furthest layer first (optional, levels without one have a flat background)
+vector<BackgroundLayer> loadBackgroundLayers(const string& fileName) {
+    vector<BackgroundLayer> layers;
+
+    ifstream file(fileName);
+    if (!file.is_open()) {
+        return layers;
+    }
+
+    json data;
+    file >> data;
+    layers.reserve(data.size());
+
+    for (auto& entry : data) {
+        BackgroundLayer layer;
+        layer.image = entry.value("image", "");
+        layer.factor = entry["factor"].get<float>();
+        layer.y = entry["y"].get<int>();
+        layer.height = entry.value("height", 256);
+        layer.amplitude = entry.value("amplitude", 64);
+        layer.seed = entry.value("seed", 0);
+        vector<int> colour = entry.value("colour", vector<int>{ 0, 0, 0 });
+        layer.colour = { (Uint8)colour[0], (Uint8)colour[1], (Uint8)colour[2], 255 };
+
+        layers.push_back(layer);
+    }
+
+    return layers;
+}
+
+// Hazard fluids, water drowns anything whose head goes under and lava burns anything touching it
+enum class HazardType { WATER, LAVA, COUNT };
+
+// Fluid placed when the level starts, sources keep refilling their area (flooding set pieces)
+struct HazardVolume {
+    HazardType type;
+    SDL_Rect area;
+    bool source;
+};
+
+// Load hazard fluids from json file (optional, levels without one have no hazards)
+vector<HazardVolume> loadHazards(const string& fileName) {
+    vector<HazardVolume> hazards;
+
+    ifstream file(fileName);
+    if (!file.is_open()) {
+        return hazards;
+    }
+
+    json data;
+    file >> data;
+    hazards.reserve(data.size());
+
+    for (auto& entry : data) {
+        HazardVolume hazard;
+        string type = entry["type"].get<string>();
+        if (type == "Water") { hazard.type = HazardType::WATER; }
+        else if (type == "Lava") { hazard.type = HazardType::LAVA; }
+        else {
+            cerr << "Unknown hazard type '" << type << "' in '" << fileName << "', skipping." << endl;
+            continue;
+        }
+
+        int x = entry["x"].get<int>();
+        int y = Constants::FLOOR_LEVEL - entry["y"].get<int>();
+        hazard.area = { x, y, entry["w"].get<int>(), entry["h"].get<int>() };
+        hazard.source = entry.value("source", false);
+
+        hazards.push_back(hazard);
+    }
+
+    return hazards;
+}
+
+// Read-only level data, shared between every world simulating it
+struct Level {
+    vector<SDL_Rect> platforms;
+    vector<bool> platformBreakable;
+    vector<MovingPlatformPath> movingPlatforms;
+    vector<Coin> coins;
+    vector<EnemySpawn> enemySpawns;
+    vector<TriggerVolume> triggers;
+    vector<BackgroundLayer> backgroundLayers;
+    vector<HazardVolume> hazards;
+};
+
+// Load the level from the json files in the given directory
+shared_ptr<const Level> loadLevel(const string& directory) {
+    auto level = make_shared<Level>();
+    level->platforms = loadPlatforms(directory + "/platforms.json", level->platformBreakable);
+    level->movingPlatforms = loadMovingPlatforms(directory + "/moving_platforms.json");
+    level->coins = loadCoins(directory + "/coins.json");
+    level->enemySpawns = loadEnemySpawns(directory + "/enemies.json");
+    level->triggers = loadTriggers(directory + "/triggers.json");
+    level->backgroundLayers = loadBackgroundLayers(directory + "/background.json");
+    level->hazards = loadHazards(directory + "/hazards.json");
+    return level;
+}
+
+// Write a json array of objects in the same layout as the level files, entries are written straight into one
+// buffer as building a json document first is far slower for large levels
+template<typename WriteEntry>
+bool saveJsonArray(const string& fileName, size_t count, WriteEntry writeEntry) {
+    string text = "[\n";
+    text.reserve(count * 96 + 4);
+    for (size_t i = 0; i < count; i++) {
+        text += "    {\n";
+        writeEntry(text, i);
+        text += i + 1 < count ? "    },\n" : "    }\n";
+    }
+    text += "]";
+
+    ofstream file(fileName, ios::binary);
+    if (!file.is_open()) {
+        cerr << "File '" << fileName << "' could not be saved." << endl;
+        return false;
+    }
+    file.write(text.data(), text.size());
+    return (bool)file;
+}
+
+void appendJsonField(string& text, const char* name, const string& value, bool last = false) {
+    text += "        \"";
+    text += name;
+    text += "\": ";
+    text += value;
+    text += last ? "\n" : ",\n";
+}
+
+// Save platforms, coins, enemies and triggers back to the json files in the given directory (y is stored up from the floor)
+bool saveLevel(const Level& level, const string& directory) {
+    bool saved = saveJsonArray(directory + "/platforms.json", level.platforms.size(), [&](string& text, size_t i) {
+        const SDL_Rect& platform = level.platforms[i];
+        bool breakable = level.platformBreakable[i];
+        appendJsonField(text, "x", to_string(platform.x));
+        appendJsonField(text, "y", to_string(Constants::FLOOR_LEVEL - platform.y));
+        appendJsonField(text, "w", platform.w == Constants::LEVEL_WIDTH ? "\"LEVEL_WIDTH\"" : to_string(platform.w));
+        appendJsonField(text, "h", to_string(platform.h), !breakable);
+        if (breakable) {
+            appendJsonField(text, "breakable", "true", true);
+        }
+    });
+
+    saved = saveJsonArray(directory + "/coins.json", level.coins.size(), [&](string& text, size_t i) {
+        const Coin& coin = level.coins[i];
+        appendJsonField(text, "x", to_string(coin.body.x));
+        appendJsonField(text, "y", to_string(Constants::FLOOR_LEVEL - coin.body.y), true);
+    }) && saved;
+
+    saved = saveJsonArray(directory + "/enemies.json", level.enemySpawns.size(), [&](string& text, size_t i) {
+        const EnemySpawn& spawn = level.enemySpawns[i];
+        appendJsonField(text, "type", json(spawn.type).dump());
+        appendJsonField(text, "x", to_string(spawn.x));
+        appendJsonField(text, "y", to_string(Constants::FLOOR_LEVEL - spawn.y));
+        appendJsonField(text, "w", to_string(spawn.w));
+        appendJsonField(text, "h", to_string(spawn.h));
+        appendJsonField(text, "health", to_string(spawn.health), !spawn.behaviour);
+        if (spawn.behaviour) {
+            appendJsonField(text, "behaviour", json(spawn.behaviour->getName()).dump(), true);
+        }
+    }) && saved;
+
+    // Spawners name enemies by index, which removing an enemy changes, so triggers are saved with them
+    if (!level.triggers.empty()) {
+        saved = saveJsonArray(directory + "/triggers.json", level.triggers.size(), [&](string& text, size_t i) {
+            const TriggerVolume& trigger = level.triggers[i];
+            appendJsonField(text, "type", json(TRIGGER_TYPE_NAMES[(int)trigger.type]).dump());
+            appendJsonField(text, "x", to_string(trigger.area.x));
+            appendJsonField(text, "y", to_string(Constants::FLOOR_LEVEL - trigger.area.y));
+            appendJsonField(text, "w", to_string(trigger.area.w));
+            bool last = trigger.music.empty() && trigger.enemies.empty() && !trigger.coins;
+            appendJsonField(text, "h", to_string(trigger.area.h), last);
+            if (!trigger.music.empty()) {
+                last = trigger.enemies.empty() && !trigger.coins;
+                appendJsonField(text, "music", json(trigger.music).dump(), last);
+            }
+            if (!trigger.enemies.empty()) {
+                appendJsonField(text, "enemies", json(trigger.enemies).dump(), !trigger.coins);
+            }
+            if (trigger.coins) {
+                appendJsonField(text, "coins", "true", true);
+            }
+        }) && saved;
+    }
+
+    return saved;
+}
+
+// Load player data from json file
+PlayerData loadPlayerFile(const string& fileName) {
+    ifstream file(fileName);
+    if (!file.is_open()) {
+        cerr << "File '" << fileName << "' could not be opened." << endl;
+        // Restore default player data
+        return PlayerData{ 100, 250, 10 };
+    }
+
+    json data;
+    file >> data;
+
+    int x = data[0]["x"].get<int>();
+    int y = data[0]["y"].get<int>();
+    int health = data[0]["health"].get<int>();
+
+    return PlayerData{ x, y, health };
+}
+
+// Save player data to json file
+void savePlayerFile(const string& fileName, Vector2 pos, int health) {
+    json data = json::array();
+    data.push_back({ {"x", (int)pos.x}, {"y", (int)pos.y}, {"health", health} });
+
+    ofstream file(fileName);
+    if (!file.is_open()) {
+        cerr << "Player data failed to save." << endl;
+        return;
+    }
+
+    file << data.dump(4);
+}
+
+// Every sprite in the atlas
+enum class SpriteId { PLAYER, ATTACK, MELEE_ENEMY, FLYING_ENEMY, COIN, PLATFORM, PLATFORM_BREAKABLE, HEALTH, COUNT };
+
+const char* const SPRITE_NAMES[] = { "player", "attack", "melee_enemy", "flying_enemy", "coin", "platform", "platform_breakable", "health" };
+
+// Animation clips, each is a run of frames from one sprite's strip
+enum class AnimationClipId {
+    PLAYER_IDLE, PLAYER_RUN, PLAYER_AIRBORNE, PLAYER_DASH, PLAYER_ATTACK, PLAYER_KNOCKBACK,
+    MELEE_IDLE, MELEE_WALK, MELEE_KNOCKBACK,
+    FLYING_HOVER, FLYING_KNOCKBACK,
+    COUNT
+};
+
+// Clip data is shared by every instance and never changes
+struct AnimationClip {
+    SpriteId sprite;
+    int firstFrame;
+    int frameCount;
+    float frameTime;
+    bool loop;
+};
+
+constexpr AnimationClip ANIMATION_CLIPS[] = {
+    { SpriteId::PLAYER, 0, 4, 0.2f, true },             // PLAYER_IDLE
+    { SpriteId::PLAYER, 4, 6, 0.08f, true },            // PLAYER_RUN
+    { SpriteId::PLAYER, 10, 2, 0.15f, true },           // PLAYER_AIRBORNE
+    { SpriteId::PLAYER, 12, 3, 0.1f, false },           // PLAYER_DASH
+    { SpriteId::PLAYER, 15, 3, 0.05f, false },          // PLAYER_ATTACK
+    { SpriteId::PLAYER, 18, 2, 0.05f, true },           // PLAYER_KNOCKBACK
+    { SpriteId::MELEE_ENEMY, 0, 2, 0.3f, true },        // MELEE_IDLE
+    { SpriteId::MELEE_ENEMY, 2, 6, 0.1f, true },        // MELEE_WALK
+    { SpriteId::MELEE_ENEMY, 8, 2, 0.05f, true },       // MELEE_KNOCKBACK
+    { SpriteId::FLYING_ENEMY, 0, 4, 0.1f, true },       // FLYING_HOVER
+    { SpriteId::FLYING_ENEMY, 4, 2, 0.05f, true },      // FLYING_KNOCKBACK
+};
+static_assert(sizeof(ANIMATION_CLIPS) / sizeof(ANIMATION_CLIPS[0]) == (size_t)AnimationClipId::COUNT, "Every clip needs data");
+
+// Frames a sprite's strip needs to hold every clip that uses it
+constexpr int spriteFrameCount(SpriteId sprite) {
+    int frames = 1;
+    for (const AnimationClip& clip : ANIMATION_CLIPS) {
+        if (clip.sprite == sprite && clip.firstFrame + clip.frameCount > frames) {
+            frames = clip.firstFrame + clip.frameCount;
+        }
+    }
+    return frames;
+}
+
+// Position of one sprite frame in the atlas, in texture coordinates
+struct Sprite {
+    float u0, v0, u1, v1;
+    bool fromImage;     // Generated sprites are white and take their colour from the batch, images keep their own
+};
+
+// Every sprite packed into one texture at load time, so a frame's sprites can share one draw call. Sprites are
+// bmp images named in a json file (animated sprites are a horizontal strip of equal frames), anything not named
+// or that fails to load gets a white placeholder
+class SpriteAtlas {
+public:
+    static constexpr int MIN_WIDTH = 512;
+    static constexpr int PLACEHOLDER_SIZE = 32;
+    // Gap between packed sprites so filtering never samples a neighbour
+    static constexpr int PADDING = 1;
+
+    SpriteAtlas() :
+        texture(nullptr)
+    {
+    };
+
+    void Load(SDL_Renderer* renderer, const string& fileName) {
+        Release();
+
+        json data;
+        ifstream file(fileName);
+        if (file.is_open()) {
+            file >> data;
+        }
+
+        // Load or generate every sprite
+        SDL_Surface* surfaces[(int)SpriteId::COUNT];
+        bool fromImage[(int)SpriteId::COUNT];
+        for (int i = 0; i < (int)SpriteId::COUNT; i++) {
+            surfaces[i] = nullptr;
+            fromImage[i] = false;
+            frameCounts[i] = spriteFrameCount((SpriteId)i);
+
+            if (data.contains(SPRITE_NAMES[i])) {
+                const json& entry = data[SPRITE_NAMES[i]];
+                string image = entry.is_string() ? entry.get<string>() : entry["image"].get<string>();
+                int frames = entry.is_string() ? 1 : entry.value("frames", 1);
+
+                SDL_Surface* loaded = SDL_LoadBMP(("Files/" + image).c_str());
+                if (!loaded) {
+                    cerr << "Failed to load sprite '" << image << "': " << SDL_GetError() << endl;
+                }
+                else if (frames < frameCounts[i]) {
+                    cerr << "Sprite '" << image << "' has " << frames << " frames but its animations need " << frameCounts[i] << "." << endl;
+                    SDL_FreeSurface(loaded);
+                }
+                else {
+                    surfaces[i] = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+                    SDL_FreeSurface(loaded);
+                    fromImage[i] = surfaces[i] != nullptr;
+                    frameCounts[i] = frames;
+                }
+            }
+            if (!surfaces[i]) {
+                surfaces[i] = CreatePlaceholder((SpriteId)i, frameCounts[i]);
+            }
+        }
+
+        // Shelf pack tallest first, each shelf is as tall as its first sprite
+        int order[(int)SpriteId::COUNT];
+        int width = MIN_WIDTH;
+        for (int i = 0; i < (int)SpriteId::COUNT; i++) {
+            order[i] = i;
+            while (surfaces[i] && surfaces[i]->w + PADDING * 2 > width) { width *= 2; }
+        }
+        sort(order, order + (int)SpriteId::COUNT, [&](int a, int b) {
+            return (surfaces[a] ? surfaces[a]->h : 0) > (surfaces[b] ? surfaces[b]->h : 0);
+        });
+
+        SDL_Rect placed[(int)SpriteId::COUNT] = {};
+        int x = 0, y = 0, shelfHeight = 0;
+        for (int i : order) {
+            if (!surfaces[i]) { continue; }
+            int w = surfaces[i]->w + PADDING * 2;
+            int h = surfaces[i]->h + PADDING * 2;
+            if (x + w > width) {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            placed[i] = { x + PADDING, y + PADDING, surfaces[i]->w, surfaces[i]->h };
+            x += w;
+            shelfHeight = max(shelfHeight, h);
+        }
+        int height = 1;
+        while (height < y + shelfHeight) { height *= 2; }
+
+        SDL_Surface* atlas = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+        if (atlas) {
+            SDL_SetSurfaceBlendMode(atlas, SDL_BLENDMODE_NONE);
+            SDL_FillRect(atlas, nullptr, 0);
+        }
+
+        frames.clear();
+        for (int i = 0; i < (int)SpriteId::COUNT; i++) {
+            firstFrames[i] = (int)frames.size();
+            if (!surfaces[i]) {
+                frames.push_back(Sprite{ 0.0f, 0.0f, 0.0f, 0.0f, false });
+                frameCounts[i] = 1;
+                continue;
+            }
+            if (atlas) {
+                SDL_SetSurfaceBlendMode(surfaces[i], SDL_BLENDMODE_NONE);
+                SDL_BlitSurface(surfaces[i], nullptr, atlas, &placed[i]);
+            }
+
+            // Sample half a texel in from the edge of each frame
+            int frameWidth = placed[i].w / frameCounts[i];
+            for (int frame = 0; frame < frameCounts[i]; frame++) {
+                int frameX = placed[i].x + frame * frameWidth;
+                frames.push_back(Sprite{
+                    (frameX + 0.5f) / width, (placed[i].y + 0.5f) / height,
+                    (frameX + frameWidth - 0.5f) / width, (placed[i].y + placed[i].h - 0.5f) / height,
+                    fromImage[i]
+                });
+            }
+            SDL_FreeSurface(surfaces[i]);
+        }
+
+        if (atlas) {
+            texture = SDL_CreateTextureFromSurface(renderer, atlas);
+            SDL_FreeSurface(atlas);
+        }
+        if (texture) {
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        }
+        else {
+            cerr << "Sprite atlas could not be created, sprites will be drawn as flat colours." << endl;
+        }
+    }
+
+    void Release() {
+        if (texture) {
+            SDL_DestroyTexture(texture);
+            texture = nullptr;
+        }
+    }
+
+    const Sprite& Get(SpriteId sprite, int frame = 0) const {
+        return frames[firstFrames[(int)sprite] + frame % frameCounts[(int)sprite]];
+    }
+    SDL_Texture* getTexture() const { return texture; }
+
+private:
+    // White square (or circle for round things), animated strips get a faint band that moves down each frame
+    static SDL_Surface* CreatePlaceholder(SpriteId sprite, int frameCount) {
+        SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, PLACEHOLDER_SIZE * frameCount, PLACEHOLDER_SIZE, 32, SDL_PIXELFORMAT_RGBA32);
+        if (!surface) { return nullptr; }
+
+        bool round = sprite == SpriteId::COIN;
+        float centre = PLACEHOLDER_SIZE / 2.0f;
+        for (int y = 0; y < PLACEHOLDER_SIZE; y++) {
+            Uint32* row = (Uint32*)((Uint8*)surface->pixels + y * surface->pitch);
+            for (int x = 0; x < PLACEHOLDER_SIZE * frameCount; x++) {
+                int frame = x / PLACEHOLDER_SIZE;
+                float dx = x % PLACEHOLDER_SIZE + 0.5f - centre, dy = y + 0.5f - centre;
+                bool inside = !round || dx * dx + dy * dy <= centre * centre;
+                bool band = frameCount > 1 && y / 4 == frame % (PLACEHOLDER_SIZE / 4);
+
+                Uint8 shade = band ? 220 : 255;
+                Uint8 pixel[4] = { shade, shade, shade, (Uint8)(inside ? 255 : 0) };
+                memcpy(&row[x], pixel, sizeof(pixel));
+            }
+        }
+        return surface;
+    }
+
+    vector<Sprite> frames;
+    int firstFrames[(int)SpriteId::COUNT];
+    int frameCounts[(int)SpriteId::COUNT];
+    SDL_Texture* texture;
+};
+
+// Collects a frame's sprites as textured quads and submits them with one SDL_RenderGeometry call
+class SpriteBatch {
+public:
+    SpriteBatch() :
+        atlas(nullptr),
+        batching(true)
+    {
+    };
+
+    void setAtlas(const SpriteAtlas* spriteAtlas) { atlas = spriteAtlas; }
+    // Unbatched, each quad is drawn with its own call (to measure what batching saves)
+    void setBatching(bool enabled) { batching = enabled; }
+    bool getBatching() { return batching; }
+
+    void Add(SpriteId spriteId, const SDL_Rect& rect, SDL_Color colour, int frame = 0, bool flip = false) {
+        float u0 = 0.0f, v0 = 0.0f, u1 = 0.0f, v1 = 0.0f;
+        if (atlas && atlas->getTexture()) {
+            const Sprite& sprite = atlas->Get(spriteId, frame);
+            u0 = sprite.u0; v0 = sprite.v0; u1 = sprite.u1; v1 = sprite.v1;
+            if (sprite.fromImage) {
+                colour = SDL_Color{ 255, 255, 255, colour.a };
+            }
+            if (flip) { swap(u0, u1); }
+        }
+
+        float left = (float)rect.x, top = (float)rect.y;
+        float right = (float)(rect.x + rect.w), bottom = (float)(rect.y + rect.h);
+        int first = (int)vertices.size();
+        vertices.push_back({ { left, top }, colour, { u0, v0 } });
+        vertices.push_back({ { right, top }, colour, { u1, v0 } });
+        vertices.push_back({ { right, bottom }, colour, { u1, v1 } });
+        vertices.push_back({ { left, bottom }, colour, { u0, v1 } });
+
+        const int quad[] = { 0, 1, 2, 0, 2, 3 };
+        for (int index : quad) {
+            indices.push_back(first + index);
+        }
+    }
+
+    // Draw everything added since the last flush (without an atlas the quads are flat colours)
+    void Flush(SDL_Renderer* renderer) {
+        if (vertices.empty()) { return; }
+
+        SDL_Texture* texture = atlas ? atlas->getTexture() : nullptr;
+        if (!texture) {
+            SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+        }
+        if (batching) {
+            SDL_RenderGeometry(renderer, texture, vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size());
+            metrics.Increment(Counter::DRAW_CALLS);
+        }
+        else {
+            for (size_t quad = 0; quad < indices.size(); quad += 6) {
+                SDL_RenderGeometry(renderer, texture, vertices.data(), (int)vertices.size(), &indices[quad], 6);
+                metrics.Increment(Counter::DRAW_CALLS);
+            }
+        }
+        if (!texture) {
+            SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+        }
+
+        vertices.clear();
+        indices.clear();
+    }
+
+private:
+    const SpriteAtlas* atlas;
+    bool batching;
+    vector<SDL_Vertex> vertices;
+    vector<int> indices;
+};
+
+// Playback state for every animated instance, stored as parallel arrays and advanced together in one pass
+class AnimationSystem {
+public:
+    // Add an instance, returning its index
+    int Add(AnimationClipId clip) {
+        clips.push_back((uint8_t)clip);
+        times.push_back(0.0f);
+        frames.push_back((uint16_t)ANIMATION_CLIPS[(int)clip].firstFrame);
+        return (int)clips.size() - 1;
+    }
+
+    void Clear() {
+        clips.clear();
+        times.clear();
+        frames.clear();
+    }
+
+    // Switch an instance to a clip, restarting it only if it changed
+    void Play(int instance, AnimationClipId clip) {
+        if (clips[instance] != (uint8_t)clip) {
+            clips[instance] = (uint8_t)clip;
+            times[instance] = 0.0f;
+        }
+    }
+
+    // Advance every instance and work out the sprite frame each is showing
+    void Update(float deltaTime) {
+        size_t count = clips.size();
+        for (size_t i = 0; i < count; i++) {
+            const AnimationClip& clip = ANIMATION_CLIPS[clips[i]];
+            float time = times[i] + deltaTime;
+            int frame = (int)(time / clip.frameTime);
+            if (frame >= clip.frameCount) {
+                if (clip.loop) {
+                    // Keep time within one loop so it never loses precision
+                    time = fmodf(time, clip.frameTime * clip.frameCount);
+                    frame = (int)(time / clip.frameTime) % clip.frameCount;
+                }
+                else {
+                    frame = clip.frameCount - 1;
+                }
+            }
+            times[i] = time;
+            frames[i] = (uint16_t)(clip.firstFrame + frame);
+        }
+    }
+
+    int getFrame(int instance) const { return frames[instance]; }
+    int getCount() const { return (int)clips.size(); }
+
+private:
+    vector<uint8_t> clips;
+    vector<float> times;
+    vector<uint16_t> frames;
+};
+
+// Use enum class to store attack direction, as it is more efficient than a string
+enum class AttackDirection : uint8_t { UP, DOWN, LEFT, RIGHT };
+
+// Player body position, animation frame and state for one tick of a recorded run (level coordinates fit in 16 bits)
+struct GhostSample {
+    static constexpr uint8_t FACING_LEFT = 1 << 0;
+    static constexpr uint8_t ATTACKING = 1 << 1;
+    static constexpr uint8_t DAMAGED = 1 << 2;
+    // Attack direction is kept in the top two bits
+    static constexpr int ATTACK_SHIFT = 6;
+
+    int16_t x, y;
+    uint8_t frame;
+    uint8_t flags;
+};
+
+// Buttons held for one tick, kept separate from SDL so headless simulations and bots can drive the player
+struct PlayerInput {
+    bool left, right, up, down;
+    bool jump, dash, attack;
+};
+
+// Read player input from keyboard and controller
+PlayerInput readPlayerInput(const Uint8* keystate, SDL_GameController* controller) {
+    PlayerInput input = {};
+
+    // Players without the keyboard pass no keystate
+    if (keystate) {
+        input = {
+            (bool)keystate[SDL_SCANCODE_A], (bool)keystate[SDL_SCANCODE_D],
+            (bool)keystate[SDL_SCANCODE_W], (bool)keystate[SDL_SCANCODE_S],
+            (bool)keystate[SDL_SCANCODE_SPACE], (bool)keystate[SDL_SCANCODE_LSHIFT], (bool)keystate[SDL_SCANCODE_E]
+        };
+    }
+
+    if (controller) {
+        float leftStickXAxis = SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTX) / 32767.0f;
+        float leftStickYAxis = SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTY) / 32767.0f;
+
+        // Leave slight deadzone on stick input
+        if (leftStickXAxis < -0.2f) { input.left = true; }
+        if (leftStickXAxis > 0.2f) { input.right = true; }
+        if (leftStickYAxis < -0.5f) { input.up = true; }
+        if (leftStickYAxis > 0.5f) { input.down = true; }
+
+        if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_A)) { input.jump = true; }
+        if (SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_TRIGGERRIGHT)) { input.dash = true; }
+        if (SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_X)) { input.attack = true; }
+    }
+
+    return input;
+}
+
+
+// Player state read and written every tick, packed into one cache line so the simulation touches nothing else
+// Flags share a byte instead of padding out the floats they used to sit between
+struct alignas(64) PlayerState {
+    Vector2 pos;
+    Vector2 vel;
+    SDL_Rect body;
+    float dashTimer;
+    float dashCooldown;
+    float attackTimer;
+    float attackCooldown;
+    float coyoteTimer;
+    float damageCooldown;
+    float knockbackTimer;
+    bool canDash : 1;
+    bool isDashing : 1;
+    bool isAttacking : 1;
+    bool isGrounded : 1;
+    bool isJumping : 1;
+    bool facingLeft : 1;
+    AttackDirection attackDirection;
+};
+
+static_assert(sizeof(PlayerState) == 64 && alignof(PlayerState) == 64, "PlayerState should be exactly one cache line");
+static_assert(offsetof(PlayerState, body) == 16 && offsetof(PlayerState, attackDirection) == 61, "PlayerState should have no gaps between fields");
+
+// Player class
+class Player {
+public:
+    Player(int width, int height, World* world) :
+        state{},
+        previousPos{ 0.0f, 0.0f },
+        attackHitbox{ 0, 0, width, width },
+        previousAttackPos{ 0.0f, 0.0f },
+        world(world),
+        dashPressedLastFrame{ false },
+        attackPressedLastFrame{ false },
+        speed(300.0f),
+        jumpVelocity(-960.0f),
+        health(10),
+        levelLeft(0.0f),
+        levelWidth((float)Constants::LEVEL_WIDTH)
+    {
+        state.body = { 0, 0, width, height };
+        state.canDash = true;
+        state.attackDirection = AttackDirection::RIGHT;
+    };
+
+    void HandleInput(const PlayerInput& input) {
+        bool dashPressed = input.dash;
+        bool attackPressed = input.attack;
+
+        // Dash
+        if (dashPressed && !dashPressedLastFrame && state.canDash && state.dashCooldown <= 0.0f) {
+            state.isDashing = true;
+            state.canDash = false;
+            state.dashTimer = 0.3f;
+            state.dashCooldown = 0.75f;
+        }
+
+        // Stop player from jumping or changing direction whilst dashing
+        if (!state.isDashing && state.knockbackTimer <= 0.0f) {
+            // Reset horizontal velocity
+            state.vel.x = 0.0f;
 
             // Move Left
-            if (keystate[SDL_SCANCODE_A] || leftStickXAxis < 0.0f) {
-                facingLeft = true;
-                vel.x = -speed;
+            if (input.left) {
+                state.facingLeft = true;
+                state.vel.x = -speed;
+            }
+            // Move Right
+            if (input.right) {
+                state.facingLeft = false;
+                state.vel.x = speed;
+            }
+
+            // Jump
+            if (input.jump) {
+                if (state.isGrounded && !state.isJumping) {
+                    state.vel.y = jumpVelocity;
+                    state.isJumping = true;
+                }
+            }
+            else {
+                state.isJumping = false;
+            }
+        }
+
+        // Attack
+        if (attackPressed && !attackPressedLastFrame && !state.isAttacking && state.attackCooldown <= 0.0f) {
+            state.isAttacking = true;
+            state.attackTimer = 0.5f;
+            state.attackCooldown = 0.75f;
+
+            if (input.up) {
+                // Set attack direction
+                state.attackDirection = AttackDirection::UP;
+                // Set attack initial position
+                attackHitbox.x = state.pos.x;
+                attackHitbox.y = state.pos.y - attackHitbox.h;
+            }
+            else if (input.down && !state.isGrounded) {
+                state.attackDirection = AttackDirection::DOWN;
+                attackHitbox.x = state.pos.x;
+                attackHitbox.y = state.pos.y + state.body.h;
+            }
+            else if (state.facingLeft) {
+                state.attackDirection = AttackDirection::LEFT;
+                attackHitbox.x = state.pos.x - attackHitbox.w;
+                attackHitbox.y = state.pos.y + attackHitbox.h / 2.0f;
+            }
+            else {
+                state.attackDirection = AttackDirection::RIGHT;
+                attackHitbox.x = state.pos.x + attackHitbox.w;
+                attackHitbox.y = state.pos.y + attackHitbox.h / 2.0f;
+            }
+        }
+
+        // Check if button pressed last frame so player cant hold down button button to keep doing action
+        dashPressedLastFrame = dashPressed;
+        attackPressedLastFrame = attackPressed;
+    }
+
+    void Update(const vector<SDL_Rect>& platforms, Camera& camera, float deltaTime) {
+        // Track previous positions for smoother rendering with fixed timestep physics
+        previousPos = state.pos;
+        previousAttackPos.x = attackHitbox.x; previousAttackPos.y = attackHitbox.y;
+
+        if (state.knockbackTimer <= 0.0f) {
+            if (state.isDashing) {
+                // Apply dash velocity (multiply by dashTimer so dash starts fast then slows down)
+                if (state.facingLeft) {
+                    state.vel.x = -speed * 15.0f * state.dashTimer;
+                }
+                else {
+                    state.vel.x = speed * 15.0f * state.dashTimer;
+                }
+
+                state.dashTimer -= deltaTime;
+                if (state.dashTimer <= 0.0f) {
+                    state.isDashing = false;
+                }
+            }
+
+            if (state.isAttacking) {
+                state.attackTimer -= deltaTime;
+                if (state.attackTimer <= 0.0f) {
+                    state.isAttacking = false;
+                }
+            }
+
+            // Apply gravity
+            state.vel.y += Constants::GRAVITY * deltaTime;
+
+            // Shorten jump if player stopped pressed jump early by increasing gravity
+            if (!state.isJumping && state.vel.y < 0.0f) {
+                state.vel.y += Constants::GRAVITY * deltaTime * 3.0f;
+            }
+
+            if (state.vel.y > Constants::TERMINAL_VELOCITY) {
+                state.vel.y = Constants::TERMINAL_VELOCITY;
+            }
+        }
+        else {
+            state.knockbackTimer -= deltaTime;
+        }
+
+        // Apply horizontal velocity
+        state.pos.x += state.vel.x * deltaTime;
+
+        // Stop player from going off screen
+        if (state.pos.x < levelLeft) {
+            state.pos.x = levelLeft;
+            state.vel.x = 0.0f;
+        }
+        else if (state.pos.x + state.body.w > levelWidth) {
+            state.pos.x = levelWidth - state.body.w;
+            state.vel.x = 0.0f;
+        }
+
+        state.body.x = (int)state.pos.x;
+
+        for (auto& platform : platforms) {
+            // If player is colliding with platform
+            if (AABB(state.body, platform)) {
+                // If moving left, allign players right edge with platforms left edge
+                if (state.vel.x > 0.0f) {
+                    state.body.x = platform.x - state.body.w;
+                }
+                // If moving right, allign players left edge with platforms right edge
+                else if (state.vel.x < 0.0f) {
+                    state.body.x = platform.x + platform.w;
+                }
+
+                // Sync pos with body after collision
+                state.pos.x = state.body.x;
+
+                // Reset horizontal velocity
+                state.vel.x = 0.0f;;
+            }
+        }
+
+        // Apply vertical velocity
+        state.pos.y += state.vel.y * deltaTime;
+        state.body.y = (int)state.pos.y;
+        state.isGrounded = false;
+        bool groundedThisFrame = false;
+
+        for (auto& platform : platforms) {
+            // If player is colliding with platform
+            if (AABB(state.body, platform)) {
+                // If moving down, allign players bottom edge with platforms top edge
+                if (state.vel.y > 0.0f) {
+                    state.body.y = platform.y - state.body.h;
+                    groundedThisFrame = true;
+                }
+                // If moving up, allign players top edge with platforms bottom edge
+                else if (state.vel.y < 0.0f) {
+                    state.body.y = platform.y + platform.h;
+                }
+
+                // Sync pos with body after collision
+                state.pos.y = state.body.y;
+
+                // Reset vertical velocity
+                state.vel.y = 0.0f;
+            }
+        }
+
+        // Allow player to still jump for a few frames after leaving the ground (makes movement feel smoother)
+        if (groundedThisFrame) {
+            state.isGrounded = true;
+            state.coyoteTimer = 0.05f;
+        }
+        else {
+            if (state.coyoteTimer > 0.0f) {
+                state.coyoteTimer -= deltaTime;
+                state.isGrounded = true;
+            }
+            else {
+                state.isGrounded = false;
+            }
+        }
+
+        // Make camera follow player
+        camera.targetX = state.pos.x + state.body.w / 2.0f - camera.w / 2.0f;
+        camera.targetY = state.pos.y + state.body.h / 2.0f - camera.h / 1.8f;
+
+        // Make attack hitbox follow player
+        if (state.isAttacking) {
+            switch (state.attackDirection) {
+            case AttackDirection::UP:
+                attackHitbox.x = state.pos.x;
+                attackHitbox.y = state.pos.y - attackHitbox.h;
+                break;
+            case AttackDirection::DOWN:
+                attackHitbox.x = state.pos.x;
+                attackHitbox.y = state.pos.y + state.body.h;
+                break;
+            case AttackDirection::LEFT:
+                attackHitbox.x = state.pos.x - attackHitbox.w;
+                attackHitbox.y = state.pos.y + attackHitbox.h / 2.0f;
+                break;
+            case AttackDirection::RIGHT:
+                attackHitbox.x = state.pos.x + attackHitbox.w;
+                attackHitbox.y = state.pos.y + attackHitbox.h / 2.0f;
+                break;
+            }
+        }
+
+        // Apply cooldowns
+        if (state.dashCooldown > 0.0f) { state.dashCooldown -= deltaTime; }
+        if (state.attackCooldown > 0.0f) { state.attackCooldown -= deltaTime; }
+        if (state.damageCooldown > 0.0f) { state.damageCooldown -= deltaTime; }
+
+        // If player is grounded, allow them to dash again (can only dash once middair)
+        if (state.isGrounded && !state.canDash) {
+            state.canDash = true;
+        }
+    }
+
+    // Clip for the player's current state, most important state first
+    AnimationClipId getAnimation() {
+        if (state.knockbackTimer > 0.0f) { return AnimationClipId::PLAYER_KNOCKBACK; }
+        if (state.isAttacking) { return AnimationClipId::PLAYER_ATTACK; }
+        if (state.isDashing) { return AnimationClipId::PLAYER_DASH; }
+        if (!state.isGrounded) { return AnimationClipId::PLAYER_AIRBORNE; }
+        if (fabs(state.vel.x) > 1.0f) { return AnimationClipId::PLAYER_RUN; }
+        return AnimationClipId::PLAYER_IDLE;
+    }
+
+    void Render(SpriteBatch& batch, Camera camera, float alpha, int frame) {
+        if (state.isAttacking) {
+            // Draw attack relative to camera position
+            SDL_Rect drawAttack = {
+                (int)roundf((previousAttackPos.x * (1.0f - alpha) + attackHitbox.x * alpha) - camera.x),
+                (int)((previousAttackPos.y * (1.0f - alpha) + attackHitbox.y * alpha) - camera.y),
+                attackHitbox.w,
+                attackHitbox.h
+            };
+            batch.Add(SpriteId::ATTACK, drawAttack, SDL_Color{ 204, 62, 146, 255 });
+        }
+
+        // Change colour temporarily to show damage
+        SDL_Color colour = { 62, 146, 204, 255 };
+        if (state.damageCooldown > 0.25f) {
+            colour = { 255, 0, 0, 255 };
+        }
+
+        // Draw player relative to camera position
+        SDL_Rect drawPlayer = {
+            (int)roundf((previousPos.x * (1.0f - alpha) + state.body.x * alpha) - camera.x),
+            (int)((previousPos.y * (1.0f - alpha) + state.body.y * alpha) - camera.y),
+            state.body.w,
+            state.body.h
+        };
+        batch.Add(SpriteId::PLAYER, drawPlayer, colour, frame, state.facingLeft);
+    }
+
+    // Health bar in the top left of the player's view
+    void RenderHealth(SpriteBatch& batch) {
+        // Health icons
+        for (int i = 0; i < health; i++) {
+            batch.Add(SpriteId::HEALTH, SDL_Rect{ 10 + (60 * i), 10, 40, 40 }, SDL_Color{ 255, 0, 0, 255 });
+        }
+        // Damaged health icons
+        for (int i = 0; i < 10 - health; i++) {
+            batch.Add(SpriteId::HEALTH, SDL_Rect{ 550 - (60 * i), 10, 40, 40 }, SDL_Color{ 50, 50, 50, 255 });
+        }
+    }
+
+    void RespawnPlayer(Camera& camera, int x, int y, int hp) {
+        // Reset attributes on death
+        state.body.x = x; state.body.y = y;
+        state.pos.x = (float)x; state.pos.y = (float)y;
+        previousPos = state.pos;
+        state.vel.x = 0.0f; state.vel.y = 0.0f;
+        camera.x = levelLeft; camera.y = 0.0f;
+
+        state.damageCooldown = 0.0f;
+        health = hp;
+    }
+
+    // Move with a platform being stood on
+    void Carry(Vector2 delta) {
+        state.pos.x += delta.x; state.pos.y += delta.y;
+        state.body.x = (int)state.pos.x; state.body.y = (int)state.pos.y;
+    }
+
+    // Move along with the world's origin, the level edges move too
+    void ShiftOrigin(int dx) {
+        state.pos.x += dx;
+        state.body.x += dx;
+        previousPos.x += dx;
+        attackHitbox.x += dx;
+        previousAttackPos.x += dx;
+        levelLeft += dx;
+        levelWidth += dx;
+    }
+
+    void DealDamage(vector<unique_ptr<Enemy>>& enemies, vector<Coin>& coins);
+    void TakeDamage(int damage, Vector2 damageLocation);
+    void Kill();
+
+    // Getters and Setters
+    Vector2 getPos() { return state.pos; }
+    Vector2 getVel() { return state.vel; }
+    SDL_Rect getBody() { return state.body; }
+    int getHealth() { return health; }
+    bool getIsGrounded() { return state.isGrounded; }
+    bool getIsAttacking() { return state.isAttacking; }
+    // This tick's state for ghost playback, showing the given animation frame
+    GhostSample getGhostSample(int frame) {
+        uint8_t flags = (uint8_t)((int)state.attackDirection << GhostSample::ATTACK_SHIFT);
+        if (state.facingLeft) { flags |= GhostSample::FACING_LEFT; }
+        if (state.isAttacking) { flags |= GhostSample::ATTACKING; }
+        if (state.damageCooldown > 0.25f) { flags |= GhostSample::DAMAGED; }
+        return { (int16_t)state.body.x, (int16_t)state.body.y, (uint8_t)frame, flags };
+    }
+    void setLevelWidth(float width) { levelWidth = width; }
+    SDL_Rect getAttackHitbox() { return attackHitbox; }
+    void setPlayerData() {
+        PlayerData playerData = loadPlayerFile("Files/player.json");
+        state.body.x = playerData.x;
+        state.body.y = playerData.y;
+        state.pos.x = (float)playerData.x;
+        state.pos.y = (float)playerData.y;
+        health = playerData.health;
+
+        // If player quit game whilst respawning, take damage to retrigger death
+        if (health <= 0) {
+            TakeDamage(0, Vector2{ 0.0f, 0.0f });
+        }
+    }
+
+private:
+    // Reachability analyzer discretises movement state directly
+    friend class ReachabilityAnalyzer;
+
+    PlayerState state;
+
+    // Cold state, only read when rendering, attacking or reading input
+    Vector2 previousPos;
+    SDL_Rect attackHitbox;
+    Vector2 previousAttackPos;
+    World* world;
+    bool dashPressedLastFrame;
+    bool attackPressedLastFrame;
+    float speed;
+    float jumpVelocity;
+    int health;
+    // Edges the player cant walk past (the right is infinite in endless levels)
+    float levelLeft;
+    float levelWidth;
+};
+
+// Fixed size slots carved from large blocks, so objects allocated one at a time still end up packed together in
+// allocation order. Freed slots are reused first and blocks are only released at exit
+template<size_t SLOT_SIZE>
+class SlabAllocator {
+public:
+    static constexpr int SLOTS_PER_BLOCK = 1024;
+
+    SlabAllocator() :
+        used(SLOTS_PER_BLOCK),
+        freeSlots(nullptr)
+    {
+    };
+
+    void* Allocate() {
+        lock_guard<mutex> lock(slabMutex);
+        if (freeSlots) {
+            void* slot = freeSlots;
+            freeSlots = *(void**)slot;
+            return slot;
+        }
+        if (used == SLOTS_PER_BLOCK) {
+            blocks.emplace_back(new Slot[SLOTS_PER_BLOCK]);
+            used = 0;
+        }
+        return &blocks.back()[used++];
+    }
+
+    void Free(void* slot) {
+        lock_guard<mutex> lock(slabMutex);
+        *(void**)slot = freeSlots;
+        freeSlots = slot;
+    }
+
+private:
+    struct alignas(64) Slot {
+        unsigned char bytes[SLOT_SIZE];
+    };
+
+    vector<unique_ptr<Slot[]>> blocks;
+    int used;
+    // Freed slots linked through their first bytes
+    void* freeSlots;
+    // Worlds can be built on batch simulation threads
+    mutex slabMutex;
+};
+
+// Enemy state used every tick, sized so that with the vtable pointer an enemy fills exactly one cache line
+// Where it respawns and its full health are cold, they are read from its level spawn when it respawns
+struct EnemyState {
+    Vector2 pos;
+    Vector2 previousPos;
+    Vector2 vel;
+    SDL_Rect body;
+    float damageCooldown;
+    float knockbackTimer;
+    float respawnTimer;
+    int16_t health;
+    bool onScreen : 1;
+    bool canSeePlayer : 1;  // Cached line of sight, refreshed by the world every few ticks
+    bool isFlying : 1;
+    bool isAlive : 1;
+};
+
+static_assert(sizeof(EnemyState) == 56, "EnemyState should leave room for the vtable pointer in one cache line");
+static_assert(offsetof(EnemyState, body) == 24 && offsetof(EnemyState, health) == 52, "EnemyState should have no gaps between fields");
+
+// Enemy Abstract Base Class, aligned so every enemy sits in its own cache line
+class alignas(64) Enemy {
+public:
+    // Enemies come from a slab so they sit a cache line apart, rather than wherever the heap puts each aligned
+    // allocation (which leaves a gap after every enemy). Anything too big or too aligned for a slot uses the heap,
+    // and deletes are sized so they know which it came from
+    static constexpr size_t SLOT_SIZE = 64;
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, align_val_t alignment);
+    static void operator delete(void* memory, size_t size);
+    static void operator delete(void* memory, size_t size, align_val_t alignment);
+
+    Enemy(int x, int y, int width, int height, int health, bool isFlying) :
+        state{}
+    {
+        state.pos = { (float)x, (float)y };
+        state.previousPos = state.pos;
+        state.body = { x, y, width, height };
+        state.health = (int16_t)health;
+        state.isFlying = isFlying;
+        state.isAlive = true;
+    };
+
+    virtual ~Enemy() = default;
+
+    void Update(const vector<SDL_Rect>& platforms, float deltaTime, Vector2 playerPos, SDL_Rect playerBody) {
+        // Track previous position for smoother rendering with fixed timestep physics
+        state.previousPos = state.pos;
+
+        if (state.onScreen) {
+            // If not currently taking knockback
+            if (state.knockbackTimer <= 0.0f) {
+                // Only chase a player that can be seen, otherwise wait where it is
+                if (state.canSeePlayer) {
+                    TrackPlayer(playerPos, playerBody);
+                }
+                else {
+                    state.vel.x = 0.0f;
+                    if (state.isFlying) { state.vel.y = 0.0f; }
+                }
+
+                // Apply gravity
+                if (!state.isFlying) {
+                    state.vel.y += Constants::GRAVITY * deltaTime;
+
+                    if (state.vel.y > Constants::TERMINAL_VELOCITY) {
+                        state.vel.y = Constants::TERMINAL_VELOCITY;
+                    }
+                }
+            }
+            else {
+                state.knockbackTimer -= deltaTime;
+            }
+
+            // Apply horizontal velocity
+            state.pos.x += state.vel.x * deltaTime;
+            state.body.x = (int)state.pos.x;
+
+            for (auto& platform : platforms) {
+                // If enemy is colliding with platform
+                if (AABB(state.body, platform)) {
+                    // If moving left, allign enemys right edge with platforms left edge
+                    if (state.vel.x > 0.0f) {
+                        state.body.x = platform.x - state.body.w;
+                    }
+                    // If moving right, allign enemys left edge with platforms right edge
+                    else if (state.vel.x < 0.0f) {
+                        state.body.x = platform.x + platform.w;
+                    }
+
+                    // Sync pos with body after collision
+                    state.pos.x = state.body.x;
+
+                    // Reset horizontal velocity
+                    state.vel.x = 0.0f;
+                }
+            }
+
+            // Apply vertical velocity
+            state.pos.y += state.vel.y * deltaTime;
+            state.body.y = (int)state.pos.y;
+
+            for (auto& platform : platforms) {
+                // If enemy is colliding with platform
+                if (AABB(state.body, platform)) {
+                    // If moving down, allign enemys bottom edge with platforms top edge
+                    if (state.vel.y > 0.0f) {
+                        state.body.y = platform.y - state.body.h;
+                    }
+                    // If moving up, allign enemys top edge with platforms bottom edge
+                    else if (state.vel.y < 0.0f) {
+                        state.body.y = platform.y + platform.h;
+                    }
+
+                    // Sync pos with body after collision
+                    state.pos.y = state.body.y;
+
+                    // Reset vertical velocity
+                    state.vel.y = 0.0f;
+                }
+            }
+        }
+        // Dead enemies count down until the world respawns them
+        else if (!state.isAlive) {
+            state.respawnTimer -= deltaTime;
+        }
+
+        // Apply cooldowns
+        if (state.damageCooldown > 0.0f) { state.damageCooldown -= deltaTime; }
+    }
+
+    // Clip for the enemy's current state
+    AnimationClipId getAnimation() {
+        if (state.isFlying) {
+            return state.knockbackTimer > 0.0f ? AnimationClipId::FLYING_KNOCKBACK : AnimationClipId::FLYING_HOVER;
+        }
+        if (state.knockbackTimer > 0.0f) { return AnimationClipId::MELEE_KNOCKBACK; }
+        return state.vel.x != 0.0f ? AnimationClipId::MELEE_WALK : AnimationClipId::MELEE_IDLE;
+    }
+
+    // Drawn whenever alive, a zoomed out view can see enemies outside the area that wakes them
+    void Render(SpriteBatch& batch, Camera camera, float alpha, int frame) {
+        if (state.isAlive) {
+            // Change colour temporarily to show damage
+            SDL_Color colour = { 14, 201, 128, 255 };
+            if (state.damageCooldown > 0.25f) {
+                colour = { 255, 0, 0, 255 };
+            }
+
+            // Draw enemy relative to camera position
+            SDL_Rect drawEnemy = {
+                (int)roundf((state.previousPos.x * (1.0f - alpha) + state.pos.x * alpha) - camera.x),
+                (int)((state.previousPos.y * (1.0f - alpha) + state.pos.y * alpha) - camera.y),
+                state.body.w,
+                state.body.h
+            };
+            batch.Add(state.isFlying ? SpriteId::FLYING_ENEMY : SpriteId::MELEE_ENEMY, drawEnemy, colour, frame, state.vel.x < 0.0f);
+        }
+    }
+
+    void DealDamage(Player& player);
+    bool TakeDamage(int damage, Vector2 damageLocation);
+    void Kill();
+    virtual void TrackPlayer(Vector2 playerPos, SDL_Rect playerBody) = 0;
+
+    void Respawn(const EnemySpawn& spawn) {
+        // Reset attributes on respawn
+        state.isAlive = true;
+        state.health = (int16_t)spawn.health;
+        state.knockbackTimer = 0.0f;
+        state.canSeePlayer = false;
+
+        state.pos.x = (float)spawn.x; state.pos.y = (float)spawn.y;
+        state.previousPos = state.pos;
+        state.body.x = spawn.x; state.body.y = spawn.y;
+    }
+
+    // Move with a platform being stood on
+    void Carry(Vector2 delta) {
+        state.pos.x += delta.x; state.pos.y += delta.y;
+        state.body.x = (int)state.pos.x; state.body.y = (int)state.pos.y;
+    }
+
+    // Move along with the world's origin
+    void ShiftOrigin(int dx) {
+        state.pos.x += dx;
+        state.previousPos.x += dx;
+        state.body.x += dx;
+    }
+
+    // Move the enemy to where its spawn has been moved, used by the level editor
+    void Place(int x, int y) {
+        state.pos = { (float)x, (float)y };
+        state.previousPos = state.pos;
+        state.vel = { 0.0f, 0.0f };
+        state.body.x = x; state.body.y = y;
+    }
+
+    // Remove enemy until it is activated by respawning it
+    void Deactivate() {
+        state.isAlive = false;
+        state.onScreen = false;
+        state.respawnTimer = INFINITY;
+    }
+
+    void CheckOnScreen(const vector<SDL_Rect>& cameraRects) {
+        if (state.isAlive) {
+            // If enemy is colliding with any camera, then they are on screen
+            state.onScreen = false;
+            for (auto& cameraRect : cameraRects) {
+                if (AABB(state.body, cameraRect)) {
+                    state.onScreen = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Getters and Setters
+    bool getOnScreen() { return state.onScreen; }
+    bool getIsAlive() { return state.isAlive; }
+    bool getRespawnDue() { return !state.isAlive && state.respawnTimer <= 0.0f; }
+    void setCanSeePlayer(bool canSee) { state.canSeePlayer = canSee; }
+    SDL_Rect getBody() { return state.body; }
+    Vector2 getPos() { return state.pos; }
+    Vector2 getVel() { return state.vel; }
+    void setVel(Vector2 vel) { state.vel = vel; }
+    int getHealth() { return state.health; }
+    // Whether the next update will call TrackPlayer
+    bool getChasingPlayer() { return state.onScreen && state.knockbackTimer <= 0.0f && state.canSeePlayer; }
+
+protected:
+    EnemyState state;
+};
+
+// Melee enemy class
+class MeleeEnemy : public Enemy {
+public:
+    MeleeEnemy(int x, int y, int width, int height, int health) :
+        Enemy(x, y, width, height, health, false)
+    {
+    };
+
+    // Only track player horizontally (cant fly)
+    void TrackPlayer(Vector2 playerPos, SDL_Rect playerBody) override {
+        if (playerPos.x + playerBody.w < state.pos.x + 1.0f) { state.vel.x = -150.0f; }
+        else if (playerPos.x > state.pos.x + state.body.w - 1.0f) { state.vel.x = 150.0f; }
+        else { state.vel.x = 0.0f; }
+    }
+};
+
+// Flying enemy class
+class FlyingEnemy : public Enemy {
+public:
+    FlyingEnemy(int x, int y, int width, int height, int health) :
+        Enemy(x, y, width, height, health, true)
+    {
+    };
+
+    // Track player horizontally and vertically (can fly)
+    void TrackPlayer(Vector2 playerPos, SDL_Rect playerBody) override {
+        if (playerPos.x + playerBody.w < state.pos.x + 1.0f) { state.vel.x = -100.0f; }
+        else if (playerPos.x > state.pos.x + state.body.w - 1.0f) { state.vel.x = 100.0f; }
+        else { state.vel.x = 0.0f; }
+
+        if (playerPos.y + playerBody.h < state.pos.y + 1.0f) { state.vel.y = -100.0f; }
+        else if (playerPos.y > state.pos.y + state.body.h - 1.0f) { state.vel.y = 100.0f; }
+        else { state.vel.y = 0.0f; }
+    }
+};
+
+// Enemy driven by a behaviour script, the world runs every script in batches before enemies update
+class ScriptedEnemy : public Enemy {
+public:
+    ScriptedEnemy(int x, int y, int width, int height, int health, bool isFlying) :
+        Enemy(x, y, width, height, health, isFlying)
+    {
+    };
+
+    // Velocity has already been set by the script
+    void TrackPlayer(Vector2, SDL_Rect) override {}
+};
+
+static_assert(sizeof(MeleeEnemy) == 64 && sizeof(FlyingEnemy) == 64 && sizeof(ScriptedEnemy) == 64,
+    "Enemies should be exactly one cache line each");
+
+
+// Events raised by the simulation, the game turns these into sounds and music (headless runs can just count them)
+enum class WorldEvent {
+    COIN_COLLECTED,
+    PLAYER_DAMAGED,
+    PLAYER_DIED,
+    PLAYER_WON,
+    ENEMY_DAMAGED,
+    ENEMY_KILLED,
+    RESPAWN_STARTED,
+    RESPAWN_FINISHED,
+    PLATFORM_BROKEN,
+    CHECKPOINT_REACHED,
+    MUSIC_CHANGED,
+    ORIGIN_SHIFTED
+};
+
+// Create enemies from level spawns
+unique_ptr<Enemy> createEnemy(const EnemySpawn& spawn);
+vector<unique_ptr<Enemy>> createEnemies(const vector<EnemySpawn>& spawns);
+
+
+// State of one moving platform in a world
+struct MovingPlatform {
+    Vector2 pos;
+    Vector2 previousPos;
+    SDL_Rect body;
+    int nextWaypoint;
+    int proxy;
+};
+
+
+// Two neighbouring words of a bit-packed hazard row, in one SSE2 register where available
+struct HazardBits {
+#ifdef USE_SSE2
+    __m128i v;
+
+    static HazardBits Load(const uint64_t* words) { return { _mm_loadu_si128((const __m128i*)words) }; }
+    void Store(uint64_t* words) const { _mm_storeu_si128((__m128i*)words, v); }
+    HazardBits operator|(HazardBits other) const { return { _mm_or_si128(v, other.v) }; }
+    HazardBits operator&(HazardBits other) const { return { _mm_and_si128(v, other.v) }; }
+    HazardBits operator~() const { return { _mm_xor_si128(v, _mm_set1_epi32(-1)) }; }
+    // Bits set in this but not in other
+    HazardBits Without(HazardBits other) const { return { _mm_andnot_si128(other.v, v) }; }
+    bool Any() const { return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF; }
+
+    // Bit i of the result is bit i - 1 of the row, previous is the same row loaded one word earlier
+    HazardBits FromLeft(HazardBits previous) const {
+        return { _mm_or_si128(_mm_slli_epi64(v, 1), _mm_srli_epi64(previous.v, 63)) };
+    }
+    // Bit i of the result is bit i + 1 of the row, next is the same row loaded one word later
+    HazardBits FromRight(HazardBits next) const {
+        return { _mm_or_si128(_mm_srli_epi64(v, 1), _mm_slli_epi64(next.v, 63)) };
+    }
+    // Move every bit one tile left or right within the pair, bits leaving the pair are dropped
+    HazardBits Left() const { return FromRight({ _mm_srli_si128(v, 8) }); }
+    HazardBits Right() const { return FromLeft({ _mm_slli_si128(v, 8) }); }
+#else
+    uint64_t v[2];
+
+    static HazardBits Load(const uint64_t* words) { return { { words[0], words[1] } }; }
+    void Store(uint64_t* words) const { words[0] = v[0]; words[1] = v[1]; }
+    HazardBits operator|(HazardBits other) const { return { { v[0] | other.v[0], v[1] | other.v[1] } }; }
+    HazardBits operator&(HazardBits other) const { return { { v[0] & other.v[0], v[1] & other.v[1] } }; }
+    HazardBits operator~() const { return { { ~v[0], ~v[1] } }; }
+    HazardBits Without(HazardBits other) const { return { { v[0] & ~other.v[0], v[1] & ~other.v[1] } }; }
+    bool Any() const { return (v[0] | v[1]) != 0; }
+
+    HazardBits FromLeft(HazardBits previous) const {
+        return { { (v[0] << 1) | (previous.v[0] >> 63), (v[1] << 1) | (previous.v[1] >> 63) } };
+    }
+    HazardBits FromRight(HazardBits next) const {
+        return { { (v[0] >> 1) | (next.v[0] << 63), (v[1] >> 1) | (next.v[1] << 63) } };
+    }
+    HazardBits Left() const { return FromRight({ { v[1], 0 } }); }
+    HazardBits Right() const { return FromLeft({ { 0, v[0] } }); }
+#endif
+};
+
+// Water and lava simulated as a cellular automaton on a grid of tiles over the fixed level. Rows are bit-packed,
+// one plane per fluid plus one for solid tiles, so a step works on 128 tiles at once. Fluid falls into an empty
+// tile below, otherwise moves one tile sideways into an empty tile if a drop is within REACH tiles of it through empty
+// tiles, or if it has fluid on top of it. There is no push from fluid behind, so a single layer further than REACH
+// from a drop stays put. Sideways moves alternate direction each step, and only ever come from one side, so two tiles
+// never move into the same place. Rows are split into regions, and a step only visits regions where something moved
+// last time (or next to one). Pools in a basin settle and then cost nothing, but a wide pool on a ledge drains
+// slowly over the edge and keeps its regions active for a long time (a 60 tile pool is still draining after 4000
+// steps)
+class HazardGrid {
+public:
+    static constexpr int TILE = 10;
+    static constexpr int TOP = Constants::FLOOR_LEVEL - Constants::LEVEL_HEIGHT;
+    static constexpr int COLS = (Constants::LEVEL_WIDTH + TILE - 1) / TILE;
+    static constexpr int ROWS = (Constants::LEVEL_HEIGHT + TILE - 1) / TILE;
+    // Rows are whole pairs of words, with a solid guard word either side so shifts never need bounds checks
+    static constexpr int WORDS = (COLS + 127) / 128 * 2;
+    static constexpr int STRIDE = WORDS + 2;
+    // Regions are one pair of words wide
+    static constexpr int REGION_ROWS = 16;
+    static constexpr int REGION_COLS = WORDS / 2;
+    static constexpr int REGION_BANDS = (ROWS + REGION_ROWS - 1) / REGION_ROWS;
+    // Fluids step at a lower fixed rate than the world, and lava only every other step as it is thicker
+    static constexpr float STEP_TIME = Constants::FIXED_DT * 3.0f;
+    static constexpr int LAVA_INTERVAL = 2;
+    // A region is kept active long enough to try both directions after anything in it moves
+    static constexpr uint8_t ACTIVE_STEPS = 2;
+    // How far fluid looks sideways for somewhere lower to flow to, surfaces settle within a tile over this distance
+    static constexpr int REACH = 16;
+
+    static_assert((int)HazardType::COUNT == 2, "Each fluid treats the other as solid");
+
+    HazardGrid() :
+        stepCounts{},
+        activeCounts{},
+        reach{}
+    {
+    };
+
+    // Grid is only allocated for levels with hazards
+    bool getEnabled() const { return !solid.empty(); }
+
+    // Allocate the grid with no fluid, only the level's edges and floor are solid
+    void Reset() {
+        size_t size = (size_t)STRIDE * (ROWS + 2);
+        solid.assign(size, 0);
+        for (int row = -1; row <= ROWS; row++) {
+            uint64_t* words = Row(solid, row);
+            words[-1] = ~0ull;
+            words[WORDS] = ~0ull;
+            for (int word = 0; word < WORDS; word++) {
+                words[word] = row == ROWS ? ~0ull : ~ColumnMask(word, 0, COLS - 1);
+            }
+        }
+        for (int type = 0; type < (int)HazardType::COUNT; type++) {
+            fluid[type].assign(size, 0);
+            active[type].assign(REGION_COLS * REGION_BANDS, 0);
+            nextActive[type].assign(REGION_COLS * REGION_BANDS, 0);
+            stepCounts[type] = 0;
+            activeCounts[type] = 0;
+        }
+    }
+
+    void Release() {
+        solid = vector<uint64_t>();
+        for (int type = 0; type < (int)HazardType::COUNT; type++) {
+            fluid[type] = vector<uint64_t>();
+            active[type] = vector<uint8_t>();
+            nextActive[type] = vector<uint8_t>();
+        }
+    }
+
+    // Mark every tile overlapping rect as solid or empty, solid tiles lose any fluid in them
+    void SetSolid(const SDL_Rect& rect, bool isSolid) {
+        int firstCol, lastCol, firstRow, lastRow;
+        if (!TileRange(rect, firstCol, lastCol, firstRow, lastRow)) { return; }
+
+        for (int row = firstRow; row <= lastRow; row++) {
+            for (int word = firstCol / 64; word <= lastCol / 64; word++) {
+                uint64_t mask = ColumnMask(word, firstCol, lastCol);
+                if (isSolid) {
+                    Row(solid, row)[word] |= mask;
+                    for (auto& plane : fluid) { Row(plane, row)[word] &= ~mask; }
+                }
+                else {
+                    Row(solid, row)[word] &= ~mask;
+                }
+            }
+        }
+        for (int type = 0; type < (int)HazardType::COUNT; type++) {
+            Activate(active[type], firstCol, lastCol, firstRow, lastRow);
+        }
+    }
+
+    // Fill every empty tile overlapping rect with fluid
+    void Fill(HazardType type, const SDL_Rect& rect) {
+        int firstCol, lastCol, firstRow, lastRow;
+        if (!TileRange(rect, firstCol, lastCol, firstRow, lastRow)) { return; }
+
+        vector<uint64_t>& plane = fluid[(int)type];
+        const vector<uint64_t>& other = fluid[1 - (int)type];
+        bool filled = false;
+        for (int row = firstRow; row <= lastRow; row++) {
+            for (int word = firstCol / 64; word <= lastCol / 64; word++) {
+                uint64_t& bits = Row(plane, row)[word];
+                uint64_t add = ColumnMask(word, firstCol, lastCol) & ~Row(solid, row)[word] & ~Row(other, row)[word] & ~bits;
+                bits |= add;
+                filled = filled || add != 0;
+            }
+        }
+        if (filled) {
+            Activate(active[(int)type], firstCol, lastCol, firstRow, lastRow);
+        }
+    }
+
+    // Move one fluid by a step, a row at a time from the bottom up so falling fluid only moves once
+    void Step(HazardType type) {
+        int index = (int)type;
+        bool left = (stepCounts[index]++ & 1) == 0;
+        vector<uint8_t>& regions = active[index];
+        vector<uint8_t>& next = nextActive[index];
+        for (size_t i = 0; i < regions.size(); i++) {
+            next[i] = regions[i] > 0 ? regions[i] - 1 : 0;
+        }
+
+        for (int band = REGION_BANDS - 1; band >= 0; band--) {
+            const uint8_t* bandRegions = &regions[band * REGION_COLS];
+            if (all_of(bandRegions, bandRegions + REGION_COLS, [](uint8_t steps) { return steps == 0; })) { continue; }
+
+            for (int row = min(ROWS, (band + 1) * REGION_ROWS) - 1; row >= band * REGION_ROWS; row--) {
+                bool changed[REGION_COLS] = {};
+                for (int region = 0; region < REGION_COLS; region++) {
+                    if (bandRegions[region]) { changed[region] = Fall(index, row, region * 2); }
+                }
+
+                // Left moves spill into the pair on the left, which has then already been stepped (and the other
+                // way round), so nothing moves twice in a step
+                FindReach(index, row, left);
+                for (int i = 0; i < REGION_COLS; i++) {
+                    int region = left ? i : REGION_COLS - 1 - i;
+                    if (bandRegions[region] && Spread(index, row, region * 2, left)) { changed[region] = true; }
+                }
+
+                for (int region = 0; region < REGION_COLS; region++) {
+                    if (!changed[region]) { continue; }
+                    ActivateAround(next, region, band);
+                    ActivateAround(active[1 - index], region, band);
+                }
+            }
+        }
+
+        regions.swap(next);
+        activeCounts[index] = (int)count_if(regions.begin(), regions.end(), [](uint8_t steps) { return steps > 0; });
+    }
+
+    // True if any tile overlapping rect holds the fluid
+    bool Touches(HazardType type, const SDL_Rect& rect) const {
+        int firstCol, lastCol, firstRow, lastRow;
+        if (!getEnabled() || !TileRange(rect, firstCol, lastCol, firstRow, lastRow)) { return false; }
+
+        const vector<uint64_t>& plane = fluid[(int)type];
+        for (int row = firstRow; row <= lastRow; row++) {
+            for (int word = firstCol / 64; word <= lastCol / 64; word++) {
+                if (Row(plane, row)[word] & ColumnMask(word, firstCol, lastCol)) { return true; }
+            }
+        }
+        return false;
+    }
+
+    // Call callback(rect) for each horizontal run of the fluid overlapping area, in level coordinates
+    template<typename Callback>
+    void ForEachRun(HazardType type, const SDL_Rect& area, Callback callback) const {
+        int firstCol, lastCol, firstRow, lastRow;
+        if (!getEnabled() || !TileRange(area, firstCol, lastCol, firstRow, lastRow)) { return; }
+
+        const vector<uint64_t>& plane = fluid[(int)type];
+        for (int row = firstRow; row <= lastRow; row++) {
+            const uint64_t* words = Row(plane, row);
+            int start = -1;
+            for (int col = firstCol; col <= lastCol + 1; col++) {
+                // Whole empty words are skipped
+                if (start == -1 && col % 64 == 0 && col + 63 <= lastCol && words[col / 64] == 0) {
+                    col += 63;
+                    continue;
+                }
+                bool set = col <= lastCol && ((words[col / 64] >> (col % 64)) & 1);
+                if (set && start == -1) { start = col; }
+                else if (!set && start != -1) {
+                    callback(SDL_Rect{ start * TILE, TOP + row * TILE, (col - start) * TILE, TILE });
+                    start = -1;
+                }
+            }
+        }
+    }
+
+    // Rect grown out to whole tiles
+    static SDL_Rect TileBounds(const SDL_Rect& rect) {
+        int left = (int)floorf((float)rect.x / TILE) * TILE;
+        int top = TOP + (int)floorf((float)(rect.y - TOP) / TILE) * TILE;
+        int right = (int)ceilf((float)(rect.x + rect.w) / TILE) * TILE;
+        int bottom = TOP + (int)ceilf((float)(rect.y + rect.h - TOP) / TILE) * TILE;
+        return SDL_Rect{ left, top, right - left, bottom - top };
+    }
+
+    // Getters
+    int getActiveRegions(HazardType type) const { return activeCounts[(int)type]; }
+
+private:
+    vector<uint64_t> solid;
+    vector<uint64_t> fluid[(int)HazardType::COUNT];
+    // Steps each region will be visited for, counting down once nothing in it moves
+    vector<uint8_t> active[(int)HazardType::COUNT];
+    vector<uint8_t> nextActive[(int)HazardType::COUNT];
+    int stepCounts[(int)HazardType::COUNT];
+    int activeCounts[(int)HazardType::COUNT];
+    // Reach of the row being stepped, with a zero guard word either side
+    uint64_t reach[WORDS + 2];
+
+    // Row -1 and row ROWS are guard rows above and below the grid
+    static uint64_t* Row(vector<uint64_t>& plane, int row) { return &plane[(size_t)(row + 1) * STRIDE + 1]; }
+    static const uint64_t* Row(const vector<uint64_t>& plane, int row) { return &plane[(size_t)(row + 1) * STRIDE + 1]; }
+
+    // Bits of a word covering columns [firstCol, lastCol]
+    static uint64_t ColumnMask(int word, int firstCol, int lastCol) {
+        int first = max(firstCol - word * 64, 0);
+        int last = min(lastCol - word * 64, 63);
+        if (first > last) { return 0; }
+        uint64_t upTo = last == 63 ? ~0ull : (1ull << (last + 1)) - 1;
+        return upTo & ~((1ull << first) - 1);
+    }
+
+    // Tiles overlapping rect, clipped to the grid, false if there are none
+    static bool TileRange(const SDL_Rect& rect, int& firstCol, int& lastCol, int& firstRow, int& lastRow) {
+        firstCol = max(0, (int)floorf((float)rect.x / TILE));
+        lastCol = min(COLS - 1, (int)ceilf((float)(rect.x + rect.w) / TILE) - 1);
+        firstRow = max(0, (int)floorf((float)(rect.y - TOP) / TILE));
+        lastRow = min(ROWS - 1, (int)ceilf((float)(rect.y + rect.h - TOP) / TILE) - 1);
+        return firstCol <= lastCol && firstRow <= lastRow;
+    }
+
+    void Activate(vector<uint8_t>& regions, int firstCol, int lastCol, int firstRow, int lastRow) {
+        for (int band = firstRow / REGION_ROWS; band <= lastRow / REGION_ROWS; band++) {
+            for (int region = firstCol / 128; region <= lastCol / 128; region++) {
+                ActivateAround(regions, region, band);
+            }
+        }
+    }
+
+    // A change can let fluid move in any neighbouring region as well
+    static void ActivateAround(vector<uint8_t>& regions, int region, int band) {
+        for (int y = max(band - 1, 0); y <= min(band + 1, REGION_BANDS - 1); y++) {
+            for (int x = max(region - 1, 0); x <= min(region + 1, REGION_COLS - 1); x++) {
+                regions[y * REGION_COLS + x] = ACTIVE_STEPS;
+            }
+        }
+    }
+
+    // Move fluid in one pair of words into any empty tiles below, returns true if any moved
+    bool Fall(int type, int row, int word) {
+        uint64_t* cells = Row(fluid[type], row) + word;
+        HazardBits current = HazardBits::Load(cells);
+        if (!current.Any()) { return false; }
+
+        uint64_t* cellsBelow = cells + STRIDE;
+        HazardBits below = HazardBits::Load(Row(solid, row + 1) + word) | HazardBits::Load(Row(fluid[1 - type], row + 1) + word) |
+            HazardBits::Load(cellsBelow);
+        HazardBits fall = current.Without(below);
+        if (!fall.Any()) { return false; }
+
+        (HazardBits::Load(cellsBelow) | fall).Store(cellsBelow);
+        current.Without(fall).Store(cells);
+        return true;
+    }
+
+    // Find the empty tiles in a row that fluid could flow sideways through to reach a drop within REACH tiles,
+    // for moving one way. The whole row is done at once so flow isnt cut short at the edges of a pair
+    void FindReach(int type, int row, bool left) {
+        const uint64_t* walls = Row(solid, row);
+        const uint64_t* cells = Row(fluid[type], row);
+        const uint64_t* other = Row(fluid[1 - type], row);
+        const uint64_t* wallsBelow = Row(solid, row + 1);
+        const uint64_t* cellsBelow = Row(fluid[type], row + 1);
+        const uint64_t* otherBelow = Row(fluid[1 - type], row + 1);
+
+        uint64_t empty[WORDS];
+        for (int word = 0; word < WORDS; word++) {
+            empty[word] = ~(walls[word] | cells[word] | other[word]);
+            reach[word + 1] = empty[word] & ~(wallsBelow[word] | cellsBelow[word] | otherBelow[word]);
+        }
+        // Each pass carries reach one tile further back towards fluid that would flow there
+        for (int pass = 0; pass < REACH; pass++) {
+            for (int word = 0; word < WORDS; word++) {
+                uint64_t* bits = &reach[word + 1];
+                uint64_t carried = left ? (bits[0] << 1) | (bits[-1] >> 63) : (bits[0] >> 1) | (bits[1] << 63);
+                bits[0] |= empty[word] & carried;
+            }
+        }
+    }
+
+    // Move fluid in one pair of words one tile sideways, into an empty tile where it can reach a drop or when fluid
+    // on top is pressing down on it. Returns true if any moved
+    bool Spread(int type, int row, int word, bool left) {
+        uint64_t* cells = Row(fluid[type], row) + word;
+        HazardBits current = HazardBits::Load(cells);
+        if (!current.Any()) { return false; }
+
+        // Occupancy is loaded one word to the side as well for the shifts, spills from the pair beside this one
+        // may have filled a tile since the reach was found
+        const uint64_t* walls = Row(solid, row) + word;
+        const uint64_t* other = Row(fluid[1 - type], row) + word;
+        int side = left ? -1 : 1;
+        HazardBits full = HazardBits::Load(walls) | HazardBits::Load(other) | current;
+        HazardBits fullSide = HazardBits::Load(walls + side) | HazardBits::Load(other + side) | HazardBits::Load(cells + side);
+        HazardBits flow = HazardBits::Load(&reach[word + 1]);
+        HazardBits flowSide = HazardBits::Load(&reach[word + 1 + side]);
+        HazardBits above = HazardBits::Load(cells - STRIDE);
+
+        HazardBits open = left ? ~full.FromLeft(fullSide) : ~full.FromRight(fullSide);
+        HazardBits target = left ? flow.FromLeft(flowSide) : flow.FromRight(flowSide);
+        HazardBits move = current & open & (target | above);
+        if (!move.Any()) { return false; }
+
+        (current.Without(move) | (left ? move.Left() : move.Right())).Store(cells);
+
+        // Tiles moving off the end of the pair go into the next word along
+        uint64_t moving[2];
+        move.Store(moving);
+        if (left) { cells[-1] |= (moving[0] & 1) << 63; }
+        else { cells[2] |= moving[1] >> 63; }
+        return true;
+    }
+};
+
+// Part of the window a player's view is drawn into, side by side for two players and quarters for three or four
+SDL_Rect splitScreenViewport(int player, int playerCount) {
+    if (playerCount <= 1) {
+        return SDL_Rect{ 0, 0, Constants::WIN_WIDTH, Constants::WIN_HEIGHT };
+    }
+    if (playerCount == 2) {
+        return SDL_Rect{ player * Constants::WIN_WIDTH / 2, 0, Constants::WIN_WIDTH / 2, Constants::WIN_HEIGHT };
+    }
+    return SDL_Rect{ (player % 2) * Constants::WIN_WIDTH / 2, (player / 2) * Constants::WIN_HEIGHT / 2, Constants::WIN_WIDTH / 2, Constants::WIN_HEIGHT / 2 };
+}
+
+// One line of sight check, blocked is filled in by World::CastRays
+struct LineOfSightRay {
+    Vector2 from;
+    Vector2 to;
+    int enemy;
+    bool blocked;
+};
+
+// Position in chunks from the start of the level plus an offset within the chunk, stays exact however far the
+// world's origin has moved
+struct ChunkPosition {
+    int chunk;
+    Vector2 offset;
+};
+
+
+// Simulation of one playthrough of a level, has no dependency on the window, renderer or mixer
+class World {
+public:
+    // Platform tree user data is the platform index, with this bit set for moving platforms
+    static constexpr int MOVING_PLATFORM = 1 << 30;
+    // Distance around a body to gather platforms from, more than anything moves in one tick
+    static constexpr int GATHER_MARGIN = 32;
+    // By default each enemy refreshes its line of sight every this many ticks, with enemies spread evenly over the ticks
+    static constexpr int LINE_OF_SIGHT_INTERVAL = 6;
+    // Horizontal gap between players respawning together
+    static constexpr int PLAYER_SPACING = 70;
+    // Endless levels move the origin in whole chunks of this width, a whole number of pixels so integer bodies and
+    // platforms shift exactly
+    static constexpr int CHUNK_WIDTH = 2048;
+    // Damage taken each time something is hurt by water or lava
+    static constexpr int HAZARD_DAMAGE = 1;
+
+    World(shared_ptr<const Level> level, Telemetry* telemetry = nullptr, int playerCount = 1) :
+        level(level),
+        telemetry(telemetry),
+        playerIsRespawning(false),
+        playerHasReset(false),
+        playerHasWon(false),
+        isFinished(false),
+        endless(false),
+        broadphase(true),
+        stepTime(Constants::FIXED_DT),
+        fadeAlpha(0.0f),
+        enemies(createEnemies(level->enemySpawns)),
+        coins(level->coins),
+        lineOfSightTick(0),
+        lineOfSightInterval(LINE_OF_SIGHT_INTERVAL),
+        respawnPoint{ 100, 450 },
+        musicTrigger(-1),
+        originChunk(0),
+        hazardTime(0.0f),
+        hazardSteps(0)
+    {
+        // Every player has their own camera, sized to their part of the screen
+        players.reserve(playerCount);
+        for (int i = 0; i < playerCount; i++) {
+            SDL_Rect viewport = splitScreenViewport(i, playerCount);
+            cameras.push_back(Camera{ 0.0f, 0.0f, 0.0f, 0.0f, viewport.w, viewport.h, 1.0f });
+            cameraRects.push_back(SDL_Rect{ 0, 0, viewport.w, viewport.h });
+            players.emplace_back(55, 100, this);
+            if (i > 0) {
+                players[i].RespawnPlayer(cameras[i], respawnPoint.x + i * PLAYER_SPACING, respawnPoint.y, 10);
+            }
+        }
+        previousCameras = cameras;
+
+        // Static platforms never move so they dont need fattening
+        staticProxies.reserve(level->platforms.size());
+        for (size_t i = 0; i < level->platforms.size(); i++) {
+            staticProxies.push_back(platformTree.CreateProxy(level->platforms[i], (int)i, 0));
+        }
+        platformBroken.assign(level->platforms.size(), false);
+
+        movingPlatforms.reserve(level->movingPlatforms.size());
+        for (size_t i = 0; i < level->movingPlatforms.size(); i++) {
+            const MovingPlatformPath& path = level->movingPlatforms[i];
+            Vector2 start = path.waypoints[0];
+            SDL_Rect body = { (int)start.x, (int)start.y, path.w, path.h };
+            int proxy = platformTree.CreateProxy(body, (int)i | MOVING_PLATFORM);
+            movingPlatforms.push_back(MovingPlatform{ start, start, body, 1 % (int)path.waypoints.size(), proxy });
+        }
+
+        // Triggers never move, enemies started by a spawner are dormant until it is entered
+        enemyDormant.assign(enemies.size(), false);
+        for (size_t i = 0; i < level->triggers.size(); i++) {
+            const TriggerVolume& trigger = level->triggers[i];
+            triggerTree.CreateProxy(trigger.area, (int)i, 0);
+
+            if (trigger.type == TriggerType::SPAWNER) {
+                for (int enemy : trigger.enemies) {
+                    if (enemy >= 0 && enemy < (int)enemies.size()) { enemyDormant[enemy] = true; }
+                }
+            }
+        }
+        ResetEnemies();
+        ResetHazards();
+    };
+
+    // Player and enemies point back to their world, so it cant be copied or moved
+    World(const World&) = delete;
+    World& operator=(const World&) = delete;
+
+    // Advance the simulation by one fixed timestep
+    void Step(const PlayerInput& input) {
+        Step(&input);
+    }
+
+    // Advance the simulation by one fixed timestep, inputs[i] drives player i
+    void Step(const PlayerInput* inputs) {
+        previousCameras = cameras;
+        for (size_t i = 0; i < players.size(); i++) {
+            players[i].HandleInput(inputs[i]);
+        }
+
+        // Normal game logic
+        if (!playerIsRespawning) {
+            MovePlatforms();
+            UpdateLineOfSight();
+
+            // Scripted enemies need to know which of them are chasing before their scripts run
+            for (auto& enemy : enemies) {
+                enemy->CheckOnScreen(cameraRects);
+            }
+            RunBehaviours();
+
+            for (size_t i = 0; i < enemies.size(); i++) {
+                // Enemies chase whichever player is closest
+                Enemy& enemy = *enemies[i];
+                Player& target = players[NearestPlayer(enemy.getBody())];
+                if (enemy.getOnScreen()) {
+                    enemy.Update(GatherPlatforms(enemy.getBody()), stepTime, target.getPos(), target.getBody());
+                }
+                else {
+                    enemy.Update(noPlatforms, stepTime, target.getPos(), target.getBody());
+                }
+                // Full health and where to respawn are only needed now, so they stay in the level spawn
+                if (enemy.getRespawnDue()) {
+                    enemy.Respawn(level->enemySpawns[i]);
+                }
+                for (auto& player : players) {
+                    enemy.DealDamage(player);
+                }
+            }
+
+            for (size_t i = 0; i < players.size(); i++) {
+                players[i].Update(GatherPlatforms(players[i].getBody()), cameras[i], stepTime);
+                players[i].DealDamage(enemies, coins);
+            }
+
+            StepHazards();
+            UpdateTriggers();
+
+            if (telemetry) {
+                telemetry->AdvanceTime(stepTime);
+                for (auto& player : players) {
+                    RecordTelemetry(Heatmap::POSITION, player.getPos());
+                }
+            }
+
+            for (size_t i = 0; i < cameras.size(); i++) {
+                Camera& camera = cameras[i];
+
+                // Clamp camera to avoid out of bounds
+                if (camera.targetX < getLevelLeft()) {
+                    camera.targetX = getLevelLeft();
+                }
+                else if (!endless && camera.targetX > Constants::LEVEL_WIDTH - camera.w) {
+                    camera.targetX = Constants::LEVEL_WIDTH - camera.w;
+                }
+
+                if (camera.targetY > 0.0f) {
+                    camera.targetY = 0.0f;
+                }
+
+                // Make camera move smoothly to avoid stuttering
+                camera.y += (camera.targetY - camera.y) * Constants::CAMERA_DELAY * stepTime;
+                camera.x += (camera.targetX - camera.x) * Constants::CAMERA_DELAY * stepTime;
+
+                UpdateCameraRect((int)i);
+            }
+        }
+        // If player is respawning (fading out)
+        else if (!playerHasReset) {
+            fadeAlpha += Constants::FADE_SPEED * stepTime;
+
+            if (fadeAlpha >= 255.0f) {
+                fadeAlpha = 255.0f;
+
+                // Reset objects whilst screen is covered, every player respawns together
+                RespawnPlayers();
+                playerHasReset = true;
+                if (telemetry) {
+                    telemetry->ResetRunTime();
+                }
+
+                if (!playerHasWon) {
+                    // Respawn enemies, reset coins and rebuild broken platforms
+                    ResetEnemies();
+                    for (auto& coin : coins) {
+                        coin.collected = false;
+                    }
+                    RestorePlatforms();
+                    ResetHazards();
+                }
+                else {
+                    // Playthrough is over once player has won
+                    isFinished = true;
+                }
+            }
+        }
+        // If player is respawning (fading back in)
+        else {
+            fadeAlpha -= Constants::FADE_SPEED * stepTime;
+
+            if (fadeAlpha <= 0.0f) {
+                fadeAlpha = 0.0f;
+                playerIsRespawning = false;
+                PushEvent(WorldEvent::RESPAWN_FINISHED);
+            }
+        }
+    }
+
+    // Restore the world to the start of the level
+    void Reset() {
+        events.clear();
+        ShiftOrigin(-originChunk);
+        respawnPoint = { 100, 450 };
+        RespawnPlayers();
+        for (size_t i = 0; i < cameras.size(); i++) {
+            UpdateCameraRect((int)i);
+        }
+
+        ResetEnemies();
+        coins = level->coins;
+        triggerPairs.clear();
+        if (musicTrigger != -1) {
+            musicTrigger = -1;
+            PushEvent(WorldEvent::MUSIC_CHANGED);
+        }
+        RestorePlatforms();
+        ResetHazards();
+
+        for (size_t i = 0; i < movingPlatforms.size(); i++) {
+            MovingPlatform& platform = movingPlatforms[i];
+            const MovingPlatformPath& path = level->movingPlatforms[i];
+            platform.pos = path.waypoints[0];
+            platform.previousPos = platform.pos;
+            platform.body.x = (int)platform.pos.x; platform.body.y = (int)platform.pos.y;
+            platform.nextWaypoint = 1 % (int)path.waypoints.size();
+            platformTree.MoveProxy(platform.proxy, platform.body, Vector2{ 0.0f, 0.0f });
+        }
+
+        playerIsRespawning = false;
+        playerHasReset = false;
+        playerHasWon = false;
+        isFinished = false;
+        fadeAlpha = 0.0f;
+    }
+
+    // Cast each ray through the platform tree, stopping at the first solid platform it passes through (broken
+    // platforms have no proxy, and moving platforms are tested against their body rather than their fat rect)
+    void CastRays(vector<LineOfSightRay>& rays) const {
+        for (auto& ray : rays) {
+            ray.blocked = platformTree.RayCast(ray.from, ray.to, [&](int userData) {
+                if (userData & MOVING_PLATFORM) {
+                    return segmentIntersectsRect(ray.from, ray.to, movingPlatforms[userData & ~MOVING_PLATFORM].body);
+                }
+                return true;
+            });
+        }
+    }
+
+    // Put every player back at the respawn point, side by side
+    void RespawnPlayers() {
+        for (size_t i = 0; i < players.size(); i++) {
+            players[i].RespawnPlayer(cameras[i], respawnPoint.x + (int)i * PLAYER_SPACING, respawnPoint.y, 10);
+        }
+        previousCameras = cameras;
+    }
+
+    // Respawn every enemy, except those waiting for a spawner to be entered
+    void ResetEnemies() {
+        enemyActivated.assign(enemies.size(), false);
+        for (size_t i = 0; i < enemies.size(); i++) {
+            if (enemyDormant[i]) {
+                enemies[i]->Deactivate();
+            }
+            else {
+                enemies[i]->Respawn(level->enemySpawns[i]);
+            }
+        }
+    }
+
+    // Any player dying respawns every player
+    void TriggerPlayerDeath() {
+        if (!playerHasWon && telemetry) {
+            for (auto& player : players) {
+                if (player.getHealth() <= 0) {
+                    RecordTelemetry(Heatmap::DEATH, player.getPos());
+                }
+            }
+        }
+
+        playerIsRespawning = true;
+        playerHasReset = false;
+        fadeAlpha = 0.0f;
+        PushEvent(WorldEvent::RESPAWN_STARTED);
+    }
+
+    void TriggerWin() {
+        // Endless levels keep generating coins, so collecting every coin so far doesnt end them
+        if (endless) { return; }
+
+        playerHasWon = true;
+        PushEvent(WorldEvent::PLAYER_WON);
+        // Reuse player death fade out for victory fade out (this also resets the player for next game)
+        TriggerPlayerDeath();
+    }
+
+    // Win if any player is inside a goal whose conditions are now met, checked on entering a goal and whenever
+    // a coin is collected. Levels without a goal trigger are won by collecting every coin, endless levels never end
+    void CheckGoals() {
+        if (playerIsRespawning) { return; }
+
+        bool hasGoal = any_of(level->triggers.begin(), level->triggers.end(),
+            [](const TriggerVolume& trigger) { return trigger.type == TriggerType::GOAL; });
+        if (!hasGoal) {
+            if (!endless && getCoinsRemaining() == 0) { TriggerWin(); }
+            return;
+        }
+
+        for (uint64_t pair : triggerPairs) {
+            int body = (int)(pair >> 32);
+            int trigger = (int)(pair & 0xffffffff);
+            if (body < (int)players.size() && level->triggers[trigger].type == TriggerType::GOAL && GoalMet(level->triggers[trigger])) {
+                TriggerWin();
+                return;
+            }
+        }
+    }
+
+    // Break every breakable platform overlapping area, only the broken platforms' tree leaves are touched
+    void BreakPlatforms(const SDL_Rect& area) {
+        platformsToBreak.clear();
+        platformTree.Query(area, [&](int userData) {
+            if (!(userData & MOVING_PLATFORM) && level->platformBreakable[userData] && !platformBroken[userData] &&
+                AABB(area, level->platforms[userData])) {
+                platformsToBreak.push_back(userData);
+            }
+        });
+
+        for (int platform : platformsToBreak) {
+            platformTree.DestroyProxy(staticProxies[platform]);
+            platformBroken[platform] = true;
+            changedPlatforms.push_back(platform);
+            UpdateHazardSolids(level->platforms[platform]);
+            PushEvent(WorldEvent::PLATFORM_BROKEN);
+        }
+    }
+
+    // Put every broken platform back
+    void RestorePlatforms() {
+        for (size_t i = 0; i < platformBroken.size(); i++) {
+            if (!platformBroken[i]) { continue; }
+
+            staticProxies[i] = platformTree.CreateProxy(level->platforms[i], (int)i, 0);
+            platformBroken[i] = false;
+            changedPlatforms.push_back((int)i);
+        }
+    }
+
+    void PushEvent(WorldEvent event) { events.push_back(event); }
+    void ClearEvents() {
+        events.clear();
+        changedPlatforms.clear();
+        editedAreas.clear();
+    }
+
+    // Heatmaps cover the fixed level, so positions are recorded relative to the level's start
+    void RecordTelemetry(Heatmap heatmap, Vector2 pos) {
+        if (telemetry) {
+            pos.x += (float)getOriginX();
+            telemetry->Record(heatmap, pos);
+        }
+    }
+
+    // Collect platforms near a body into a reused list, so collision only checks what is nearby
+    const vector<SDL_Rect>& GatherPlatforms(const SDL_Rect& body) {
+        nearbyPlatforms.clear();
+        SDL_Rect area = { body.x - GATHER_MARGIN, body.y - GATHER_MARGIN, body.w + GATHER_MARGIN * 2, body.h + GATHER_MARGIN * 2 };
+
+        // Without the broadphase every platform is tested against the area directly, to compare against the tree
+        if (!broadphase) {
+            for (size_t i = 0; i < level->platforms.size(); i++) {
+                if (!platformBroken[i] && AABB(area, level->platforms[i])) { nearbyPlatforms.push_back(level->platforms[i]); }
+            }
+            for (auto& platform : movingPlatforms) {
+                if (AABB(area, platform.body)) { nearbyPlatforms.push_back(platform.body); }
+            }
+            return nearbyPlatforms;
+        }
+
+        platformTree.Query(area, [this](int userData) {
+            if (userData & MOVING_PLATFORM) {
+                nearbyPlatforms.push_back(movingPlatforms[userData & ~MOVING_PLATFORM].body);
+            }
+            else {
+                nearbyPlatforms.push_back(level->platforms[userData]);
+            }
+        });
+        return nearbyPlatforms;
+    }
+
+    // Call callback(movingPlatform) for every moving platform that could overlap rect
+    template<typename Callback>
+    void QueryMovingPlatforms(const SDL_Rect& rect, Callback callback) {
+        platformTree.Query(rect, [&](int userData) {
+            if (userData & MOVING_PLATFORM) {
+                callback(movingPlatforms[userData & ~MOVING_PLATFORM]);
+            }
+        });
+    }
+
+    // Let players and cameras carry on right forever, the level is streamed in by an EndlessLevel
+    void MakeEndless() {
+        endless = true;
+        hazards.Release();
+        for (auto& player : players) {
+            player.setLevelWidth(INFINITY);
+        }
+        for (size_t i = 0; i < cameras.size(); i++) {
+            SetZoom((int)i, cameras[i].zoom);
+        }
+    }
+
+    // Move the origin right by a number of chunks, shifting everything in the world left to match so the players
+    // stay near the origin. Positions are then chunk-relative, collision and rendering only ever see small
+    // coordinates however far the players travel, and the origin chunk records how far that is
+    void ShiftOrigin(int chunks) {
+        if (chunks == 0) { return; }
+        originChunk += chunks;
+        int dx = -chunks * CHUNK_WIDTH;
+
+        Level& edit = EditLevel();
+        for (auto& platform : edit.platforms) { platform.x += dx; }
+        for (auto& coin : edit.coins) { coin.body.x += dx; }
+        for (auto& spawn : edit.enemySpawns) { spawn.x += dx; }
+        for (auto& trigger : edit.triggers) { trigger.area.x += dx; }
+        for (auto& path : edit.movingPlatforms) {
+            for (auto& waypoint : path.waypoints) { waypoint.x += dx; }
+        }
+        platformTree.Translate(dx, 0);
+        triggerTree.Translate(dx, 0);
+
+        for (auto& coin : coins) { coin.body.x += dx; }
+        for (auto& platform : movingPlatforms) {
+            platform.pos.x += dx; platform.previousPos.x += dx;
+            platform.body.x += dx;
+        }
+        for (auto& player : players) { player.ShiftOrigin(dx); }
+        for (auto& enemy : enemies) { enemy->ShiftOrigin(dx); }
+        for (size_t i = 0; i < cameras.size(); i++) {
+            for (Camera* camera : { &cameras[i], &previousCameras[i] }) {
+                camera->x += dx; camera->targetX += dx;
+            }
+            cameraRects[i].x += dx;
+        }
+        respawnPoint.x += dx;
+        PushEvent(WorldEvent::ORIGIN_SHIFTED);
+    }
+
+    // Chunk and offset of a world position, relative to the level's start rather than the current origin
+    ChunkPosition ToChunkPosition(Vector2 pos) {
+        int chunk = (int)floorf(pos.x / CHUNK_WIDTH);
+        return ChunkPosition{ originChunk + chunk, Vector2{ pos.x - (float)chunk * CHUNK_WIDTH, pos.y } };
+    }
+
+    // Call callback(platform) for every unbroken static platform that could overlap rect
+    template<typename Callback>
+    void QueryStaticPlatforms(const SDL_Rect& rect, Callback callback) {
+        platformTree.Query(rect, [&](int userData) {
+            if (!(userData & MOVING_PLATFORM)) {
+                callback(userData);
+            }
+        });
+    }
+
+    // Level editing works on the world's own copy of the level, and each change only touches the tree leaves and
+    // objects involved so large levels stay interactive. Removing swaps the last object into the gap and inserting
+    // is the exact inverse, so indices kept in an undo log stay valid
+
+    void InsertPlatform(int index, const SDL_Rect& rect, bool breakable) {
+        Level& edit = EditLevel();
+        edit.platforms.push_back(rect);
+        edit.platformBreakable.push_back(breakable);
+        platformBroken.push_back(false);
+        staticProxies.push_back(platformTree.CreateProxy(rect, (int)edit.platforms.size() - 1, 0));
+        SwapPlatforms(index, (int)edit.platforms.size() - 1);
+        editedAreas.push_back(rect);
+        UpdateHazardSolids(rect);
+    }
+
+    void RemovePlatform(int index) {
+        Level& edit = EditLevel();
+        int last = (int)edit.platforms.size() - 1;
+        SDL_Rect removed = edit.platforms[index];
+        editedAreas.push_back(removed);
+        SwapPlatforms(index, last);
+
+        if (!platformBroken[last]) {
+            platformTree.DestroyProxy(staticProxies[last]);
+        }
+        edit.platforms.pop_back();
+        edit.platformBreakable.pop_back();
+        platformBroken.pop_back();
+        staticProxies.pop_back();
+        UpdateHazardSolids(removed);
+    }
+
+    void MovePlatform(int index, const SDL_Rect& rect) {
+        Level& edit = EditLevel();
+        SDL_Rect previous = edit.platforms[index];
+        editedAreas.push_back(previous);
+        edit.platforms[index] = rect;
+        if (!platformBroken[index]) {
+            platformTree.DestroyProxy(staticProxies[index]);
+            staticProxies[index] = platformTree.CreateProxy(rect, index, 0);
+        }
+        editedAreas.push_back(rect);
+        UpdateHazardSolids(previous);
+        UpdateHazardSolids(rect);
+    }
+
+    void InsertCoin(int index, const SDL_Rect& rect) {
+        Level& edit = EditLevel();
+        edit.coins.push_back(Coin{ rect, false });
+        coins.push_back(Coin{ rect, false });
+        swap(edit.coins[index], edit.coins.back());
+        swap(coins[index], coins.back());
+    }
+
+    void RemoveCoin(int index) {
+        Level& edit = EditLevel();
+        swap(edit.coins[index], edit.coins.back());
+        swap(coins[index], coins.back());
+        edit.coins.pop_back();
+        coins.pop_back();
+    }
+
+    void MoveCoin(int index, const SDL_Rect& rect) {
+        EditLevel().coins[index].body = rect;
+        coins[index].body = rect;
+    }
+
+    // Spawners are the triggers that should wake the enemy, so undoing a removal puts it back in them
+    void InsertEnemy(int index, const EnemySpawn& spawn, const vector<int>& spawners = {}) {
+        Level& edit = EditLevel();
+        edit.enemySpawns.push_back(spawn);
+        enemies.push_back(createEnemy(spawn));
+        enemyDormant.push_back(false);
+        enemyActivated.push_back(false);
+        SwapEnemies(index, (int)enemies.size() - 1);
+        for (int trigger : spawners) {
+            edit.triggers[trigger].enemies.push_back(index);
+        }
+    }
+
+    void RemoveEnemy(int index) {
+        Level& edit = EditLevel();
+        int last = (int)enemies.size() - 1;
+        SwapEnemies(index, last);
+
+        // Spawners forget the removed enemy
+        for (auto& trigger : edit.triggers) {
+            trigger.enemies.erase(remove(trigger.enemies.begin(), trigger.enemies.end(), last), trigger.enemies.end());
+        }
+        edit.enemySpawns.pop_back();
+        enemies.pop_back();
+        enemyDormant.pop_back();
+        enemyActivated.pop_back();
+    }
+
+    void MoveEnemy(int index, int x, int y) {
+        EnemySpawn& spawn = EditLevel().enemySpawns[index];
+        spawn.x = x; spawn.y = y;
+        enemies[index]->Place(x, y);
+    }
+
+    // Topmost static platform under a point, -1 if there is none
+    int PickPlatform(SDL_Point point) {
+        int picked = -1;
+        QueryStaticPlatforms(SDL_Rect{ point.x, point.y, 1, 1 }, [&](int platform) {
+            if (SDL_PointInRect(&point, &level->platforms[platform])) { picked = max(picked, platform); }
+        });
+        return picked;
+    }
+
+    int PickCoin(SDL_Point point) {
+        for (int i = (int)coins.size() - 1; i >= 0; i--) {
+            if (SDL_PointInRect(&point, &coins[i].body)) { return i; }
+        }
+        return -1;
+    }
+
+    // Enemies are picked by where they spawn
+    int PickEnemy(SDL_Point point) {
+        for (int i = (int)level->enemySpawns.size() - 1; i >= 0; i--) {
+            const EnemySpawn& spawn = level->enemySpawns[i];
+            SDL_Rect body = { spawn.x, spawn.y, spawn.w, spawn.h };
+            if (SDL_PointInRect(&point, &body)) { return i; }
+        }
+        return -1;
+    }
+
+    // Refresh which enemies are on screen without stepping, so a paused world still draws the right enemies
+    void UpdateOnScreen() {
+        for (size_t i = 0; i < cameras.size(); i++) {
+            UpdateCameraRect((int)i);
+        }
+        for (auto& enemy : enemies) {
+            enemy->CheckOnScreen(cameraRects);
+        }
+    }
+
+    // Set the velocity of every chasing scripted enemy, like TrackPlayer but a whole script at a time
+    void RunBehaviours() {
+        for (auto& batch : behaviourBatches) {
+            batch.enemies.clear();
+        }
+        for (size_t i = 0; i < enemies.size(); i++) {
+            const BehaviourScript* script = level->enemySpawns[i].behaviour.get();
+            if (!script || !enemies[i]->getChasingPlayer()) { continue; }
+
+            // Levels only use a few scripts, so a linear search is fine
+            auto batch = find_if(behaviourBatches.begin(), behaviourBatches.end(), [&](const BehaviourBatch& existing) {
+                return existing.script == script;
+            });
+            if (batch == behaviourBatches.end()) {
+                behaviourBatches.push_back(BehaviourBatch{ script, {} });
+                batch = behaviourBatches.end() - 1;
+            }
+            batch->enemies.push_back((int)i);
+        }
+
+        const int size = BehaviourScript::BATCH_SIZE;
+        for (auto& batch : behaviourBatches) {
+            const BehaviourScript& script = *batch.script;
+            behaviourRegisters.resize(max(behaviourRegisters.size(), (size_t)(script.getRegisterCount() * size)));
+            float* registers = behaviourRegisters.data();
+
+            for (size_t first = 0; first < batch.enemies.size(); first += size) {
+                int count = (int)min(batch.enemies.size() - first, (size_t)size);
+
+                // Inputs go in with each register's values for the batch next to each other
+                for (int i = 0; i < count; i++) {
+                    Enemy& enemy = *enemies[batch.enemies[first + i]];
+                    Vector2 pos = enemy.getPos();
+                    Vector2 vel = enemy.getVel();
+                    SDL_Rect body = enemy.getBody();
+                    Player& target = players[NearestPlayer(body)];
+                    Vector2 playerPos = target.getPos();
+                    SDL_Rect playerBody = target.getBody();
+
+                    registers[(int)BehaviourInput::X * size + i] = pos.x;
+                    registers[(int)BehaviourInput::Y * size + i] = pos.y;
+                    registers[(int)BehaviourInput::W * size + i] = (float)body.w;
+                    registers[(int)BehaviourInput::H * size + i] = (float)body.h;
+                    registers[(int)BehaviourInput::VX * size + i] = vel.x;
+                    registers[(int)BehaviourInput::VY * size + i] = vel.y;
+                    registers[(int)BehaviourInput::HEALTH * size + i] = (float)enemy.getHealth();
+                    registers[(int)BehaviourInput::PLAYER_X * size + i] = playerPos.x;
+                    registers[(int)BehaviourInput::PLAYER_Y * size + i] = playerPos.y;
+                    registers[(int)BehaviourInput::PLAYER_W * size + i] = (float)playerBody.w;
+                    registers[(int)BehaviourInput::PLAYER_H * size + i] = (float)playerBody.h;
+                }
+
+                script.Run(registers, count);
+
+                // Enemies that dont fly keep their vertical velocity for gravity
+                for (int i = 0; i < count; i++) {
+                    Enemy& enemy = *enemies[batch.enemies[first + i]];
+                    Vector2 vel = enemy.getVel();
+                    vel.x = registers[(int)BehaviourInput::VX * size + i];
+                    if (script.getFlying()) { vel.y = registers[(int)BehaviourInput::VY * size + i]; }
+                    enemy.setVel(vel);
+                }
+            }
+        }
+    }
+
+    // Move a player's camera directly, used while the world is paused
+    void PanCamera(int player, float dx, float dy) {
+        for (Camera* camera : { &cameras[player], &previousCameras[player] }) {
+            camera->x += dx; camera->y += dy;
+            camera->targetX = camera->x; camera->targetY = camera->y;
+        }
+    }
+
+    // Player's camera interpolated between the last two steps, for smooth rendering
+    Camera getRenderCamera(float alpha, int player = 0) {
+        Camera renderCamera = cameras[player];
+        renderCamera.x = previousCameras[player].x * (1.0f - alpha) + cameras[player].x * alpha;
+        renderCamera.y = previousCameras[player].y * (1.0f - alpha) + cameras[player].y * alpha;
+        return renderCamera;
+    }
+
+    // Zoom a player's camera in or out around the centre of their view
+    void SetZoom(int player, float zoom) {
+        zoom = max(endless ? Constants::LOD_ZOOM : Constants::MIN_ZOOM, min(Constants::MAX_ZOOM, zoom));
+        SDL_Rect viewport = splitScreenViewport(player, (int)players.size());
+        Camera& camera = cameras[player];
+        int w = (int)(viewport.w / zoom);
+        int h = (int)(viewport.h / zoom);
+
+        // Shift both cameras so interpolation doesnt jump
+        float dx = (camera.w - w) / 2.0f;
+        float dy = (camera.h - h) / 2.0f;
+        for (Camera* shifted : { &camera, &previousCameras[player] }) {
+            shifted->x += dx; shifted->y += dy;
+            shifted->targetX += dx; shifted->targetY += dy;
+            shifted->w = w; shifted->h = h;
+            shifted->zoom = zoom;
+        }
+        UpdateCameraRect(player);
+    }
+
+    void UpdateCameraRect(int player) {
+        const Camera& camera = cameras[player];
+        SDL_Rect& rect = cameraRects[player];
+        rect.x = (int)(camera.x + (camera.w - rect.w) / 2.0f);
+        rect.y = (int)(camera.y + (camera.h - rect.h) / 2.0f);
+    }
+
+    // Index of the player whose centre is closest to a body's centre
+    int NearestPlayer(const SDL_Rect& body) {
+        if (players.size() == 1) { return 0; }
+
+        int nearest = 0;
+        float nearestDistance = INFINITY;
+        for (size_t i = 0; i < players.size(); i++) {
+            SDL_Rect playerBody = players[i].getBody();
+            float dx = (playerBody.x + playerBody.w * 0.5f) - (body.x + body.w * 0.5f);
+            float dy = (playerBody.y + playerBody.h * 0.5f) - (body.y + body.h * 0.5f);
+            float distance = dx * dx + dy * dy;
+            if (distance < nearestDistance) {
+                nearest = (int)i;
+                nearestDistance = distance;
+            }
+        }
+        return nearest;
+    }
+
+    int getCoinsRemaining() {
+        int coinsRemaining = 0;
+        for (auto& coin : coins) {
+            if (!coin.collected) { coinsRemaining++; }
+        }
+        return coinsRemaining;
+    }
+
+    // Getters
+    Player& getPlayer(int player = 0) { return players[player]; }
+    int getPlayerCount() { return (int)players.size(); }
+    float getZoom(int player) { return cameras[player].zoom; }
+    vector<unique_ptr<Enemy>>& getEnemies() { return enemies; }
+    const vector<SDL_Rect>& getPlatforms() { return level->platforms; }
+    const Level& getLevel() { return *level; }
+    // Level areas changed by editing since events were last cleared
+    const vector<SDL_Rect>& getEditedAreas() { return editedAreas; }
+    const vector<BackgroundLayer>& getBackgroundLayers() { return level->backgroundLayers; }
+    vector<Coin>& getCoins() { return coins; }
+    const vector<WorldEvent>& getEvents() { return events; }
+    // Music file of the music region the player is in, empty for the default music
+    const string& getMusic() { return musicTrigger == -1 ? noMusic : level->triggers[musicTrigger].music; }
+    // Static platforms broken or restored since events were last cleared
+    const vector<int>& getChangedPlatforms() { return changedPlatforms; }
+    bool getPlatformBroken(int platform) { return platformBroken[platform]; }
+    const HazardGrid& getHazards() { return hazards; }
+    bool getPlatformBreakable(int platform) { return level->platformBreakable[platform]; }
+    bool getPlayerIsRespawning() { return playerIsRespawning; }
+    bool getPlayerHasWon() { return playerHasWon; }
+    bool getIsFinished() { return isFinished; }
+    bool getIsEndless() { return endless; }
+    float getFadeAlpha() { return fadeAlpha; }
+    bool getBroadphase() { return broadphase; }
+    float getStepTime() { return stepTime; }
+    int getLineOfSightInterval() { return lineOfSightInterval; }
+    int getOriginChunk() { return originChunk; }
+    // Distance from the level's start to the origin, too far for a float once the players have travelled a long way
+    double getOriginX() { return (double)originChunk * CHUNK_WIDTH; }
+    // Where the level's start is in world coordinates, nothing goes left of it
+    float getLevelLeft() { return (float)-getOriginX(); }
+
+    // Setters
+    void setBroadphase(bool enabled) { broadphase = enabled; }
+    void setStepTime(float seconds) { stepTime = seconds; }
+    void setLineOfSightInterval(int ticks) {
+        lineOfSightInterval = max(1, ticks);
+        lineOfSightTick = 0;
+    }
+
+private:
+    shared_ptr<const Level> level;
+    // Set once the level has been edited, then level points at this copy so other worlds sharing it are unaffected
+    shared_ptr<Level> editedLevel;
+    vector<SDL_Rect> editedAreas;
+    Telemetry* telemetry;
+
+    Level& EditLevel() {
+        if (!editedLevel) {
+            editedLevel = make_shared<Level>(*level);
+            level = editedLevel;
+        }
+        return *editedLevel;
+    }
+
+    void SwapPlatforms(int a, int b) {
+        if (a == b) { return; }
+
+        Level& edit = EditLevel();
+        swap(edit.platforms[a], edit.platforms[b]);
+        vector<bool>::swap(edit.platformBreakable[a], edit.platformBreakable[b]);
+        vector<bool>::swap(platformBroken[a], platformBroken[b]);
+        swap(staticProxies[a], staticProxies[b]);
+
+        // Broken platforms have no leaf until they are restored
+        if (!platformBroken[a]) { platformTree.SetUserData(staticProxies[a], a); }
+        if (!platformBroken[b]) { platformTree.SetUserData(staticProxies[b], b); }
+    }
+
+    void SwapEnemies(int a, int b) {
+        if (a == b) { return; }
+
+        Level& edit = EditLevel();
+        swap(edit.enemySpawns[a], edit.enemySpawns[b]);
+        swap(enemies[a], enemies[b]);
+        vector<bool>::swap(enemyDormant[a], enemyDormant[b]);
+        vector<bool>::swap(enemyActivated[a], enemyActivated[b]);
+        for (auto& trigger : edit.triggers) {
+            for (int& enemy : trigger.enemies) {
+                if (enemy == a) { enemy = b; }
+                else if (enemy == b) { enemy = a; }
+            }
+        }
+
+        // Enemy trigger overlaps are keyed by index, so forget them and let enemies re-enter
+        size_t playerCount = players.size();
+        triggerPairs.erase(remove_if(triggerPairs.begin(), triggerPairs.end(), [&](uint64_t pair) {
+            return (pair >> 32) >= playerCount;
+        }), triggerPairs.end());
+    }
+
+    vector<Camera> cameras;
+    vector<Camera> previousCameras;
+    // Area around each camera that wakes enemies, always the size of the unzoomed view and centred on the camera so
+    // zooming out only changes what is drawn, not what is simulated
+    vector<SDL_Rect> cameraRects;
+    vector<Player> players;
+
+    bool playerIsRespawning;
+    bool playerHasReset;
+    bool playerHasWon;
+    bool isFinished;
+    bool endless;
+    // Collision gathers platforms through the platform tree, or by testing every platform when turned off
+    bool broadphase;
+    // Length of one simulation step, FIXED_DT unless changed from the console
+    float stepTime;
+    float fadeAlpha;
+
+    vector<unique_ptr<Enemy>> enemies;
+    vector<Coin> coins;
+    vector<WorldEvent> events;
+
+    DynamicTree platformTree;
+    vector<int> staticProxies;
+    vector<bool> platformBroken;
+    vector<int> changedPlatforms;
+    vector<int> platformsToBreak;
+    vector<MovingPlatform> movingPlatforms;
+    vector<SDL_Rect> nearbyPlatforms;
+    vector<SDL_Rect> noPlatforms;
+    vector<int> riderPlatforms;
+
+    vector<LineOfSightRay> lineOfSightRays;
+    int lineOfSightTick;
+    int lineOfSightInterval;
+
+    // Chasing enemies grouped by behaviour script, so each script runs once over all of its enemies
+    struct BehaviourBatch {
+        const BehaviourScript* script;
+        vector<int> enemies;
+    };
+    vector<BehaviourBatch> behaviourBatches;
+    vector<float> behaviourRegisters;
+
+    // Refresh line of sight for this tick's share of on screen enemies, from the centre of the enemy to the centre
+    // of the closest player
+    void UpdateLineOfSight() {
+        int slot = lineOfSightTick;
+        lineOfSightTick = (lineOfSightTick + 1) % lineOfSightInterval;
+
+        lineOfSightRays.clear();
+        for (size_t i = slot; i < enemies.size(); i += lineOfSightInterval) {
+            if (!enemies[i]->getOnScreen()) { continue; }
+            SDL_Rect body = enemies[i]->getBody();
+            SDL_Rect playerBody = players[NearestPlayer(body)].getBody();
+            Vector2 target = { playerBody.x + playerBody.w * 0.5f, playerBody.y + playerBody.h * 0.5f };
+            lineOfSightRays.push_back({ { body.x + body.w * 0.5f, body.y + body.h * 0.5f }, target, (int)i, false });
+        }
+
+        CastRays(lineOfSightRays);
+        for (auto& ray : lineOfSightRays) {
+            enemies[ray.enemy]->setCanSeePlayer(!ray.blocked);
+        }
+    }
+
+    DynamicTree triggerTree;
+    // Body and trigger overlapping last tick, packed as (body << 32 | trigger) and sorted (players come first, then enemies)
+    vector<uint64_t> triggerPairs;
+    vector<uint64_t> newTriggerPairs;
+    vector<bool> enemyDormant;
+    vector<bool> enemyActivated;
+    SDL_Point respawnPoint;
+    int musicTrigger;
+    string noMusic;
+    // Chunks the origin has moved right from the level's start
+    int originChunk;
+    // Water and lava, only simulated on fixed levels that have any
+    HazardGrid hazards;
+    float hazardTime;
+    int hazardSteps;
+
+    // Rebuild the hazard grid from the level, every unbroken platform is solid and each hazard is filled again
+    void ResetHazards() {
+        hazardTime = 0.0f;
+        hazardSteps = 0;
+        if (level->hazards.empty() || endless) {
+            hazards.Release();
+            return;
+        }
+
+        hazards.Reset();
+        for (size_t i = 0; i < level->platforms.size(); i++) {
+            if (!platformBroken[i]) { hazards.SetSolid(level->platforms[i], true); }
+        }
+        for (auto& hazard : level->hazards) {
+            hazards.Fill(hazard.type, hazard.area);
+        }
+    }
+
+    // Work out again which hazard tiles are solid after the platforms in area have changed
+    void UpdateHazardSolids(const SDL_Rect& area) {
+        if (!hazards.getEnabled()) { return; }
+
+        SDL_Rect tiles = HazardGrid::TileBounds(area);
+        hazards.SetSolid(tiles, false);
+        QueryStaticPlatforms(tiles, [&](int platform) {
+            hazards.SetSolid(level->platforms[platform], true);
+        });
+    }
+
+    // Lava burns anything touching it, water only drowns once the top of a body is under
+    bool InHazard(const SDL_Rect& body) {
+        return hazards.Touches(HazardType::LAVA, body) || hazards.Touches(HazardType::WATER, SDL_Rect{ body.x, body.y, body.w, 1 });
+    }
+
+    // Move water and lava at their own fixed rate, then hurt anything in them through the usual damage, which
+    // knocks them upwards and whose cooldown limits it to one hit at a time
+    void StepHazards() {
+        if (!hazards.getEnabled()) { return; }
+
+        hazardTime += stepTime;
+        while (hazardTime >= HazardGrid::STEP_TIME) {
+            hazardTime -= HazardGrid::STEP_TIME;
+            for (auto& hazard : level->hazards) {
+                if (hazard.source) { hazards.Fill(hazard.type, hazard.area); }
+            }
+            hazards.Step(HazardType::WATER);
+            if (hazardSteps % HazardGrid::LAVA_INTERVAL == 0) {
+                hazards.Step(HazardType::LAVA);
+            }
+            hazardSteps++;
+        }
+
+        for (auto& player : players) {
+            SDL_Rect body = player.getBody();
+            if (InHazard(body)) {
+                player.TakeDamage(HAZARD_DAMAGE, Vector2{ (float)body.x, (float)(body.y + body.h) });
+            }
+        }
+        for (auto& enemy : enemies) {
+            if (!enemy->getIsAlive() || !enemy->getOnScreen()) { continue; }
+
+            SDL_Rect body = enemy->getBody();
+            if (InHazard(body) && enemy->TakeDamage(HAZARD_DAMAGE, Vector2{ (float)body.x, (float)(body.y + body.h) })) {
+                PushEvent(enemy->getIsAlive() ? WorldEvent::ENEMY_DAMAGED : WorldEvent::ENEMY_KILLED);
+            }
+        }
+    }
+
+    // Find which bodies overlap which triggers through the trigger tree, then compare against last tick's
+    // overlaps so only enter and exit transitions do anything
+    void UpdateTriggers() {
+        if (level->triggers.empty()) { return; }
+
+        newTriggerPairs.clear();
+        for (size_t i = 0; i < players.size(); i++) {
+            triggerTree.Query(players[i].getBody(), [&](int trigger) {
+                newTriggerPairs.push_back((uint64_t)i << 32 | (uint64_t)trigger);
+            });
+        }
+        for (size_t i = 0; i < enemies.size(); i++) {
+            if (!enemies[i]->getOnScreen()) { continue; }
+            triggerTree.Query(enemies[i]->getBody(), [&](int trigger) {
+                newTriggerPairs.push_back((uint64_t)(players.size() + i) << 32 | (uint64_t)trigger);
+            });
+        }
+        sort(newTriggerPairs.begin(), newTriggerPairs.end());
+
+        // Walk both sorted lists together, anything only in the new list entered and only in the old list exited
+        size_t oldIndex = 0, newIndex = 0;
+        while (oldIndex < triggerPairs.size() || newIndex < newTriggerPairs.size()) {
+            if (newIndex == newTriggerPairs.size() || (oldIndex < triggerPairs.size() && triggerPairs[oldIndex] < newTriggerPairs[newIndex])) {
+                OnTriggerExit((int)(triggerPairs[oldIndex] >> 32), (int)(triggerPairs[oldIndex] & 0xffffffff));
+                oldIndex++;
+            }
+            else if (oldIndex == triggerPairs.size() || newTriggerPairs[newIndex] < triggerPairs[oldIndex]) {
+                OnTriggerEnter((int)(newTriggerPairs[newIndex] >> 32), (int)(newTriggerPairs[newIndex] & 0xffffffff));
+                newIndex++;
+            }
+            else {
+                oldIndex++;
+                newIndex++;
+            }
+        }
+        triggerPairs.swap(newTriggerPairs);
+    }
+
+    void OnTriggerEnter(int body, int triggerIndex) {
+        const TriggerVolume& trigger = level->triggers[triggerIndex];
+
+        int playerCount = (int)players.size();
+        if (trigger.type == TriggerType::KILL) {
+            if (body < playerCount) {
+                players[body].Kill();
+            }
+            else {
+                enemies[body - playerCount]->Kill();
+                PushEvent(WorldEvent::ENEMY_KILLED);
+            }
+            return;
+        }
+        if (body >= playerCount) { return; }
+
+        switch (trigger.type) {
+        case TriggerType::CHECKPOINT: {
+            // Respawn standing on the bottom of the checkpoint
+            SDL_Rect playerBody = players[body].getBody();
+            SDL_Point point = { trigger.area.x + (trigger.area.w - playerBody.w) / 2, trigger.area.y + trigger.area.h - playerBody.h };
+            if (point.x != respawnPoint.x || point.y != respawnPoint.y) {
+                respawnPoint = point;
+                PushEvent(WorldEvent::CHECKPOINT_REACHED);
+            }
+            break;
+        }
+        case TriggerType::MUSIC:
+            musicTrigger = triggerIndex;
+            PushEvent(WorldEvent::MUSIC_CHANGED);
+            break;
+        case TriggerType::GOAL:
+            if (!playerIsRespawning && GoalMet(trigger)) { TriggerWin(); }
+            break;
+        case TriggerType::SPAWNER:
+            for (int enemy : trigger.enemies) {
+                if (enemy >= 0 && enemy < (int)enemies.size() && enemyDormant[enemy] && !enemyActivated[enemy]) {
+                    enemies[enemy]->Respawn(level->enemySpawns[enemy]);
+                    enemyActivated[enemy] = true;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    bool GoalMet(const TriggerVolume& goal) {
+        return !goal.coins || getCoinsRemaining() == 0;
+    }
+
+    void OnTriggerExit(int body, int triggerIndex) {
+        if (body < (int)players.size() && triggerIndex == musicTrigger) {
+            musicTrigger = -1;
+            PushEvent(WorldEvent::MUSIC_CHANGED);
+        }
+    }
+
+    // Find the moving platform a body is standing on, -1 if none
+    int FindRiddenPlatform(const SDL_Rect& body) {
+        int ridden = -1;
+        SDL_Rect feet = { body.x, body.y + body.h, body.w, 1 };
+        platformTree.Query(feet, [&](int userData) {
+            if ((userData & MOVING_PLATFORM) && AABB(feet, movingPlatforms[userData & ~MOVING_PLATFORM].body)) {
+                ridden = userData & ~MOVING_PLATFORM;
+            }
+        });
+        return ridden;
+    }
+
+    // Move every platform along its path, carrying the player and enemies standing on them
+    void MovePlatforms() {
+        if (movingPlatforms.empty()) { return; }
+
+        // Find riders before anything moves (players come first, the rest are enemies)
+        riderPlatforms.assign(players.size() + enemies.size(), -1);
+        for (size_t i = 0; i < players.size(); i++) {
+            riderPlatforms[i] = FindRiddenPlatform(players[i].getBody());
+        }
+        for (size_t i = 0; i < enemies.size(); i++) {
+            if (enemies[i]->getOnScreen()) {
+                riderPlatforms[players.size() + i] = FindRiddenPlatform(enemies[i]->getBody());
+            }
+        }
+
+        for (size_t i = 0; i < movingPlatforms.size(); i++) {
+            MovingPlatform& platform = movingPlatforms[i];
+            const MovingPlatformPath& path = level->movingPlatforms[i];
+            platform.previousPos = platform.pos;
+
+            // Move towards next waypoint, moving on to the one after once reached
+            Vector2 target = path.waypoints[platform.nextWaypoint];
+            float dx = target.x - platform.pos.x;
+            float dy = target.y - platform.pos.y;
+            float distance = sqrtf(dx * dx + dy * dy);
+            float step = path.speed * stepTime;
+            if (distance <= step) {
+                platform.pos = target;
+                platform.nextWaypoint = (platform.nextWaypoint + 1) % (int)path.waypoints.size();
+            }
+            else {
+                platform.pos.x += dx / distance * step;
+                platform.pos.y += dy / distance * step;
+            }
+
+            platform.body.x = (int)platform.pos.x;
+            platform.body.y = (int)platform.pos.y;
+
+            // Tree only changes if the platform left its fat rect
+            Vector2 delta = { platform.pos.x - platform.previousPos.x, platform.pos.y - platform.previousPos.y };
+            platformTree.MoveProxy(platform.proxy, platform.body, delta);
+        }
+
+        // Carry riders by however far their platform moved
+        for (size_t i = 0; i < riderPlatforms.size(); i++) {
+            if (riderPlatforms[i] < 0) { continue; }
+
+            const MovingPlatform& platform = movingPlatforms[riderPlatforms[i]];
+            Vector2 delta = { platform.pos.x - platform.previousPos.x, platform.pos.y - platform.previousPos.y };
+            if (i < players.size()) {
+                players[i].Carry(delta);
+            }
+            else {
+                enemies[i - players.size()]->Carry(delta);
+            }
+        }
+    }
+};
+
+
+// Platforms, coins and enemies generated for one chunk of an endless level, relative to the chunk's left edge so
+// workers never need to know where the world's origin is
+struct LevelChunk {
+    int index;
+    vector<SDL_Rect> platforms;
+    vector<bool> platformBreakable;
+    vector<SDL_Rect> coins;
+    vector<EnemySpawn> enemies;
+};
+
+// Streams procedurally generated chunks to the right of the fixed level. Worker threads generate chunks ahead of
+// every camera and the game thread adds them to the world, chunks no camera is near are removed and their storage
+// reused, so only a fixed window of chunks is ever resident however far the players travel
+class EndlessLevel {
+public:
+    static constexpr int CHUNK_WIDTH = World::CHUNK_WIDTH;
+    // Chunks kept resident either side of each camera
+    static constexpr int CHUNKS_BEHIND = 1;
+    static constexpr int CHUNKS_AHEAD = 2;
+    // The world's origin is moved to the players once they are this many chunks from it
+    static constexpr int REBASE_CHUNKS = 4;
+
+    EndlessLevel(World* world, uint32_t seed, int threadCount = 0) :
+        world(world),
+        seed(seed),
+        stopping(false)
+    {
+        world->MakeEndless();
+
+        // Everything already in the world belongs to the fixed level and is never removed
+        platformChunks.assign(world->getPlatforms().size(), -1);
+        coinChunks.assign(world->getCoins().size(), -1);
+        enemyChunks.assign(world->getEnemies().size(), -1);
+
+        // Leave a core for the game thread
+        if (threadCount <= 0) {
+            threadCount = max(1, min(2, (int)thread::hardware_concurrency() - 1));
+        }
+        for (int i = 0; i < threadCount; i++) {
+            workers.emplace_back(&EndlessLevel::WorkerLoop, this);
+        }
+    };
+
+    ~EndlessLevel() {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueCondition.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Left edge of a chunk in world coordinates, chunk 0 starts where the fixed level ends
+    int ChunkLeft(int index) { return Constants::LEVEL_WIDTH + (index - world->getOriginChunk()) * CHUNK_WIDTH; }
+    // Chunk containing a world x coordinate, negative inside the fixed level
+    int ChunkAt(float x) { return world->getOriginChunk() + (int)floorf((x - Constants::LEVEL_WIDTH) / CHUNK_WIDTH); }
+
+    // Fill a chunk from the seed and its index alone, so a seed always builds the same level whatever order chunks
+    // are generated in (only the engine's raw output is used, as distributions differ between standard libraries)
+    static void Generate(uint32_t seed, LevelChunk& chunk) {
+        chunk.platforms.clear();
+        chunk.platformBreakable.clear();
+        chunk.coins.clear();
+        chunk.enemies.clear();
+
+        seed_seq sequence{ seed, (uint32_t)chunk.index };
+        mt19937 random(sequence);
+        auto range = [&](int low, int high) { return low + (int)(random() % (uint32_t)(high - low + 1)); };
+
+        // Floor runs the whole chunk so there is always somewhere to land
+        chunk.platforms.push_back({ 0, Constants::FLOOR_LEVEL, CHUNK_WIDTH, 130 });
+        chunk.platformBreakable.push_back(false);
+
+        // Stepping stones rising and falling across the chunk, each within a jump of the last
+        int x = range(100, 250);
+        int height = range(150, 300);
+        while (x < CHUNK_WIDTH - 350) {
+            SDL_Rect platform = { x, Constants::FLOOR_LEVEL - height, range(125, 325), range(40, 80) };
+            chunk.platforms.push_back(platform);
+            chunk.platformBreakable.push_back(range(0, 5) == 0);
+
+            int centre = platform.x + platform.w / 2;
+            if (range(0, 2) == 0) {
+                chunk.coins.push_back({ centre - 25, platform.y - 75, 50, 50 });
+            }
+            if (platform.w >= 250 && range(0, 2) == 0) {
+                chunk.enemies.push_back({ "Melee", centre - 27, platform.y - 100, 55, 100, 10, nullptr });
+            }
+            else if (range(0, 4) == 0) {
+                chunk.enemies.push_back({ "Flying", centre - 32, platform.y - 300, 65, 65, 8, nullptr });
+            }
+
+            x += platform.w + range(80, 220);
+            height = max(150, min(1400, height + range(-150, 175)));
+        }
+
+        // Something on the ground too
+        if (range(0, 1) == 0) {
+            chunk.enemies.push_back({ "Melee", range(200, CHUNK_WIDTH - 300), Constants::FLOOR_LEVEL - 100, 55, 100, 10, nullptr });
+        }
+    }
+
+    // Queue chunks the cameras need, add any that have finished generating and remove any no longer needed
+    // Only waits if a player is inside a chunk that hasnt arrived yet, as they would fall through its floor
+    void Update() {
+        RebaseOrigin();
+
+        wanted.clear();
+        for (int i = 0; i < world->getPlayerCount(); i++) {
+            Camera camera = world->getRenderCamera(1.0f, i);
+            int first = max(0, ChunkAt(camera.x) - CHUNKS_BEHIND);
+            int last = ChunkAt(camera.x + camera.w) + CHUNKS_AHEAD;
+            for (int index = first; index <= last; index++) {
+                wanted.push_back(index);
+            }
+        }
+        sort(wanted.begin(), wanted.end());
+        wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+
+        for (size_t i = 0; i < resident.size();) {
+            if (binary_search(wanted.begin(), wanted.end(), resident[i]->index)) {
+                i++;
+                continue;
+            }
+            RemoveChunk(resident[i]->index);
+            pool.push_back(resident[i]);
+            resident[i] = resident.back();
+            resident.pop_back();
+        }
+
+        // Hand missing chunks to the workers, reusing storage from removed chunks
+        bool queued = false;
+        {
+            lock_guard<mutex> lock(queueMutex);
+            for (int index : wanted) {
+                if (IsResident(index) || find(requested.begin(), requested.end(), index) != requested.end()) { continue; }
+
+                if (pool.empty()) {
+                    storage.push_back(make_unique<LevelChunk>());
+                    pool.push_back(storage.back().get());
+                }
+                LevelChunk* chunk = pool.back();
+                pool.pop_back();
+                chunk->index = index;
+                pending.push_back(chunk);
+                requested.push_back(index);
+                queued = true;
+            }
+        }
+        if (queued) {
+            queueCondition.notify_all();
+        }
+
+        needed.clear();
+        for (int i = 0; i < world->getPlayerCount(); i++) {
+            SDL_Rect body = world->getPlayer(i).getBody();
+            int index = ChunkAt(body.x + body.w / 2.0f);
+            if (find(requested.begin(), requested.end(), index) != requested.end()) {
+                needed.push_back(index);
+            }
+        }
+        {
+            unique_lock<mutex> lock(queueMutex);
+            finishedCondition.wait(lock, [this]() {
+                for (int index : needed) {
+                    bool arrived = false;
+                    for (LevelChunk* chunk : finished) {
+                        if (chunk->index == index) { arrived = true; }
+                    }
+                    if (!arrived) { return false; }
+                }
+                return true;
+            });
+            arrived.swap(finished);
+        }
+
+        for (LevelChunk* chunk : arrived) {
+            requested.erase(find(requested.begin(), requested.end(), chunk->index));
+            if (binary_search(wanted.begin(), wanted.end(), chunk->index)) {
+                AddChunk(*chunk);
+                resident.push_back(chunk);
+            }
+            else {
+                pool.push_back(chunk);
+            }
+        }
+        arrived.clear();
+    }
+
+    // Getters
+    int getResidentCount() { return (int)resident.size(); }
+    int getAllocatedCount() { return (int)storage.size(); }
+
+private:
+    // Move the world's origin to the chunk the players are in once they are far enough from it, every player is
+    // kept near it as each has their own view into the world
+    void RebaseOrigin() {
+        float centre = 0.0f;
+        for (int i = 0; i < world->getPlayerCount(); i++) {
+            SDL_Rect body = world->getPlayer(i).getBody();
+            centre += (body.x + body.w / 2.0f) / world->getPlayerCount();
+        }
+        int chunks = (int)floorf(centre / CHUNK_WIDTH);
+        if (abs(chunks) >= REBASE_CHUNKS) {
+            world->ShiftOrigin(chunks);
+        }
+    }
+
+    bool IsResident(int index) {
+        for (LevelChunk* chunk : resident) {
+            if (chunk->index == index) { return true; }
+        }
+        return false;
+    }
+
+    // Chunks are placed wherever the origin is when they arrive
+    void AddChunk(const LevelChunk& chunk) {
+        int left = ChunkLeft(chunk.index);
+        for (size_t i = 0; i < chunk.platforms.size(); i++) {
+            SDL_Rect platform = chunk.platforms[i];
+            platform.x += left;
+            world->InsertPlatform((int)world->getPlatforms().size(), platform, chunk.platformBreakable[i]);
+            platformChunks.push_back(chunk.index);
+        }
+        for (auto coin : chunk.coins) {
+            coin.x += left;
+            world->InsertCoin((int)world->getCoins().size(), coin);
+            coinChunks.push_back(chunk.index);
+        }
+        for (auto spawn : chunk.enemies) {
+            spawn.x += left;
+            world->InsertEnemy((int)world->getEnemies().size(), spawn);
+            enemyChunks.push_back(chunk.index);
+        }
+    }
+
+    // World removal swaps the last object into the gap, so the owner lists do the same and are walked backwards so
+    // whatever is swapped in has already been checked
+    void RemoveChunk(int index) {
+        for (int i = (int)platformChunks.size() - 1; i >= 0; i--) {
+            if (platformChunks[i] != index) { continue; }
+            world->RemovePlatform(i);
+            platformChunks[i] = platformChunks.back();
+            platformChunks.pop_back();
+        }
+        for (int i = (int)coinChunks.size() - 1; i >= 0; i--) {
+            if (coinChunks[i] != index) { continue; }
+            world->RemoveCoin(i);
+            coinChunks[i] = coinChunks.back();
+            coinChunks.pop_back();
+        }
+        for (int i = (int)enemyChunks.size() - 1; i >= 0; i--) {
+            if (enemyChunks[i] != index) { continue; }
+            world->RemoveEnemy(i);
+            enemyChunks[i] = enemyChunks.back();
+            enemyChunks.pop_back();
+        }
+    }
+
+    void WorkerLoop() {
+        while (true) {
+            LevelChunk* chunk = nullptr;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this]() { return stopping || !pending.empty(); });
+                if (stopping) { return; }
+                chunk = pending.front();
+                pending.erase(pending.begin());
+            }
+
+            Generate(seed, *chunk);
+
+            {
+                lock_guard<mutex> lock(queueMutex);
+                finished.push_back(chunk);
+            }
+            finishedCondition.notify_all();
+        }
+    }
+
+    World* world;
+    uint32_t seed;
+
+    // Chunk that added each world object, -1 for the fixed level
+    vector<int> platformChunks;
+    vector<int> coinChunks;
+    vector<int> enemyChunks;
+
+    // Every chunk ever allocated, the rest only point into it
+    vector<unique_ptr<LevelChunk>> storage;
+    vector<LevelChunk*> pool;
+    vector<LevelChunk*> resident;
+    vector<int> requested;
+    vector<int> wanted;
+    vector<int> needed;
+    vector<LevelChunk*> arrived;
+
+    // Shared with the workers
+    vector<thread> workers;
+    mutex queueMutex;
+    condition_variable queueCondition;
+    condition_variable finishedCondition;
+    vector<LevelChunk*> pending;
+    vector<LevelChunk*> finished;
+    bool stopping;
+};
+
+
+// Benchmark streaming an endless level by panning the camera right through it (run with "--stream <chunks>")
+int runStreamBenchmark(int chunkCount) {
+    World world(loadLevel("Files"));
+    EndlessLevel endless(&world, 1);
+
+    // Start from the end of the fixed level and carry the player and camera a chunk every few updates, waiting for
+    // each chunk to arrive (the origin follows the player)
+    world.PanCamera(0, (float)Constants::LEVEL_WIDTH, 0.0f);
+    world.getPlayer().Carry(Vector2{ (float)Constants::LEVEL_WIDTH, 0.0f });
+    const int updatesPerChunk = 8;
+    double slowest = 0.0;
+    auto start = chrono::steady_clock::now();
+    for (int update = 0; update < chunkCount * updatesPerChunk; update++) {
+        float step = (float)EndlessLevel::CHUNK_WIDTH / updatesPerChunk;
+        world.PanCamera(0, step, 0.0f);
+        world.getPlayer().Carry(Vector2{ step, 0.0f });
+        world.UpdateOnScreen();
+        auto updateStart = chrono::steady_clock::now();
+        endless.Update();
+        chrono::duration<double, micro> updateTime = chrono::steady_clock::now() - updateStart;
+        slowest = max(slowest, updateTime.count());
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+
+    cout << chunkCount << " chunks in " << elapsed.count() << "ms, slowest update " << slowest << "us, "
+        << endless.getResidentCount() << " resident and " << endless.getAllocatedCount() << " allocated chunks, "
+        << world.getPlatforms().size() << " platforms in world" << endl;
+    ChunkPosition position = world.ToChunkPosition(world.getPlayer().getPos());
+    cout << "player at chunk " << position.chunk << " + " << position.offset.x << ", origin at chunk "
+        << world.getOriginChunk() << endl;
+    return 0;
+}
+
+// Observation of one world, returned after every batch step
+struct Observation {
+    Vector2 playerPos;
+    Vector2 playerVel;
+    int health;
+    int coinsRemaining;
+    bool isGrounded;
+    bool isRespawning;
+    bool isFinished;
+};
+
+// Reward given to a bot for each event
+float rewardForEvent(WorldEvent event) {
+    switch (event) {
+    case WorldEvent::COIN_COLLECTED: return 1.0f;
+    case WorldEvent::PLAYER_DAMAGED: return -0.1f;
+    case WorldEvent::PLAYER_DIED: return -1.0f;
+    case WorldEvent::PLAYER_WON: return 10.0f;
+    case WorldEvent::ENEMY_KILLED: return 0.5f;
+    default: return 0.0f;
+    }
+}
+
+// Runs many independent worlds of one level in lockstep, split across worker threads
+class BatchSimulation {
+public:
+    BatchSimulation(shared_ptr<const Level> level, int worldCount, int threadCount = 0) :
+        observations(worldCount),
+        rewards(worldCount),
+        stepInputs(nullptr),
+        stepTicks(0),
+        generation(0),
+        pendingWorkers(0),
+        stopping(false)
+    {
+        worlds.reserve(worldCount);
+        for (int i = 0; i < worldCount; i++) {
+            worlds.push_back(make_unique<World>(level));
+        }
+
+        // Default to one thread per core, the calling thread does the first slice itself
+        if (threadCount <= 0) {
+            threadCount = max(1, (int)thread::hardware_concurrency());
+        }
+        this->threadCount = max(1, min(threadCount, worldCount));
+        for (int i = 1; i < this->threadCount; i++) {
+            workers.emplace_back(&BatchSimulation::WorkerLoop, this, i);
+        }
+    };
+
+    ~BatchSimulation() {
+        {
+            lock_guard<mutex> lock(workMutex);
+            stopping = true;
+            generation++;
+        }
+        startCondition.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Step every world with its own input (inputs[i] drives world i) for a number of ticks
+    void Step(const vector<PlayerInput>& inputs, int ticks = 1) {
+        stepInputs = &inputs;
+        stepTicks = ticks;
+        {
+            lock_guard<mutex> lock(workMutex);
+            pendingWorkers = threadCount - 1;
+            generation++;
+        }
+        startCondition.notify_all();
+
+        StepSlice(0);
+
+        unique_lock<mutex> lock(workMutex);
+        doneCondition.wait(lock, [this]() { return pendingWorkers == 0; });
+    }
+
+    void Reset(int index) { worlds[index]->Reset(); }
+
+    // Getters
+    const vector<Observation>& getObservations() { return observations; }
+    const vector<float>& getRewards() { return rewards; }
+    World& getWorld(int index) { return *worlds[index]; }
+    int getWorldCount() { return (int)worlds.size(); }
+
+private:
+    void WorkerLoop(int slice) {
+        uint64_t seenGeneration = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(workMutex);
+                startCondition.wait(lock, [&]() { return generation != seenGeneration; });
+                seenGeneration = generation;
+                if (stopping) { return; }
+            }
+
+            StepSlice(slice);
+
+            lock_guard<mutex> lock(workMutex);
+            pendingWorkers--;
+            if (pendingWorkers == 0) {
+                doneCondition.notify_one();
+            }
+        }
+    }
+
+    // Each thread steps a contiguous slice of worlds, so no world is touched by two threads
+    void StepSlice(int slice) {
+        size_t begin = worlds.size() * slice / threadCount;
+        size_t end = worlds.size() * (slice + 1) / threadCount;
+
+        for (size_t i = begin; i < end; i++) {
+            World& world = *worlds[i];
+            float reward = 0.0f;
+
+            for (int tick = 0; tick < stepTicks && !world.getIsFinished(); tick++) {
+                world.Step((*stepInputs)[i]);
+                for (auto event : world.getEvents()) {
+                    reward += rewardForEvent(event);
+                }
+                world.ClearEvents();
+            }
+
+            Player& player = world.getPlayer();
+            observations[i] = Observation{
+                player.getPos(),
+                player.getVel(),
+                player.getHealth(),
+                world.getCoinsRemaining(),
+                player.getIsGrounded(),
+                world.getPlayerIsRespawning(),
+                world.getIsFinished()
+            };
+            rewards[i] = reward;
+        }
+    }
+
+    vector<unique_ptr<World>> worlds;
+    vector<Observation> observations;
+    vector<float> rewards;
+
+    const vector<PlayerInput>* stepInputs;
+    int stepTicks;
+    int threadCount;
+
+    vector<thread> workers;
+    mutex workMutex;
+    condition_variable startCondition;
+    condition_variable doneCondition;
+    uint64_t generation;
+    int pendingWorkers;
+    bool stopping;
+};
+
+// Benchmark batch simulation with simple scripted inputs (run with "--batch <worlds> <ticks>")
+int runBatchBenchmark(int worldCount, int ticks) {
+    BatchSimulation batch(loadLevel("Files"), worldCount);
+
+    // Alternate between running right and left whilst jumping, so worlds spread out over the level
+    vector<PlayerInput> inputs(worldCount);
+    auto start = chrono::steady_clock::now();
+    for (int tick = 0; tick < ticks; tick += 100) {
+        for (int i = 0; i < worldCount; i++) {
+            bool goRight = ((tick / 500 + i) % 3) != 0;
+            inputs[i] = PlayerInput{ !goRight, goRight, false, false, (tick / 100 + i) % 2 == 0, false, true };
+        }
+        batch.Step(inputs, min(100, ticks - tick));
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    double totalTicks = (double)worldCount * ticks;
+    cout << worldCount << " worlds x " << ticks << " ticks in " << elapsed.count() << "s ("
+        << (long long)(totalTicks / elapsed.count()) << " ticks/s)" << endl;
+    return 0;
+}
+
+
+// Benchmark line of sight with random screen sized rays over the level (run with "--los <rays>")
+int runLineOfSightBenchmark(int rayCount) {
+    World world(loadLevel("Files"));
+    mt19937 random(1);
+    uniform_real_distribution<float> randomX(0.0f, (float)Constants::LEVEL_WIDTH);
+    uniform_real_distribution<float> randomY((float)(Constants::FLOOR_LEVEL - Constants::LEVEL_HEIGHT), (float)Constants::FLOOR_LEVEL);
+    uniform_real_distribution<float> randomOffset(-700.0f, 700.0f);
+
+    vector<LineOfSightRay> rays(rayCount);
+    for (int i = 0; i < rayCount; i++) {
+        Vector2 from = { randomX(random), randomY(random) };
+        rays[i] = { from, { from.x + randomOffset(random), from.y + randomOffset(random) * 0.5f }, i, false };
+    }
+
+    const int repeats = 1000;
+    int blocked = 0;
+    auto start = chrono::steady_clock::now();
+    for (int repeat = 0; repeat < repeats; repeat++) {
+        world.CastRays(rays);
+    }
+    chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+
+    for (auto& ray : rays) {
+        if (ray.blocked) { blocked++; }
+    }
+    cout << rayCount << " rays in " << elapsed.count() / repeats << "us per batch (" << blocked << " blocked)" << endl;
+    return 0;
+}
+
+
+// Benchmark the world's enemy update loop over enemies spread through the level (run with "--enemies <count>")
+// Timed with and without platform collision, as gathering platforms costs the same whatever the enemy layout
+int runEnemyBenchmark(int enemyCount) {
+    shared_ptr<Level> level = make_shared<Level>(*loadLevel("Files"));
+    mt19937 random(1);
+    uniform_int_distribution<int> randomX(0, Constants::LEVEL_WIDTH - 65);
+    uniform_int_distribution<int> randomY(Constants::FLOOR_LEVEL - Constants::LEVEL_HEIGHT, Constants::FLOOR_LEVEL - 100);
+    for (int i = 0; i < enemyCount; i++) {
+        bool flying = i % 3 == 0;
+        level->enemySpawns.push_back({ flying ? "Flying" : "Melee", randomX(random), randomY(random), flying ? 65 : 55, flying ? 65 : 100, 10, nullptr });
+    }
+
+    // Zoomed all the way out one camera covers most of the level, so most enemies are active and chasing
+    World world(level);
+    world.SetZoom(0, Constants::MIN_ZOOM);
+    Camera camera = world.getRenderCamera(1.0f);
+    vector<SDL_Rect> cameraRects = { { (int)camera.x, (int)camera.y, camera.w, camera.h } };
+    vector<unique_ptr<Enemy>>& enemies = world.getEnemies();
+    for (auto& enemy : enemies) {
+        enemy->setCanSeePlayer(true);
+    }
+
+    Player& target = world.getPlayer();
+    vector<SDL_Rect> noPlatforms;
+    const int ticks = 200;
+    double times[2];
+    for (int collide = 0; collide < 2; collide++) {
+        auto start = chrono::steady_clock::now();
+        for (int tick = 0; tick < ticks; tick++) {
+            for (auto& enemy : enemies) {
+                enemy->CheckOnScreen(cameraRects);
+                bool gather = collide && enemy->getOnScreen();
+                enemy->Update(gather ? world.GatherPlatforms(enemy->getBody()) : noPlatforms, Constants::FIXED_DT, target.getPos(), target.getBody());
+            }
+        }
+        chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+        times[collide] = elapsed.count() / ((double)ticks * enemyCount);
+    }
+
+    int active = 0;
+    for (auto& enemy : enemies) {
+        if (enemy->getOnScreen()) { active++; }
+    }
+    cout << enemies.size() << " enemies (" << active << " active, " << sizeof(MeleeEnemy) << " bytes each): "
+        << times[0] << "ns per enemy per tick without collision, " << times[1] << "ns with" << endl;
+    return 0;
+}
+
+
+// Benchmark behaviour scripts against the built in enemy classes they replace, over the same enemies in two worlds
+// (run with "--behaviours <count>")
+int runBehaviourBenchmark(int enemyCount) {
+    shared_ptr<Level> level = make_shared<Level>(*loadLevel("Files"));
+    level->enemySpawns.clear();
+    mt19937 random(1);
+    uniform_int_distribution<int> randomX(0, Constants::LEVEL_WIDTH - 65);
+    uniform_int_distribution<int> randomY(Constants::FLOOR_LEVEL - Constants::LEVEL_HEIGHT, Constants::FLOOR_LEVEL - 100);
+    for (int i = 0; i < enemyCount; i++) {
+        bool flying = i % 3 == 0;
+        level->enemySpawns.push_back({ flying ? "Flying" : "Melee", randomX(random), randomY(random), flying ? 65 : 55, flying ? 65 : 100, 10, nullptr });
+    }
+    shared_ptr<Level> scriptedLevel = make_shared<Level>(*level);
+    shared_ptr<const BehaviourScript> scripts[2] = {
+        loadBehaviourScript("Files/", "melee.behaviour"), loadBehaviourScript("Files/", "flying.behaviour")
+    };
+    for (auto& spawn : scriptedLevel->enemySpawns) {
+        spawn.behaviour = scripts[spawn.type == "Flying"];
+    }
+
+    // Every enemy is woken as if on screen, as zooming out no longer wakes them, so most enemies are chasing
+    World native(level);
+    World scripted(scriptedLevel);
+    vector<SDL_Rect> wholeLevel = { { 0, Constants::FLOOR_LEVEL - Constants::LEVEL_HEIGHT, Constants::LEVEL_WIDTH, Constants::LEVEL_HEIGHT } };
+    for (World* world : { &native, &scripted }) {
+        for (auto& enemy : world->getEnemies()) {
+            enemy->CheckOnScreen(wholeLevel);
+            enemy->setCanSeePlayer(true);
+        }
+    }
+
+    Player& target = native.getPlayer();
+    vector<unique_ptr<Enemy>>& enemies = native.getEnemies();
+    const int ticks = 200;
+    auto start = chrono::steady_clock::now();
+    for (int tick = 0; tick < ticks; tick++) {
+        for (auto& enemy : enemies) {
+            if (enemy->getChasingPlayer()) { enemy->TrackPlayer(target.getPos(), target.getBody()); }
+        }
+    }
+    chrono::duration<double, nano> nativeTime = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    for (int tick = 0; tick < ticks; tick++) {
+        scripted.RunBehaviours();
+    }
+    chrono::duration<double, nano> scriptedTime = chrono::steady_clock::now() - start;
+
+    // Scripts should give exactly the velocities the classes do
+    int active = 0;
+    int mismatched = 0;
+    for (int i = 0; i < enemyCount; i++) {
+        Vector2 a = enemies[i]->getVel();
+        Vector2 b = scripted.getEnemies()[i]->getVel();
+        if (enemies[i]->getChasingPlayer()) { active++; }
+        if (a.x != b.x || a.y != b.y) { mismatched++; }
+    }
+    cout << enemyCount << " enemies (" << active << " chasing, " << scripts[0]->getInstructionCount() << " and "
+        << scripts[1]->getInstructionCount() << " instructions): " << nativeTime.count() / ((double)ticks * enemyCount)
+        << "ns per enemy per tick built in, " << scriptedTime.count() / ((double)ticks * enemyCount) << "ns scripted, "
+        << mismatched << " velocities differ" << endl;
+    return mismatched == 0 ? 0 : 1;
+}
+
+
+// Benchmark a flooding set piece, water pouring in across the top of the fixed level for a number of hazard steps
+// with lava rising from the floor, timing each step of both fluids (run with "--hazards <steps>")
+int runHazardBenchmark(int steps) {
+    shared_ptr<const Level> level = loadLevel("Files");
+    HazardGrid hazards;
+    hazards.Reset();
+    for (auto& platform : level->platforms) {
+        hazards.SetSolid(platform, true);
+    }
+    SDL_Rect rain = { 0, HazardGrid::TOP, Constants::LEVEL_WIDTH, HazardGrid::TILE * 2 };
+    SDL_Rect pool = { 0, Constants::FLOOR_LEVEL - HazardGrid::TILE * 4, Constants::LEVEL_WIDTH / 4, HazardGrid::TILE * 4 };
+    hazards.Fill(HazardType::LAVA, pool);
+
+    double total = 0.0;
+    double worst = 0.0;
+    int peakRegions = 0;
+    for (int step = 0; step < steps; step++) {
+        auto start = chrono::steady_clock::now();
+        hazards.Fill(HazardType::WATER, rain);
+        hazards.Step(HazardType::WATER);
+        if (step % HazardGrid::LAVA_INTERVAL == 0) {
+            hazards.Step(HazardType::LAVA);
+        }
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        total += elapsed.count();
+        worst = max(worst, elapsed.count());
+        peakRegions = max(peakRegions, hazards.getActiveRegions(HazardType::WATER) + hazards.getActiveRegions(HazardType::LAVA));
+    }
+
+    int waterTiles = 0;
+    hazards.ForEachRun(HazardType::WATER, SDL_Rect{ 0, HazardGrid::TOP, Constants::LEVEL_WIDTH, Constants::LEVEL_HEIGHT }, [&](SDL_Rect run) {
+        waterTiles += run.w / HazardGrid::TILE;
+    });
+    cout << steps << " hazard steps over " << HazardGrid::COLS << "x" << HazardGrid::ROWS << " tiles: " << total / steps
+        << "ms average, " << worst << "ms worst, " << peakRegions << " of " << HazardGrid::REGION_COLS * HazardGrid::REGION_BANDS * 2
+        << " regions active at most, " << waterTiles << " water tiles" << endl;
+    return 0;
+}
+
+
+// Benchmark advancing many animated instances with mixed clips (run with "--anim <instances>")
+int runAnimationBenchmark(int instanceCount) {
+    AnimationSystem animation;
+    mt19937 random(1);
+    uniform_int_distribution<int> randomClip(0, (int)AnimationClipId::COUNT - 1);
+    for (int i = 0; i < instanceCount; i++) {
+        animation.Add((AnimationClipId)randomClip(random));
+    }
+
+    const int repeats = 1000;
+    long long frameSum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int repeat = 0; repeat < repeats; repeat++) {
+        animation.Update(1.0f / 60.0f);
+        frameSum += animation.getFrame(repeat % instanceCount);
+    }
+    chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+
+    cout << instanceCount << " instances in " << elapsed.count() / repeats << "us per update (checksum " << frameSum << ")" << endl;
+    return 0;
+}
+
+
+// Heuristic bot that plays a world through the same PlayerInput a human would produce
+class PlaytestBot {
+public:
+    PlaytestBot(unsigned int seed) :
+        rng(seed),
+        jumpHoldTimer(0.0f),
+        jumpHeld(false),
+        wanderTimer(0.0f),
+        wanderRight(true),
+        stuckTimer(0.0f),
+        bestDistance(INFINITY)
+    {
+    };
+
+    // Decide what to press this tick
+    PlayerInput Think(World& world) {
+        PlayerInput input = {};
+        Player& player = world.getPlayer();
+        SDL_Rect body = player.getBody();
+        Vector2 centre = { body.x + body.w / 2.0f, body.y + body.h / 2.0f };
+
+        // Head for the nearest uncollected coin (height counts double as climbing is harder than running)
+        Vector2 target = centre;
+        float targetDistance = INFINITY;
+        for (auto& coin : world.getCoins()) {
+            if (coin.collected) { continue; }
+
+            float dx = coin.body.x + coin.body.w / 2.0f - centre.x;
+            float dy = coin.body.y + coin.body.h / 2.0f - centre.y;
+            float distance = sqrtf(dx * dx + 4.0f * dy * dy);
+            if (distance < targetDistance) {
+                targetDistance = distance;
+                target = { centre.x + dx, centre.y + dy };
             }
-            // Move Right
-            if (keystate[SDL_SCANCODE_D] || leftStickXAxis > 0.0f) {
-                facingLeft = false;
-                vel.x = speed;
+        }
+        float dx = target.x - centre.x;
+        float dy = target.y - centre.y;
+
+        // If no progress has been made for a while, wander in a random direction to get unstuck
+        if (targetDistance < bestDistance - 1.0f) {
+            bestDistance = targetDistance;
+            stuckTimer = 0.0f;
+        }
+        else {
+            stuckTimer += Constants::FIXED_DT;
+        }
+        if (stuckTimer > 2.0f) {
+            stuckTimer = 0.0f;
+            bestDistance = targetDistance;
+            wanderTimer = uniform_real_distribution<float>(0.5f, 3.0f)(rng);
+            wanderRight = rng() % 2 == 0;
+        }
+
+        // Move towards target
+        bool wantsMove = true;
+        if (wanderTimer > 0.0f) {
+            wanderTimer -= Constants::FIXED_DT;
+            input.right = wanderRight;
+            input.left = !wanderRight;
+        }
+        else if (dx > 10.0f) {
+            input.right = true;
+        }
+        else if (dx < -10.0f) {
+            input.left = true;
+        }
+        else {
+            wantsMove = false;
+        }
+
+        // Jump when target is above or a wall is in the way, holding the button for a random time to vary height
+        bool blocked = wantsMove && fabs(player.getVel().x) < 1.0f;
+        if (jumpHoldTimer > 0.0f) {
+            jumpHoldTimer -= Constants::FIXED_DT;
+            input.jump = true;
+        }
+        else if (!jumpHeld && player.getIsGrounded() && (dy < -60.0f || blocked || rng() % 200 == 0)) {
+            jumpHoldTimer = uniform_real_distribution<float>(0.1f, 0.6f)(rng);
+            input.jump = true;
+        }
+        jumpHeld = input.jump;
+
+        // Dash across large horizontal gaps whilst in the air
+        if (!player.getIsGrounded() && fabs(dx) > 300.0f && rng() % 50 == 0) {
+            input.dash = true;
+        }
+
+        // Attack nearby enemies, aiming up or down if they are above or below
+        for (auto& enemy : world.getEnemies()) {
+            if (!enemy->getOnScreen()) { continue; }
+
+            SDL_Rect enemyBody = enemy->getBody();
+            float enemyDx = enemyBody.x + enemyBody.w / 2.0f - centre.x;
+            float enemyDy = enemyBody.y + enemyBody.h / 2.0f - centre.y;
+            if (fabs(enemyDx) < 150.0f && fabs(enemyDy) < 150.0f) {
+                input.attack = true;
+                input.up = enemyDy < -body.h;
+                input.down = enemyDy > body.h;
+                break;
+            }
+        }
+
+        // Coins are collected by attacking them
+        if (fabs(dx) < 120.0f && fabs(dy) < 150.0f) {
+            input.attack = true;
+            input.up = dy < -body.h / 2.0f;
+        }
+
+        return input;
+    }
+
+private:
+    mt19937 rng;
+    float jumpHoldTimer;
+    bool jumpHeld;
+    float wanderTimer;
+    bool wanderRight;
+    float stuckTimer;
+    float bestDistance;
+};
+
+struct BotResult {
+    bool completed;
+    float completionTime;
+    int deaths;
+    int coinsCollected;
+    float coverage;
+    int ticks;
+};
+
+// Play one headless run with a bot until it wins or runs out of time
+BotResult runPlaytestBot(shared_ptr<const Level> level, unsigned int seed, int maxTicks) {
+    World world(level);
+    PlaytestBot bot(seed);
+    vector<bool> visited(Telemetry::CELLS, false);
+    BotResult result = { false, 0.0f, 0, 0, 0.0f, 0 };
+
+    int tick = 0;
+    for (; tick < maxTicks && !world.getIsFinished(); tick++) {
+        world.Step(bot.Think(world));
+
+        for (auto event : world.getEvents()) {
+            if (event == WorldEvent::PLAYER_DIED) {
+                result.deaths++;
+            }
+            else if (event == WorldEvent::PLAYER_WON) {
+                result.completed = true;
+                result.completionTime = tick * Constants::FIXED_DT;
+            }
+        }
+        world.ClearEvents();
+
+        int cell = Telemetry::CellIndex(world.getPlayer().getPos());
+        if (cell >= 0) { visited[cell] = true; }
+    }
+
+    int visitedCells = 0;
+    for (bool cellVisited : visited) {
+        if (cellVisited) { visitedCells++; }
+    }
+    result.coverage = (float)visitedCells / Telemetry::CELLS;
+    result.coinsCollected = (int)world.getCoins().size() - world.getCoinsRemaining();
+    result.ticks = tick;
+    return result;
+}
+
+// Run many bot playthroughs across all cores and report results (run with "--bot <runs> [maxSeconds]")
+int runPlaytestBots(int runs, float maxSeconds) {
+    auto level = loadLevel("Files");
+    int maxTicks = (int)(maxSeconds / Constants::FIXED_DT);
+    vector<BotResult> results(runs);
+
+    atomic<int> nextRun(0);
+    auto worker = [&]() {
+        for (int run = nextRun++; run < runs; run = nextRun++) {
+            results[run] = runPlaytestBot(level, (unsigned int)run, maxTicks);
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    int threadCount = max(1, min(runs, (int)thread::hardware_concurrency()));
+    for (int i = 0; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    // Per run results for comparing builds, then a summary
+    ofstream file("bot_results.csv");
+    file << "run,completed,completion_time,deaths,coins,coverage\n";
+    int completed = 0;
+    float totalTime = 0.0f, totalDeaths = 0.0f, totalCoins = 0.0f, totalCoverage = 0.0f;
+    double totalTicks = 0.0;
+    for (int run = 0; run < runs; run++) {
+        const BotResult& result = results[run];
+        file << run << "," << result.completed << "," << result.completionTime << "," << result.deaths << ","
+            << result.coinsCollected << "," << result.coverage << "\n";
+
+        if (result.completed) {
+            completed++;
+            totalTime += result.completionTime;
+        }
+        totalDeaths += result.deaths;
+        totalCoins += result.coinsCollected;
+        totalCoverage += result.coverage;
+        totalTicks += result.ticks;
+    }
+
+    cout << runs << " bot runs in " << elapsed.count() << "s\n"
+        << "completed: " << completed << "/" << runs << "\n"
+        << "mean completion time: " << (completed ? totalTime / completed : 0.0f) << "s\n"
+        << "mean deaths: " << totalDeaths / runs << "\n"
+        << "mean coins: " << totalCoins / runs << "\n"
+        << "mean coverage: " << totalCoverage / runs * 100.0f << "%\n"
+        << "simulation speed: " << totalTicks * Constants::FIXED_DT / elapsed.count() << "x real time" << endl;
+    return 0;
+}
+
+
+
+// Offline search over discretised player states, using the real Player movement rules to find what is reachable
+class ReachabilityAnalyzer {
+public:
+    static constexpr int ACTION_TICKS = 8;
+    static constexpr int SHARDS = 64;
+    static constexpr int UNREACHED = INT_MAX;
+    static constexpr int STALL_DEPTHS = 8;
+
+    ReachabilityAnalyzer(shared_ptr<const Level> level, float maxSeconds) :
+        level(level),
+        maxDepth((int)(maxSeconds / (ACTION_TICKS * Constants::FIXED_DT))),
+        coinDepths(new atomic<int>[level->coins.size()]),
+        platformDepths(new atomic<int>[level->platforms.size()]),
+        cellDepths(new atomic<int>[Telemetry::CELLS]),
+        lastNewCellDepth(0),
+        statesExplored(0)
+    {
+        for (size_t i = 0; i < level->coins.size(); i++) { coinDepths[i].store(UNREACHED); }
+        for (size_t i = 0; i < level->platforms.size(); i++) { platformDepths[i].store(UNREACHED); }
+        for (int i = 0; i < Telemetry::CELLS; i++) { cellDepths[i].store(UNREACHED); }
+    };
+
+    // Breadth first search from spawn, each depth is expanded in parallel so depth gives the minimum time
+    void Run(int threadCount) {
+        Camera camera = { 0.0f, 0.0f, 0.0f, 0.0f, Constants::WIN_WIDTH, Constants::WIN_HEIGHT, 1.0f };
+        Player spawn(55, 100, nullptr);
+        spawn.RespawnPlayer(camera, 100, 450, 10);
+
+        vector<Player> frontier = { spawn };
+        Insert(StateKey(spawn));
+
+        for (int depth = 1; depth <= maxDepth && !frontier.empty(); depth++) {
+            vector<vector<Player>> nextFrontiers(threadCount);
+            atomic<size_t> nextIndex(0);
+
+            auto worker = [&](int threadIndex) {
+                Camera threadCamera = camera;
+                for (size_t i = nextIndex++; i < frontier.size(); i = nextIndex++) {
+                    for (auto& action : ACTIONS) {
+                        // Snapshot is just a copy of the player, restore by discarding it
+                        Player player = frontier[i];
+                        if (Simulate(player, action, threadCamera, depth) && Insert(StateKey(player))) {
+                            nextFrontiers[threadIndex].push_back(player);
+                        }
+                    }
+                }
+            };
+
+            vector<thread> threads;
+            for (int i = 1; i < threadCount; i++) {
+                threads.emplace_back(worker, i);
+            }
+            worker(0);
+            for (auto& thread : threads) {
+                thread.join();
+            }
+
+            statesExplored += frontier.size();
+            frontier.clear();
+            for (auto& next : nextFrontiers) {
+                frontier.insert(frontier.end(), next.begin(), next.end());
+            }
+
+            // Stop early once every coin and platform is reached and the explored region has stopped growing
+            if (depth - lastNewCellDepth.load() > STALL_DEPTHS && AllTargetsReached()) {
+                break;
+            }
+        }
+    }
+
+    void Report(ostream& out) {
+        float depthTime = ACTION_TICKS * Constants::FIXED_DT;
+        out << "states explored: " << statesExplored << "\n";
+
+        int coinsReached = 0;
+        for (size_t i = 0; i < level->coins.size(); i++) {
+            const SDL_Rect& coin = level->coins[i].body;
+            int depth = coinDepths[i].load();
+            out << "coin " << i << " (" << coin.x << ", " << Constants::FLOOR_LEVEL - coin.y << "): ";
+            if (depth == UNREACHED) {
+                out << "unreachable\n";
+            }
+            else {
+                out << depth * depthTime << "s\n";
+                coinsReached++;
+            }
+        }
+        out << "coins reachable: " << coinsReached << "/" << level->coins.size() << "\n";
+
+        int platformsReached = 0;
+        for (size_t i = 0; i < level->platforms.size(); i++) {
+            const SDL_Rect& platform = level->platforms[i];
+            if (platformDepths[i].load() == UNREACHED) {
+                out << "platform " << i << " (" << platform.x << ", " << Constants::FLOOR_LEVEL - platform.y << ") unreachable\n";
+            }
+            else {
+                platformsReached++;
+            }
+        }
+        out << "platforms reachable: " << platformsReached << "/" << level->platforms.size() << "\n";
+
+        int cellsReached = 0;
+        for (int i = 0; i < Telemetry::CELLS; i++) {
+            if (cellDepths[i].load() != UNREACHED) { cellsReached++; }
+        }
+        out << "regions reachable: " << 100.0f * cellsReached / Telemetry::CELLS << "%" << endl;
+    }
+
+private:
+    // Idle, move, jump and dash in each direction
+    static constexpr PlayerInput ACTIONS[] = {
+        { false, false, false, false, false, false, false },
+        { true, false, false, false, false, false, false },
+        { false, true, false, false, false, false, false },
+        { false, false, false, false, true, false, false },
+        { true, false, false, false, true, false, false },
+        { false, true, false, false, true, false, false },
+        { true, false, false, false, false, true, false },
+        { false, true, false, false, false, true, false },
+        { true, false, false, false, true, true, false },
+        { false, true, false, false, true, true, false }
+    };
+
+    // Run one action for a few ticks, recording everything touched on the way (false if the state is not worth keeping)
+    bool Simulate(Player& player, const PlayerInput& action, Camera& camera, int depth) {
+        for (int tick = 0; tick < ACTION_TICKS; tick++) {
+            player.HandleInput(action);
+            player.Update(level->platforms, camera, Constants::FIXED_DT);
+
+            int cell = Telemetry::CellIndex(player.state.pos);
+            if (cell >= 0 && RecordMin(cellDepths[cell], depth)) {
+                lastNewCellDepth.store(depth, memory_order_relaxed);
+            }
+
+            // Coins are collected with the attack, so count them as reached if within attack range
+            SDL_Rect reach = { player.state.body.x - player.attackHitbox.w, player.state.body.y - player.attackHitbox.h,
+                player.state.body.w + player.attackHitbox.w * 2, player.state.body.h + player.attackHitbox.h * 2 };
+            for (size_t i = 0; i < level->coins.size(); i++) {
+                if (AABB(reach, level->coins[i].body)) { RecordMin(coinDepths[i], depth); }
+            }
+        }
+
+        // Record platform being stood on
+        if (player.state.isGrounded) {
+            SDL_Rect feet = { player.state.body.x, player.state.body.y + player.state.body.h, player.state.body.w, 1 };
+            for (size_t i = 0; i < level->platforms.size(); i++) {
+                if (AABB(feet, level->platforms[i])) { RecordMin(platformDepths[i], depth); }
+            }
+        }
+
+        // Anything that has dropped below the bottom of the level is falling forever
+        return player.state.pos.y < Constants::FLOOR_LEVEL;
+    }
+
+    // Quantise position, velocity, abilities and timers into one key (horizontal velocity is left out as input
+    // overwrites it every tick unless dashing, which the dash timer already covers). Fields are clamped before the
+    // cast, as a negative float converted to an unsigned integer is undefined
+    static uint64_t StateKey(const Player& player) {
+        uint64_t x = (uint64_t)clamp(player.state.pos.x / 16.0f, 0.0f, 4095.0f);
+        uint64_t y = (uint64_t)clamp((player.state.pos.y + Constants::LEVEL_HEIGHT) / 16.0f, 0.0f, 4095.0f);
+        uint64_t velY = (uint64_t)clamp(player.state.vel.y / 150.0f + 32.0f, 0.0f, 63.0f);
+        uint64_t dashTimer = (uint64_t)(max(player.state.dashTimer, 0.0f) / 0.1f) & 0x7;
+        uint64_t dashCooldown = (uint64_t)(max(player.state.dashCooldown, 0.0f) / 0.25f) & 0xf;
+        uint64_t flags =
+            (uint64_t)player.state.canDash |
+            (uint64_t)player.state.isDashing << 1 |
+            (uint64_t)player.state.isGrounded << 2 |
+            (uint64_t)player.state.isJumping << 3 |
+            (uint64_t)player.state.facingLeft << 4 |
+            (uint64_t)(player.state.coyoteTimer > 0.0f) << 5;
+
+        return x | y << 12 | velY << 24 | dashTimer << 30 | dashCooldown << 33 | flags << 37;
+    }
+
+    // Returns true if this is the first time the state has been seen
+    bool Insert(uint64_t key) {
+        Shard& shard = shards[key % SHARDS];
+        lock_guard<mutex> lock(shard.lock);
+        return shard.visited.insert(key).second;
+    }
+
+    // Returns true if depth was lower than the stored value
+    static bool RecordMin(atomic<int>& value, int depth) {
+        int current = value.load(memory_order_relaxed);
+        while (depth < current) {
+            if (value.compare_exchange_weak(current, depth, memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool AllTargetsReached() {
+        for (size_t i = 0; i < level->coins.size(); i++) {
+            if (coinDepths[i].load() == UNREACHED) { return false; }
+        }
+        for (size_t i = 0; i < level->platforms.size(); i++) {
+            if (platformDepths[i].load() == UNREACHED) { return false; }
+        }
+        return true;
+    }
+
+    struct Shard {
+        mutex lock;
+        unordered_set<uint64_t> visited;
+    };
+
+    shared_ptr<const Level> level;
+    int maxDepth;
+    Shard shards[SHARDS];
+    unique_ptr<atomic<int>[]> coinDepths;
+    unique_ptr<atomic<int>[]> platformDepths;
+    unique_ptr<atomic<int>[]> cellDepths;
+    atomic<int> lastNewCellDepth;
+    size_t statesExplored;
+};
+
+// Analyse which coins, platforms and regions can be reached from spawn (run with "--reach [maxSeconds]")
+int runReachability(float maxSeconds) {
+    ReachabilityAnalyzer analyzer(loadLevel("Files"), maxSeconds);
+
+    auto start = chrono::steady_clock::now();
+    analyzer.Run(max(1, (int)thread::hardware_concurrency()));
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    analyzer.Report(cout);
+    cout << "search took " << elapsed.count() << "s" << endl;
+    return 0;
+}
+
+
+// Breakable platforms are drawn in a different colour so the player knows to attack them
+SDL_Color platformColour(bool breakable) {
+    if (breakable) {
+        return SDL_Color{ 120, 90, 70, 255 };
+    }
+    else {
+        return SDL_Color{ 42, 98, 143, 255 };
+    }
+}
+
+void setPlatformColour(SDL_Renderer* renderer, bool breakable) {
+    SDL_Color colour = platformColour(breakable);
+    SDL_SetRenderDrawColor(renderer, colour.r, colour.g, colour.b, colour.a);
+}
+
+// Add a static platform to a sprite batch
+void addPlatform(SpriteBatch& batch, const SDL_Rect& drawPlatform, bool breakable) {
+    batch.Add(breakable ? SpriteId::PLATFORM_BREAKABLE : SpriteId::PLATFORM, drawPlatform, platformColour(breakable));
+}
+
+// Static platforms pre-drawn into chunk textures, so the level costs one blit per visible chunk instead of one
+// draw per platform, and a changed platform only redraws the chunks it overlaps. Chunks find their platforms
+// through the world's platform tree, so editing the level only needs the changed area invalidating. Endless levels
+// use a ring of columns instead, each column is redrawn for whichever part of the level it is showing. Split screen
+// views can be far apart in an endless level, so each view has its own ring rather than fighting over columns
+class StaticLevelCache {
+public:
+    static constexpr int CHUNK_SIZE = 512;
+    static constexpr int ENDLESS_COLUMNS = 32;
+    static constexpr int TOP = Constants::FLOOR_LEVEL - Constants::LEVEL_HEIGHT;
+    // Below this zoom the whole level is drawn from one overview texture at 1 / LOD_SCALE size instead of chunks,
+    // so zooming out further never draws more
+    static constexpr float LOD_ZOOM = Constants::LOD_ZOOM;
+    static constexpr int LOD_SCALE = 4;
+
+    StaticLevelCache() :
+        chunksX(0),
+        chunksY(0),
+        rings(1),
+        wrap(false),
+        enabled(false),
+        overview(nullptr),
+        overviewDirty(true)
+    {
+    };
+
+    // Size the chunk grid to the level (textures are created lazily when first seen)
+    void Build(SDL_Renderer* renderer, const vector<SDL_Rect>& platforms, bool endless = false, int views = 1) {
+        Release();
+        enabled = SDL_RenderTargetSupported(renderer);
+
+        int bottom = TOP;
+        for (auto& platform : platforms) {
+            bottom = max(bottom, platform.y + platform.h);
+        }
+        chunksX = endless ? ENDLESS_COLUMNS : (Constants::LEVEL_WIDTH + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        chunksY = (bottom - TOP + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        wrap = endless;
+        rings = endless ? views : 1;
+        chunks.assign(rings * chunksX * chunksY, Chunk{ nullptr, -1, true });
+    }
+
+    // Mark the chunks overlapping a changed platform to be redrawn next time they are visible
+    void Invalidate(const SDL_Rect& rect) {
+        for (int ring = 0; ring < rings; ring++) {
+            ForEachChunk(ring, rect, [](Chunk& chunk, int, int) { chunk.dirty = true; });
+        }
+        overviewDirty = true;
+    }
+
+    // Render targets lose their contents when the renderer resets them
+    void InvalidateAll() {
+        for (auto& chunk : chunks) {
+            chunk.dirty = true;
+        }
+        overviewDirty = true;
+    }
+
+    void Release() {
+        for (auto& chunk : chunks) {
+            if (chunk.texture) {
+                SDL_DestroyTexture(chunk.texture);
+                chunk.texture = nullptr;
+            }
+            chunk.dirty = true;
+        }
+        if (overview) {
+            SDL_DestroyTexture(overview);
+            overview = nullptr;
+        }
+        overviewDirty = true;
+    }
+
+    // Create or redraw any dirty chunks visible to a camera, once per frame before any view is drawn as changing
+    // render target resets the viewport (returns false if render targets are unsupported)
+    bool Prepare(SDL_Renderer* renderer, SpriteBatch& batch, World& world, const vector<Camera>& cameras) {
+        if (!enabled) { return false; }
+
+        for (size_t view = 0; view < cameras.size(); view++) {
+            const Camera& camera = cameras[view];
+            if (camera.zoom < LOD_ZOOM) {
+                if (!overview) {
+                    overview = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
+                        chunksX * CHUNK_SIZE / LOD_SCALE, chunksY * CHUNK_SIZE / LOD_SCALE);
+                    SDL_SetTextureBlendMode(overview, SDL_BLENDMODE_BLEND);
+                    overviewDirty = true;
+                }
+                if (overviewDirty) {
+                    RedrawOverview(renderer, batch, world);
+                }
+                continue;
+            }
+
+            SDL_Rect cameraRect = { (int)camera.x, (int)camera.y, camera.w, camera.h };
+            ForEachChunk((int)view, cameraRect, [&](Chunk& chunk, int column, int row) {
+                // A wrapped chunk showing another column has to be redrawn for this one
+                if (chunk.column != column) {
+                    chunk.column = column;
+                    chunk.dirty = true;
+                }
+                if (!chunk.dirty) { return; }
+
+                SDL_Rect chunkRect = { column * CHUNK_SIZE, TOP + row * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE };
+                if (!chunk.texture) {
+                    // Empty chunks dont need a texture until something is placed in them
+                    bool empty = true;
+                    world.QueryStaticPlatforms(chunkRect, [&](int) { empty = false; });
+                    if (empty) {
+                        chunk.dirty = false;
+                        return;
+                    }
+
+                    chunk.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, CHUNK_SIZE, CHUNK_SIZE);
+                    SDL_SetTextureBlendMode(chunk.texture, SDL_BLENDMODE_BLEND);
+                }
+                Redraw(renderer, batch, world, chunk, chunkRect);
+            });
+        }
+        return true;
+    }
+
+    // Draw the chunks visible to a view's camera, fixed levels share their chunks between every view
+    void Render(SDL_Renderer* renderer, Camera camera, int view) {
+        if (camera.zoom < LOD_ZOOM && overview) {
+            SDL_Rect drawOverview = { (int)-camera.x, (int)(TOP - camera.y), chunksX * CHUNK_SIZE, chunksY * CHUNK_SIZE };
+            SDL_RenderCopy(renderer, overview, nullptr, &drawOverview);
+            metrics.Increment(Counter::DRAW_CALLS);
+            return;
+        }
+
+        SDL_Rect cameraRect = { (int)camera.x, (int)camera.y, camera.w, camera.h };
+        ForEachChunk(view, cameraRect, [&](Chunk& chunk, int column, int row) {
+            if (!chunk.texture || chunk.column != column) { return; }
+
+            int chunkX = column * CHUNK_SIZE;
+            int chunkY = TOP + row * CHUNK_SIZE;
+
+            SDL_Rect drawChunk = { (int)(chunkX - camera.x), (int)(chunkY - camera.y), CHUNK_SIZE, CHUNK_SIZE };
+            SDL_RenderCopy(renderer, chunk.texture, nullptr, &drawChunk);
+            metrics.Increment(Counter::DRAW_CALLS);
+        });
+    }
+
+private:
+    struct Chunk {
+        SDL_Texture* texture;
+        int column;     // Level column the texture was drawn for
+        bool dirty;
+    };
+
+    // Call callback(chunk, column, row) for every chunk of a view's ring overlapping rect
+    // Wrapped columns can be negative, as the fixed level is left of the origin once an endless level has moved it
+    template<typename Callback>
+    void ForEachChunk(int view, const SDL_Rect& rect, Callback callback) {
+        Chunk* ring = &chunks[(view % rings) * chunksX * chunksY];
+        int firstX = max(0, rect.x / CHUNK_SIZE);
+        int lastX = min(chunksX - 1, (rect.x + rect.w - 1) / CHUNK_SIZE);
+        if (wrap) {
+            firstX = (int)floorf((float)rect.x / CHUNK_SIZE);
+            lastX = (int)floorf((float)(rect.x + rect.w - 1) / CHUNK_SIZE);
+        }
+        int firstY = max(0, (rect.y - TOP) / CHUNK_SIZE);
+        int lastY = min(chunksY - 1, (rect.y + rect.h - 1 - TOP) / CHUNK_SIZE);
+
+        for (int y = firstY; y <= lastY; y++) {
+            for (int x = firstX; x <= lastX; x++) {
+                callback(ring[y * chunksX + (x % chunksX + chunksX) % chunksX], x, y);
+            }
+        }
+    }
+
+    // Broken platforms have no leaf in the tree, so only solid platforms are drawn
+    void Redraw(SDL_Renderer* renderer, SpriteBatch& batch, World& world, Chunk& chunk, const SDL_Rect& chunkRect) {
+        SDL_SetRenderTarget(renderer, chunk.texture);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        SDL_RenderClear(renderer);
+
+        const vector<SDL_Rect>& platforms = world.getPlatforms();
+        world.QueryStaticPlatforms(chunkRect, [&](int index) {
+            const SDL_Rect& platform = platforms[index];
+            SDL_Rect drawPlatform = { platform.x - chunkRect.x, platform.y - chunkRect.y, platform.w, platform.h };
+            addPlatform(batch, drawPlatform, world.getPlatformBreakable(index));
+        });
+        batch.Flush(renderer);
+
+        SDL_SetRenderTarget(renderer, nullptr);
+        chunk.dirty = false;
+    }
+
+    // Redraw every platform into the overview, shrunk but never below one pixel so thin platforms dont vanish
+    void RedrawOverview(SDL_Renderer* renderer, SpriteBatch& batch, World& world) {
+        SDL_SetRenderTarget(renderer, overview);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        SDL_RenderClear(renderer);
+
+        const vector<SDL_Rect>& platforms = world.getPlatforms();
+        for (size_t i = 0; i < platforms.size(); i++) {
+            if (world.getPlatformBroken((int)i)) { continue; }
+
+            const SDL_Rect& platform = platforms[i];
+            SDL_Rect drawPlatform = {
+                platform.x / LOD_SCALE, (platform.y - TOP) / LOD_SCALE,
+                max(1, platform.w / LOD_SCALE), max(1, platform.h / LOD_SCALE)
+            };
+            addPlatform(batch, drawPlatform, world.getPlatformBreakable((int)i));
+        }
+        batch.Flush(renderer);
+
+        SDL_SetRenderTarget(renderer, nullptr);
+        overviewDirty = false;
+    }
+
+    // One ring of chunksX by chunksY chunks per view in endless levels, otherwise just the one
+    vector<Chunk> chunks;
+    int chunksX;
+    int chunksY;
+    int rings;
+    bool wrap;
+    bool enabled;
+
+    SDL_Texture* overview;
+    bool overviewDirty;
+};
+
+
+// Parallax background, each layer is one texture tiled horizontally so it costs the same few blits per view
+// however wide the level is
+class ParallaxBackground {
+public:
+    // Generated layers tile every this many pixels
+    static constexpr int TILE_WIDTH = 1024;
+
+    void Build(const vector<BackgroundLayer>& backgroundLayers) {
+        Release();
+        layers.clear();
+        for (auto& layer : backgroundLayers) {
+            layers.push_back({ layer, nullptr, 0, 0 });
+        }
+    }
+
+    void Release() {
+        for (auto& layer : layers) {
+            if (layer.texture) {
+                SDL_DestroyTexture(layer.texture);
+                layer.texture = nullptr;
+            }
+        }
+    }
+
+    // Draw every layer into the current viewport (unscaled, the background ignores zoom), originX is how far the
+    // world's origin has moved so layers keep scrolling smoothly when it moves
+    void Render(SDL_Renderer* renderer, Camera camera, int viewportW, int viewportH, double originX = 0.0) {
+        for (auto& layer : layers) {
+            if (!layer.texture && !CreateTexture(renderer, layer)) { continue; }
+
+            // Wrap the scroll offset into one tile, then enough tiles to cover the view plus the partial one
+            float scrollX = (float)fmod((originX + camera.x) * layer.data.factor, (double)layer.w);
+            if (scrollX < 0.0f) { scrollX += layer.w; }
+            int y = (int)(layer.data.y - camera.y * layer.data.factor);
+            int tiles = viewportW / layer.w + 2;
+
+            for (int i = 0; i < tiles; i++) {
+                SDL_Rect drawTile = { (int)(i * layer.w - scrollX), y, layer.w, layer.h };
+                SDL_RenderCopy(renderer, layer.texture, nullptr, &drawTile);
+                metrics.Increment(Counter::DRAW_CALLS);
+            }
+
+            // Generated layers are solid below their hills
+            if (layer.data.image.empty() && y + layer.h < viewportH) {
+                SDL_SetRenderDrawColor(renderer, layer.data.colour.r, layer.data.colour.g, layer.data.colour.b, 255);
+                SDL_Rect below = { 0, y + layer.h, viewportW, viewportH - (y + layer.h) };
+                renderFillRect(renderer, &below);
+            }
+        }
+    }
+
+private:
+    struct Layer {
+        BackgroundLayer data;
+        SDL_Texture* texture;
+        int w;
+        int h;
+    };
+
+    // Load the layer's image, or generate hills from whole sine waves over the tile so the edges wrap seamlessly
+    bool CreateTexture(SDL_Renderer* renderer, Layer& layer) {
+        SDL_Surface* surface = nullptr;
+        if (!layer.data.image.empty()) {
+            surface = SDL_LoadBMP(("Files/" + layer.data.image).c_str());
+            if (!surface) {
+                cerr << "Failed to load background '" << layer.data.image << "': " << SDL_GetError() << endl;
+                layer.data.image.clear();
             }
+        }
+        if (!surface) {
+            surface = SDL_CreateRGBSurfaceWithFormat(0, TILE_WIDTH, layer.data.height, 32, SDL_PIXELFORMAT_RGBA32);
+            if (!surface) { return false; }
+
+            mt19937 random(layer.data.seed);
+            uniform_real_distribution<float> randomPhase(0.0f, 6.2831853f);
+            float phases[3] = { randomPhase(random), randomPhase(random), randomPhase(random) };
+            const int frequencies[3] = { 2, 5, 11 };
+            const float weights[3] = { 0.6f, 0.3f, 0.1f };
+
+            SDL_Color colour = layer.data.colour;
+            for (int x = 0; x < TILE_WIDTH; x++) {
+                float wave = 0.0f;
+                for (int i = 0; i < 3; i++) {
+                    wave += weights[i] * sinf(6.2831853f * frequencies[i] * x / TILE_WIDTH + phases[i]);
+                }
+                int top = (int)(layer.data.amplitude * (1.0f - wave) / 2.0f);
 
-            // Jump
-            if (keystate[SDL_SCANCODE_SPACE] || SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_A)) {
-                if (isGrounded && !isJumping) {
-                    vel.y = jumpVelocity;
-                    isJumping = true;
+                for (int y = 0; y < layer.data.height; y++) {
+                    Uint8* pixel = (Uint8*)surface->pixels + y * surface->pitch + x * 4;
+                    pixel[0] = colour.r; pixel[1] = colour.g; pixel[2] = colour.b;
+                    pixel[3] = y >= top ? 255 : 0;
                 }
             }
-            else {
-                isJumping = false;
+        }
+
+        layer.texture = SDL_CreateTextureFromSurface(renderer, surface);
+        layer.w = surface->w;
+        layer.h = surface->h;
+        SDL_FreeSurface(surface);
+        if (!layer.texture) { return false; }
+
+        SDL_SetTextureBlendMode(layer.texture, SDL_BLENDMODE_BLEND);
+        return true;
+    }
+
+    vector<Layer> layers;
+};
+
+
+// Minimap HUD, the level is drawn once into a small texture and only the parts under a changed platform are
+// redrawn, each frame is then one blit plus a batched draw per kind of marker
+class Minimap {
+public:
+    static constexpr int SCALE = 16;
+    static constexpr int MARGIN = 10;
+
+    Minimap() :
+        texture(nullptr),
+        width(0),
+        height(0),
+        needsFullRedraw(true)
+    {
+    };
+
+    void Build(SDL_Renderer* renderer, World& world) {
+        Release();
+        if (!SDL_RenderTargetSupported(renderer)) { return; }
+
+        int bottom = StaticLevelCache::TOP;
+        for (auto& platform : world.getPlatforms()) {
+            bottom = max(bottom, platform.y + platform.h);
+        }
+        width = (Constants::LEVEL_WIDTH + SCALE - 1) / SCALE;
+        height = (bottom - StaticLevelCache::TOP + SCALE - 1) / SCALE;
+        needsFullRedraw = true;
+    }
+
+    // Redraw only the part of the minimap under a changed platform
+    void Invalidate(const SDL_Rect& rect) {
+        dirtyRects.push_back(rect);
+    }
+
+    void InvalidateAll() {
+        needsFullRedraw = true;
+    }
+
+    void Release() {
+        if (texture) {
+            SDL_DestroyTexture(texture);
+            texture = nullptr;
+        }
+        needsFullRedraw = true;
+    }
+
+    // Draw in the top right of the window
+    void Render(SDL_Renderer* renderer, World& world) {
+        if (width == 0) { return; }
+
+        if (!texture) {
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, width, height);
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+            needsFullRedraw = true;
+        }
+        if (needsFullRedraw) {
+            dirtyRects.clear();
+            Redraw(renderer, world, SDL_Rect{ 0, StaticLevelCache::TOP, width * SCALE, height * SCALE });
+            needsFullRedraw = false;
+        }
+        for (auto& rect : dirtyRects) {
+            Redraw(renderer, world, rect);
+        }
+        dirtyRects.clear();
+
+        SDL_Rect frame = { Constants::WIN_WIDTH - width - MARGIN, MARGIN, width, height };
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 120);
+        renderFillRect(renderer, &frame);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+        SDL_RenderCopy(renderer, texture, nullptr, &frame);
+        metrics.Increment(Counter::DRAW_CALLS);
+
+        // Markers are gathered then drawn in one call per colour
+        markers.clear();
+        for (auto& coin : world.getCoins()) {
+            if (!coin.collected) { markers.push_back(Marker(frame, coin.body, 2)); }
+        }
+        RenderMarkers(renderer, 251, 206, 43);
+
+        for (auto& enemy : world.getEnemies()) {
+            if (enemy->getOnScreen()) { markers.push_back(Marker(frame, enemy->getBody(), 2)); }
+        }
+        RenderMarkers(renderer, 255, 0, 0);
+
+        for (int i = 0; i < world.getPlayerCount(); i++) {
+            markers.push_back(Marker(frame, world.getPlayer(i).getBody(), 3));
+        }
+        RenderMarkers(renderer, 62, 146, 204);
+    }
+
+private:
+    // Small square centred on a body, in minimap coordinates
+    static SDL_Rect Marker(const SDL_Rect& frame, const SDL_Rect& body, int radius) {
+        int x = frame.x + (body.x + body.w / 2) / SCALE;
+        int y = frame.y + (body.y + body.h / 2 - StaticLevelCache::TOP) / SCALE;
+        return SDL_Rect{ x - radius, y - radius, radius * 2, radius * 2 };
+    }
+
+    void RenderMarkers(SDL_Renderer* renderer, Uint8 r, Uint8 g, Uint8 b) {
+        if (markers.empty()) { return; }
+        SDL_SetRenderDrawColor(renderer, r, g, b, 255);
+        SDL_RenderFillRects(renderer, markers.data(), (int)markers.size());
+        metrics.Increment(Counter::DRAW_CALLS);
+        markers.clear();
+    }
+
+    // Clear an area of the level on the minimap then redraw the platforms overlapping it
+    void Redraw(SDL_Renderer* renderer, World& world, const SDL_Rect& area) {
+        SDL_Rect mapArea = {
+            area.x / SCALE, (area.y - StaticLevelCache::TOP) / SCALE,
+            (area.w + SCALE - 1) / SCALE + 1, (area.h + SCALE - 1) / SCALE + 1
+        };
+
+        SDL_SetRenderTarget(renderer, texture);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        renderFillRect(renderer, &mapArea);
+
+        // Platforms are clipped to the area so neighbours arent drawn over the rest of the map
+        // Platforms come from the world's tree, so a small area only visits the platforms near it
+        SDL_RenderSetClipRect(renderer, &mapArea);
+        const vector<SDL_Rect>& platforms = world.getPlatforms();
+        SDL_Rect levelArea = { mapArea.x * SCALE, StaticLevelCache::TOP + mapArea.y * SCALE, mapArea.w * SCALE, mapArea.h * SCALE };
+        world.QueryStaticPlatforms(levelArea, [&](int i) {
+            const SDL_Rect& platform = platforms[i];
+            SDL_Rect drawPlatform = {
+                platform.x / SCALE, (platform.y - StaticLevelCache::TOP) / SCALE,
+                max(1, platform.w / SCALE), max(1, platform.h / SCALE)
+            };
+            if (!AABB(drawPlatform, mapArea)) { return; }
+
+            setPlatformColour(renderer, world.getPlatformBreakable(i));
+            renderFillRect(renderer, &drawPlatform);
+        });
+        SDL_RenderSetClipRect(renderer, nullptr);
+
+        SDL_SetRenderTarget(renderer, nullptr);
+    }
+
+    SDL_Texture* texture;
+    int width;
+    int height;
+    bool needsFullRedraw;
+    vector<SDL_Rect> dirtyRects;
+    vector<SDL_Rect> markers;
+};
+
+
+// Light in level coordinates, brightness falls off to nothing at radius
+struct PointLight {
+    Vector2 pos;
+    float radius;
+    float r, g, b;
+};
+
+// Low resolution light buffer built on the CPU each frame and multiplied over a view with one texture
+// Channels are stored as separate float rows so four cells are lit at once, platforms cast shadows
+class Lightmap {
+public:
+    // Screen pixels covered by one lightmap cell
+    static constexpr int CELL = 8;
+    static constexpr float AMBIENT = 0.45f;
+
+    Lightmap() :
+        texture(nullptr),
+        cols(0),
+        rows(0),
+        stride(0)
+    {
+    };
+
+    void Release() {
+        if (texture) {
+            SDL_DestroyTexture(texture);
+            texture = nullptr;
+        }
+    }
+
+    void Clear() { lights.clear(); }
+    void AddLight(const PointLight& light) { lights.push_back(light); }
+    int getLightCount() const { return (int)lights.size(); }
+
+    // Light every cell of a view from every light that reaches it
+    void Accumulate(World& world, Camera camera, int viewW, int viewH) {
+        cols = (viewW + CELL - 1) / CELL;
+        rows = (viewH + CELL - 1) / CELL;
+        stride = (cols + 3) & ~3;
+        red.assign(stride * rows, AMBIENT);
+        green.assign(stride * rows, AMBIENT);
+        blue.assign(stride * rows, AMBIENT);
+
+        float cellSize = CELL / camera.zoom;
+        for (const PointLight& light : lights) {
+            // Cells the light could reach, skipping lights that miss the view
+            int firstCol = max(0, (int)floorf((light.pos.x - light.radius - camera.x) / cellSize));
+            int lastCol = min(cols, (int)ceilf((light.pos.x + light.radius - camera.x) / cellSize));
+            int firstRow = max(0, (int)floorf((light.pos.y - light.radius - camera.y) / cellSize));
+            int lastRow = min(rows, (int)ceilf((light.pos.y + light.radius - camera.y) / cellSize));
+            if (firstCol >= lastCol || firstRow >= lastRow) { continue; }
+
+            // Round the columns out to whole groups of four, the stride leaves room past the last column
+            firstCol &= ~3;
+            lastCol = min(stride, (lastCol + 3) & ~3);
+
+            SDL_Rect reach = {
+                (int)(light.pos.x - light.radius), (int)(light.pos.y - light.radius),
+                (int)(light.radius * 2.0f) + 1, (int)(light.radius * 2.0f) + 1
+            };
+            occluders = world.GatherPlatforms(reach);
+
+            for (int row = firstRow; row < lastRow; row++) {
+                LightRow(light, occluders, row, firstCol, lastCol, camera.x, camera.y + (row + 0.5f) * cellSize, cellSize);
             }
         }
+    }
 
-        // Attack
-        if (attackPressed && !attackPressedLastFrame && !isAttacking && attackCooldown <= 0.0f) {
-            isAttacking = true;
-            attackTimer = 0.5f;
-            attackCooldown = 0.75f;
+    // Multiply the accumulated light over the current viewport
+    void Render(SDL_Renderer* renderer) {
+        if (cols == 0) { return; }
 
-            if (keystate[SDL_SCANCODE_W] || leftStickYAxis < 0.0f) {
-                // Set attack direction
-                attackDirection = AttackDirection::UP;
-                // Set attack initial position
-                attackHitbox.x = pos.x;
-                attackHitbox.y = pos.y - attackHitbox.h;
+        if (texture) {
+            int w, h;
+            SDL_QueryTexture(texture, nullptr, nullptr, &w, &h);
+            if (w != cols || h != rows) { Release(); }
+        }
+        if (!texture) {
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, cols, rows);
+            if (!texture) { return; }
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_MOD);
+            SDL_SetTextureScaleMode(texture, SDL_ScaleModeLinear);
+        }
+
+        ConvertPixels();
+        SDL_UpdateTexture(texture, nullptr, pixels.data(), stride * (int)sizeof(Uint32));
+
+        SDL_Rect drawLight = { 0, 0, cols * CELL, rows * CELL };
+        SDL_RenderCopy(renderer, texture, nullptr, &drawLight);
+        metrics.Increment(Counter::DRAW_CALLS);
+    }
+
+private:
+    // Add one light to the cells in columns [first, last) of a row, last - first is a multiple of four
+    void LightRow(const PointLight& light, const vector<SDL_Rect>& occluders, int row, int first, int last,
+        float originX, float cellY, float cellSize) {
+        float invRadius2 = 1.0f / (light.radius * light.radius);
+        float dy = cellY - light.pos.y;
+        float* red = &this->red[row * stride];
+        float* green = &this->green[row * stride];
+        float* blue = &this->blue[row * stride];
+
+#ifdef USE_SSE2
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        __m128 dy4 = _mm_set1_ps(dy);
+        __m128 invDy = _mm_set1_ps(1.0f / dy);
+
+        for (int col = first; col < last; col += 4) {
+            // Distance falloff for four cells
+            __m128 cellX = _mm_add_ps(_mm_set1_ps(originX + col * cellSize), _mm_mul_ps(lanes, _mm_set1_ps(cellSize)));
+            __m128 dx = _mm_sub_ps(cellX, _mm_set1_ps(light.pos.x));
+            __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy4, dy4));
+            __m128 falloff = _mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(d2, _mm_set1_ps(invRadius2))));
+            if (_mm_movemask_ps(_mm_cmpgt_ps(falloff, zero)) == 0) { continue; }
+            falloff = _mm_mul_ps(falloff, falloff);
+
+            // Slab test the segments from the light to each cell against every occluder
+            __m128 invDx = _mm_div_ps(one, dx);
+            __m128 blocked = zero;
+            for (const SDL_Rect& rect : occluders) {
+                __m128 tx1 = _mm_mul_ps(_mm_set1_ps(rect.x - light.pos.x), invDx);
+                __m128 tx2 = _mm_mul_ps(_mm_set1_ps(rect.x + rect.w - light.pos.x), invDx);
+                __m128 ty1 = _mm_mul_ps(_mm_set1_ps(rect.y - light.pos.y), invDy);
+                __m128 ty2 = _mm_mul_ps(_mm_set1_ps(rect.y + rect.h - light.pos.y), invDy);
+                __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), zero);
+                __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), one);
+                blocked = _mm_or_ps(blocked, _mm_cmplt_ps(enter, exit));
+            }
+            falloff = _mm_andnot_ps(blocked, falloff);
+
+            _mm_storeu_ps(&red[col], _mm_add_ps(_mm_loadu_ps(&red[col]), _mm_mul_ps(falloff, _mm_set1_ps(light.r))));
+            _mm_storeu_ps(&green[col], _mm_add_ps(_mm_loadu_ps(&green[col]), _mm_mul_ps(falloff, _mm_set1_ps(light.g))));
+            _mm_storeu_ps(&blue[col], _mm_add_ps(_mm_loadu_ps(&blue[col]), _mm_mul_ps(falloff, _mm_set1_ps(light.b))));
+        }
+#else
+        for (int col = first; col < last; col++) {
+            float dx = originX + (col + 0.5f) * cellSize - light.pos.x;
+            float falloff = 1.0f - (dx * dx + dy * dy) * invRadius2;
+            if (falloff <= 0.0f) { continue; }
+
+            Vector2 cell = { light.pos.x + dx, cellY };
+            bool blocked = false;
+            for (const SDL_Rect& rect : occluders) {
+                if (segmentIntersectsRect(light.pos, cell, rect)) {
+                    blocked = true;
+                    break;
+                }
             }
-            else if ((keystate[SDL_SCANCODE_S] || leftStickYAxis > 0.0f) && !isGrounded) {
-                attackDirection = AttackDirection::DOWN;
-                attackHitbox.x = pos.x;
-                attackHitbox.y = pos.y + body.h;
+            if (blocked) { continue; }
+
+            falloff *= falloff;
+            red[col] += falloff * light.r;
+            green[col] += falloff * light.g;
+            blue[col] += falloff * light.b;
+        }
+#endif
+    }
+
+    // Clamp light to one and pack into texture pixels
+    void ConvertPixels() {
+        pixels.resize(stride * rows);
+        for (int row = 0; row < rows; row++) {
+            const float* red = &this->red[row * stride];
+            const float* green = &this->green[row * stride];
+            const float* blue = &this->blue[row * stride];
+            Uint32* pixel = &pixels[row * stride];
+
+#ifdef USE_SSE2
+            const __m128 scale = _mm_set1_ps(255.0f);
+            const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+            for (int col = 0; col < stride; col += 4) {
+                __m128i r = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_loadu_ps(&red[col]), _mm_set1_ps(1.0f)), scale));
+                __m128i g = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_loadu_ps(&green[col]), _mm_set1_ps(1.0f)), scale));
+                __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_loadu_ps(&blue[col]), _mm_set1_ps(1.0f)), scale));
+                __m128i packed = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), alpha));
+                _mm_storeu_si128((__m128i*)&pixel[col], packed);
             }
-            else if (facingLeft) {
-                attackDirection = AttackDirection::LEFT;
-                attackHitbox.x = pos.x - attackHitbox.w;
-                attackHitbox.y = pos.y + attackHitbox.h / 2.0f;
+#else
+            for (int col = 0; col < stride; col++) {
+                Uint32 r = (Uint32)(min(red[col], 1.0f) * 255.0f + 0.5f);
+                Uint32 g = (Uint32)(min(green[col], 1.0f) * 255.0f + 0.5f);
+                Uint32 b = (Uint32)(min(blue[col], 1.0f) * 255.0f + 0.5f);
+                pixel[col] = r | g << 8 | b << 16 | 0xff000000;
             }
-            else {
-                attackDirection = AttackDirection::RIGHT;
-                attackHitbox.x = pos.x + attackHitbox.w;
-                attackHitbox.y = pos.y + attackHitbox.h / 2.0f;
+#endif
+        }
+    }
+
+    vector<PointLight> lights;
+    vector<SDL_Rect> occluders;
+    vector<float> red, green, blue;
+    vector<Uint32> pixels;
+    SDL_Texture* texture;
+    int cols;
+    int rows;
+    // Row length rounded up to a multiple of four cells
+    int stride;
+};
+
+
+// Benchmark lighting a full screen view with random lights near the start of the level (run with "--lights <lights>")
+int runLightmapBenchmark(int lightCount) {
+    World world(loadLevel("Files"));
+    Camera camera = world.getRenderCamera(1.0f);
+    mt19937 random(1);
+    uniform_real_distribution<float> randomX(camera.x, camera.x + camera.w);
+    uniform_real_distribution<float> randomY(camera.y, camera.y + camera.h);
+    uniform_real_distribution<float> randomRadius(80.0f, 320.0f);
+
+    Lightmap lightmap;
+    for (int i = 0; i < lightCount; i++) {
+        lightmap.AddLight({ { randomX(random), randomY(random) }, randomRadius(random), 0.5f, 0.4f, 0.3f });
+    }
+
+    const int repeats = 100;
+    auto start = chrono::steady_clock::now();
+    for (int repeat = 0; repeat < repeats; repeat++) {
+        lightmap.Accumulate(world, camera, Constants::WIN_WIDTH, Constants::WIN_HEIGHT);
+    }
+    chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+
+#ifdef USE_SSE2
+    const char* kernel = "sse2";
+#else
+    const char* kernel = "scalar";
+#endif
+    cout << lightCount << " lights in " << elapsed.count() / repeats << "us per view (" << kernel << ")" << endl;
+    return 0;
+}
+
+
+// Recorded runs played back as translucent players. The ghost file is a header followed by each track as a
+// sample count and its samples, it is memory-mapped read only so thousands of runs cost no load time or heap
+class GhostRuns {
+public:
+    static constexpr uint32_t MAGIC = 0x47485354;
+    // Version 1 files only held positions
+    static constexpr uint32_t VERSION = 2;
+
+    GhostRuns() :
+        memory(nullptr),
+        size(0)
+#ifdef _WIN32
+        , file(INVALID_HANDLE_VALUE),
+        mapping(nullptr)
+#endif
+    {
+    };
+
+    ~GhostRuns() {
+        Release();
+    }
+
+    GhostRuns(const GhostRuns&) = delete;
+    GhostRuns& operator=(const GhostRuns&) = delete;
+
+    // Map the ghost file and index its tracks (optional, no file means no ghosts)
+    void Load(const string& fileName) {
+        Release();
+
+#ifdef _WIN32
+        file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) { return; }
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            size = (size_t)fileSize.QuadPart;
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                memory = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
             }
         }
+#else
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) { return; }
+        off_t fileSize = lseek(fd, 0, SEEK_END);
+        if (fileSize > 0) {
+            size = (size_t)fileSize;
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            memory = mapped == MAP_FAILED ? nullptr : (const uint8_t*)mapped;
+        }
+        close(fd);
+#endif
+        if (!memory) {
+            cerr << "Ghost file '" << fileName << "' could not be mapped, ghosts will not be shown." << endl;
+            Release();
+            return;
+        }
 
-        // DEBUG inputs
-        /*if (keystate[SDL_SCANCODE_Q]) {
-            vel.y = jumpVelocity;
+        const uint32_t* header = (const uint32_t*)memory;
+        if (size < 2 * sizeof(uint32_t) || header[0] != MAGIC || header[1] != VERSION) {
+            cerr << "Ghost file '" << fileName << "' is not a valid ghost file, ghosts will not be shown." << endl;
+            Release();
+            return;
         }
-        if (keystate[SDL_SCANCODE_T]) {
-            cout << "player.x = " << body.x << ", player.y = " << body.y << endl;
-        }*/
 
-        // Check if button pressed last frame so player cant hold down button button to keep doing action
-        dashPressedLastFrame = dashPressed;
-        attackPressedLastFrame = attackPressed;
+        // Walk the tracks once, a truncated last track (from a crash whilst saving) is ignored
+        size_t offset = 2 * sizeof(uint32_t);
+        while (offset + sizeof(uint32_t) <= size) {
+            uint32_t count;
+            memcpy(&count, memory + offset, sizeof(count));
+            offset += sizeof(uint32_t);
+            if (count == 0 || offset + (size_t)count * sizeof(GhostSample) > size) { break; }
+
+            tracks.push_back({ (const GhostSample*)(memory + offset), count });
+            offset += (size_t)count * sizeof(GhostSample);
+        }
+        cout << "Loaded " << tracks.size() << " ghost runs" << endl;
     }
 
-    void Update(vector<SDL_Rect> platforms, Camera& camera, float deltaTime) {
-        // Track previous positions for smoother rendering with fixed timestep physics
-        previousPos = pos;
-        previousAttackPos.x = attackHitbox.x; previousAttackPos.y = attackHitbox.y;
+    void Release() {
+#ifdef _WIN32
+        if (memory) { UnmapViewOfFile(memory); }
+        if (mapping) { CloseHandle(mapping); }
+        if (file != INVALID_HANDLE_VALUE) { CloseHandle(file); }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (memory) { munmap((void*)memory, size); }
+#endif
+        memory = nullptr;
+        size = 0;
+        tracks.clear();
+    }
 
-        if (knockbackTimer <= 0.0f) {
-            if (isDashing) {
-                // Apply dash velocity (multiply by dashTimer so dash starts fast then slows down)
-                if (facingLeft) {
-                    vel.x = -speed * 15.0f * dashTimer;
-                }
-                else {
-                    vel.x = speed * 15.0f * dashTimer;
-                }
+    // Append one recorded run to the ghost file, writing the header if the file is new
+    static void Save(const string& fileName, const vector<GhostSample>& samples) {
+        if (samples.empty()) { return; }
+
+        ofstream file(fileName, ios::binary | ios::app);
+        if (!file.is_open()) {
+            cerr << "Failed to open file '" << fileName << "'." << endl;
+            return;
+        }
+        if (file.tellp() == 0) {
+            uint32_t header[] = { MAGIC, VERSION };
+            file.write((const char*)header, sizeof(header));
+        }
+
+        uint32_t count = (uint32_t)samples.size();
+        file.write((const char*)&count, sizeof(count));
+        file.write((const char*)samples.data(), samples.size() * sizeof(GhostSample));
+    }
 
-                dashTimer -= deltaTime;
-                if (dashTimer <= 0.0f) {
-                    isDashing = false;
+    // Add every ghost 'tick' ticks into its run to the sprite batch, interpolated like Player::Render
+    void Render(SpriteBatch& batch, Camera camera, int tick, float alpha, int w, int h) {
+        if (tracks.empty() || tick <= 0) { return; }
+
+        for (auto& track : tracks) {
+            // Finished ghosts wait at the end of their run
+            int last = (int)track.count - 1;
+            const GhostSample& current = track.samples[min(tick - 1, last)];
+            const GhostSample& previous = track.samples[min(max(tick - 2, 0), last)];
+
+            float x = previous.x * (1.0f - alpha) + current.x * alpha - camera.x;
+            float y = previous.y * (1.0f - alpha) + current.y * alpha - camera.y;
+            if (x + w * 2 < 0.0f || y + h * 2 < 0.0f || x - w > camera.w || y - h > camera.h) { continue; }
+
+            // Attacks are placed like Player::Update places the hitbox, which is as wide as the player
+            if (current.flags & GhostSample::ATTACKING) {
+                SDL_Rect attack = { (int)roundf(x), (int)y, w, w };
+                switch ((AttackDirection)(current.flags >> GhostSample::ATTACK_SHIFT)) {
+                case AttackDirection::UP: attack.y -= w; break;
+                case AttackDirection::DOWN: attack.y += h; break;
+                case AttackDirection::LEFT: attack.x -= w; attack.y += w / 2; break;
+                case AttackDirection::RIGHT: attack.x += w; attack.y += w / 2; break;
                 }
+                batch.Add(SpriteId::ATTACK, attack, SDL_Color{ 204, 62, 146, 60 });
             }
 
-            if (isAttacking) {
-                attackTimer -= deltaTime;
-                if (attackTimer <= 0.0f) {
-                    isAttacking = false;
+            SDL_Color colour = (current.flags & GhostSample::DAMAGED) ? SDL_Color{ 255, 0, 0, 60 } : SDL_Color{ 62, 146, 204, 60 };
+            batch.Add(SpriteId::PLAYER, SDL_Rect{ (int)roundf(x), (int)y, w, h }, colour, current.frame, (current.flags & GhostSample::FACING_LEFT) != 0);
+        }
+    }
+
+    int getTrackCount() { return (int)tracks.size(); }
+
+private:
+    struct Track {
+        const GhostSample* samples;
+        uint32_t count;
+    };
+
+    const uint8_t* memory;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+    vector<Track> tracks;
+};
+
+
+// What the level editor places when clicking on empty space
+enum class EditorTool { PLATFORM, BREAKABLE_PLATFORM, COIN, MELEE_ENEMY, FLYING_ENEMY, COUNT };
+
+const char* const EDITOR_TOOL_NAMES[] = { "platform", "breakable platform", "coin", "melee enemy", "flying enemy" };
+
+enum class EditObject { NONE, PLATFORM, COIN, ENEMY };
+enum class EditAction { ADD, REMOVE, MOVE };
+
+// One change to the level, with enough stored to apply it either way
+struct EditCommand {
+    EditAction action;
+    EditObject object;
+    int index;
+    SDL_Rect from;      // Where a removed or moved object was
+    SDL_Rect to;        // Where an added or moved object is
+    bool breakable;
+    string enemyType;
+    int health;
+    shared_ptr<const BehaviourScript> behaviour;
+    vector<int> spawners;   // Spawner triggers a removed enemy was woken by
+};
+
+// Level editor for the first player's view (toggle with F1), the world is paused while editing
+// Left click places the current tool or drags what is under the mouse, right click or delete removes, 1-5 pick the
+// tool, arrows pan, ctrl+z and ctrl+y undo and redo through the command log, ctrl+s saves to the level files
+class LevelEditor {
+public:
+    // Placed and moved objects snap to this grid
+    static constexpr int GRID = 25;
+    static constexpr float PAN_SPEED = 1200.0f;
+
+    LevelEditor() :
+        active(false),
+        tool(EditorTool::PLATFORM),
+        selected(EditObject::NONE),
+        selectedIndex(-1),
+        dragging(false),
+        dragFrom{ 0, 0, 0, 0 },
+        grabOffset{ 0, 0 }
+    {
+    };
+
+    void Toggle(World& world) {
+        active = !active;
+        selected = EditObject::NONE;
+        dragging = false;
+        if (active) {
+            // Enemies are edited where they spawn, so put them all back there
+            world.ResetEnemies();
+            cout << "Editing level, placing " << EDITOR_TOOL_NAMES[(int)tool] << endl;
+        }
+    }
+
+    // Returns true if the event was used by the editor
+    bool HandleEvent(const SDL_Event& event, World& world) {
+        if (!active) { return false; }
+
+        if (event.type == SDL_KEYDOWN) {
+            SDL_Keycode key = event.key.keysym.sym;
+            bool ctrl = (event.key.keysym.mod & KMOD_CTRL) != 0;
+            bool shift = (event.key.keysym.mod & KMOD_SHIFT) != 0;
+
+            if (key >= SDLK_1 && key < SDLK_1 + (int)EditorTool::COUNT) {
+                tool = (EditorTool)(key - SDLK_1);
+                cout << "Placing " << EDITOR_TOOL_NAMES[(int)tool] << endl;
+            }
+            else if ((key == SDLK_DELETE || key == SDLK_BACKSPACE) && selected != EditObject::NONE && !dragging) {
+                Remove(world, selected, selectedIndex);
+            }
+            else if (ctrl && ((key == SDLK_z && shift) || key == SDLK_y)) {
+                Redo(world);
+            }
+            else if (ctrl && key == SDLK_z) {
+                Undo(world);
+            }
+            else if (ctrl && key == SDLK_s) {
+                if (saveLevel(world.getLevel(), "Files")) {
+                    cout << "Level saved" << endl;
                 }
             }
+            else {
+                return false;
+            }
+            return true;
+        }
 
-            // Apply gravity
-            vel.y += Constants::GRAVITY * deltaTime;
+        if (event.type == SDL_MOUSEBUTTONDOWN && !dragging) {
+            SDL_Point point = ToLevel(world, event.button.x, event.button.y);
+            EditObject object = EditObject::NONE;
+            int index = Pick(world, point, object);
 
-            // Shorten jump if player stopped pressed jump early by increasing gravity
-            if (!isJumping && vel.y < 0.0f) {
-                vel.y += Constants::GRAVITY * deltaTime * 3.0f;
+            if (event.button.button == SDL_BUTTON_RIGHT) {
+                if (object != EditObject::NONE) { Remove(world, object, index); }
+                return true;
             }
+            if (event.button.button != SDL_BUTTON_LEFT) { return false; }
 
-            if (vel.y > Constants::TERMINAL_VELOCITY) {
-                vel.y = Constants::TERMINAL_VELOCITY;
+            // Place something new if nothing was clicked, then drag whatever is selected
+            if (object == EditObject::NONE) {
+                index = Place(world, point, object);
             }
+            selected = object;
+            selectedIndex = index;
+            dragging = true;
+            dragFrom = Bounds(world, object, index);
+            grabOffset = { point.x - dragFrom.x, point.y - dragFrom.y };
+            return true;
         }
-        else {
-            knockbackTimer -= deltaTime;
+
+        if (event.type == SDL_MOUSEMOTION && dragging) {
+            SDL_Point point = ToLevel(world, event.motion.x, event.motion.y);
+            SDL_Rect current = Bounds(world, selected, selectedIndex);
+            SDL_Rect rect = current;
+            Snap(rect, point.x - grabOffset.x, point.y - grabOffset.y);
+            if (rect.x != current.x || rect.y != current.y) {
+                Move(world, selected, selectedIndex, rect);
+            }
+            return true;
         }
 
-        // Apply horizontal velocity
-        pos.x += vel.x * deltaTime;
+        if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT && dragging) {
+            // A whole drag is one command, the object has already been moved so it is only logged
+            dragging = false;
+            SDL_Rect rect = Bounds(world, selected, selectedIndex);
+            if (rect.x != dragFrom.x || rect.y != dragFrom.y) {
+                Log(EditCommand{ EditAction::MOVE, selected, selectedIndex, dragFrom, rect, false, "", 0, nullptr, {} });
+            }
+            return true;
+        }
 
-        // Stop player from going off screen
-        if (pos.x < 0.0f) {
-            pos.x = 0.0f;
-            vel.x = 0.0f;
+        return false;
+    }
+
+    // Pan the first player's camera
+    void Update(const Uint8* keystate, float deltaTime, World& world) {
+        if (!active) { return; }
+
+        float dx = (float)(keystate[SDL_SCANCODE_RIGHT] - keystate[SDL_SCANCODE_LEFT]);
+        float dy = (float)(keystate[SDL_SCANCODE_DOWN] - keystate[SDL_SCANCODE_UP]);
+        if (dx != 0.0f || dy != 0.0f) {
+            float speed = PAN_SPEED * deltaTime / world.getZoom(0);
+            world.PanCamera(0, dx * speed, dy * speed);
         }
-        else if (pos.x + body.w > Constants::LEVEL_WIDTH) {
-            pos.x = Constants::LEVEL_WIDTH - body.w;
-            vel.x = 0.0f;
+    }
+
+    // Outline coins and enemy spawns in view (enemies waiting for a spawner arent drawn otherwise) and the selection
+    void Render(SDL_Renderer* renderer, World& world, Camera camera) {
+        if (!active) { return; }
+
+        SDL_Rect view = { (int)camera.x, (int)camera.y, camera.w, camera.h };
+        outlines.clear();
+        for (auto& coin : world.getCoins()) {
+            if (AABB(coin.body, view)) { outlines.push_back(ToView(coin.body, camera)); }
         }
+        RenderOutlines(renderer, 251, 206, 43);
 
-        body.x = (int)pos.x;
+        for (auto& spawn : world.getLevel().enemySpawns) {
+            SDL_Rect body = { spawn.x, spawn.y, spawn.w, spawn.h };
+            if (AABB(body, view)) { outlines.push_back(ToView(body, camera)); }
+        }
+        RenderOutlines(renderer, 14, 201, 128);
 
-        for (auto& platform : platforms) {
-            // If player is colliding with platform
-            if (AABB(body, platform)) {
-                // If moving left, allign players right edge with platforms left edge
-                if (vel.x > 0.0f) {
-                    body.x = platform.x - body.w;
-                }
-                // If moving right, allign players left edge with platforms right edge
-                else if (vel.x < 0.0f) {
-                    body.x = platform.x + platform.w;
-                }
+        if (selected != EditObject::NONE) {
+            outlines.push_back(ToView(Bounds(world, selected, selectedIndex), camera));
+            RenderOutlines(renderer, 255, 255, 255);
+        }
+    }
 
-                // Sync pos with body after collision
-                pos.x = body.x;
+    bool getActive() { return active; }
 
-                // Reset horizontal velocity
-                vel.x = 0.0f;;
+private:
+    // Mouse position in the first player's view to level coordinates
+    SDL_Point ToLevel(World& world, int x, int y) {
+        SDL_Rect viewport = splitScreenViewport(0, world.getPlayerCount());
+        Camera camera = world.getRenderCamera(1.0f);
+        return SDL_Point{
+            (int)floorf(camera.x + (x - viewport.x) / camera.zoom),
+            (int)floorf(camera.y + (y - viewport.y) / camera.zoom)
+        };
+    }
+
+    static SDL_Rect ToView(const SDL_Rect& rect, Camera camera) {
+        return SDL_Rect{ (int)(rect.x - camera.x), (int)(rect.y - camera.y), rect.w, rect.h };
+    }
+
+    // Move a rect to the grid, keeping it inside the level
+    static void Snap(SDL_Rect& rect, int x, int y) {
+        const int top = Constants::FLOOR_LEVEL - Constants::LEVEL_HEIGHT;
+        x = (int)floorf((float)x / GRID + 0.5f) * GRID;
+        y = (int)floorf((float)y / GRID + 0.5f) * GRID;
+        rect.x = max(0, min(Constants::LEVEL_WIDTH - rect.w, x));
+        rect.y = max(top, min(Constants::FLOOR_LEVEL - rect.h, y));
+    }
+
+    // Enemies then coins then platforms, so small things sitting on platforms can be grabbed
+    int Pick(World& world, SDL_Point point, EditObject& object) {
+        int index = world.PickEnemy(point);
+        object = EditObject::ENEMY;
+        if (index == -1) {
+            index = world.PickCoin(point);
+            object = EditObject::COIN;
+        }
+        if (index == -1) {
+            index = world.PickPlatform(point);
+            object = EditObject::PLATFORM;
+        }
+        if (index == -1) {
+            object = EditObject::NONE;
+        }
+        return index;
+    }
+
+    SDL_Rect Bounds(World& world, EditObject object, int index) {
+        const Level& level = world.getLevel();
+        switch (object) {
+        case EditObject::PLATFORM:
+            return level.platforms[index];
+        case EditObject::COIN:
+            return level.coins[index].body;
+        case EditObject::ENEMY:
+            return SDL_Rect{ level.enemySpawns[index].x, level.enemySpawns[index].y, level.enemySpawns[index].w, level.enemySpawns[index].h };
+        default:
+            return SDL_Rect{ 0, 0, 0, 0 };
+        }
+    }
+
+    // Add the current tool's object centred on a point, returning its index
+    int Place(World& world, SDL_Point point, EditObject& object) {
+        const Level& level = world.getLevel();
+        EditCommand command = { EditAction::ADD, EditObject::PLATFORM, 0, {}, {}, false, "", 0, nullptr, {} };
+        switch (tool) {
+        case EditorTool::PLATFORM:
+        case EditorTool::BREAKABLE_PLATFORM:
+            command.index = (int)level.platforms.size();
+            command.to = { 0, 0, 125, 50 };
+            command.breakable = tool == EditorTool::BREAKABLE_PLATFORM;
+            break;
+        case EditorTool::COIN:
+            command.object = EditObject::COIN;
+            command.index = (int)level.coins.size();
+            command.to = { 0, 0, 50, 50 };
+            break;
+        case EditorTool::MELEE_ENEMY:
+        case EditorTool::FLYING_ENEMY:
+            command.object = EditObject::ENEMY;
+            command.index = (int)level.enemySpawns.size();
+            command.enemyType = tool == EditorTool::FLYING_ENEMY ? "Flying" : "Melee";
+            command.to = tool == EditorTool::FLYING_ENEMY ? SDL_Rect{ 0, 0, 65, 65 } : SDL_Rect{ 0, 0, 55, 100 };
+            command.health = tool == EditorTool::FLYING_ENEMY ? 8 : 10;
+            break;
+        default:
+            break;
+        }
+        Snap(command.to, point.x - command.to.w / 2, point.y - command.to.h / 2);
+
+        Apply(world, command, false);
+        Log(command);
+        object = command.object;
+        return command.index;
+    }
+
+    void Remove(World& world, EditObject object, int index) {
+        const Level& level = world.getLevel();
+        EditCommand command = { EditAction::REMOVE, object, index, Bounds(world, object, index), {}, false, "", 0, nullptr, {} };
+        if (object == EditObject::PLATFORM) {
+            command.breakable = level.platformBreakable[index];
+        }
+        else if (object == EditObject::ENEMY) {
+            command.enemyType = level.enemySpawns[index].type;
+            command.health = level.enemySpawns[index].health;
+            command.behaviour = level.enemySpawns[index].behaviour;
+            for (size_t i = 0; i < level.triggers.size(); i++) {
+                const vector<int>& enemies = level.triggers[i].enemies;
+                if (find(enemies.begin(), enemies.end(), index) != enemies.end()) { command.spawners.push_back((int)i); }
             }
         }
 
-        // Apply vertical velocity
-        pos.y += vel.y * deltaTime;
-        body.y = (int)pos.y;
-        isGrounded = false;
-        bool groundedThisFrame = false;
+        Apply(world, command, false);
+        Log(command);
+        selected = EditObject::NONE;
+    }
 
-        for (auto& platform : platforms) {
-            // If player is colliding with platform
-            if (AABB(body, platform)) {
-                // If moving down, allign players bottom edge with platforms top edge
-                if (vel.y > 0.0f) {
-                    body.y = platform.y - body.h;
-                    groundedThisFrame = true;
-                }
-                // If moving up, allign players top edge with platforms bottom edge
-                else if (vel.y < 0.0f) {
-                    body.y = platform.y + platform.h;
-                }
+    void Move(World& world, EditObject object, int index, const SDL_Rect& rect) {
+        switch (object) {
+        case EditObject::PLATFORM:
+            world.MovePlatform(index, rect);
+            break;
+        case EditObject::COIN:
+            world.MoveCoin(index, rect);
+            break;
+        case EditObject::ENEMY:
+            world.MoveEnemy(index, rect.x, rect.y);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void Insert(World& world, const EditCommand& command, const SDL_Rect& rect) {
+        switch (command.object) {
+        case EditObject::PLATFORM:
+            world.InsertPlatform(command.index, rect, command.breakable);
+            break;
+        case EditObject::COIN:
+            world.InsertCoin(command.index, rect);
+            break;
+        case EditObject::ENEMY:
+            world.InsertEnemy(command.index, EnemySpawn{ command.enemyType, rect.x, rect.y, rect.w, rect.h, command.health, command.behaviour }, command.spawners);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void Erase(World& world, const EditCommand& command) {
+        switch (command.object) {
+        case EditObject::PLATFORM:
+            world.RemovePlatform(command.index);
+            break;
+        case EditObject::COIN:
+            world.RemoveCoin(command.index);
+            break;
+        case EditObject::ENEMY:
+            world.RemoveEnemy(command.index);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Do a command, or undo it
+    void Apply(World& world, const EditCommand& command, bool undo) {
+        switch (command.action) {
+        case EditAction::ADD:
+            if (undo) { Erase(world, command); }
+            else { Insert(world, command, command.to); }
+            break;
+        case EditAction::REMOVE:
+            if (undo) { Insert(world, command, command.from); }
+            else { Erase(world, command); }
+            break;
+        case EditAction::MOVE:
+            Move(world, command.object, command.index, undo ? command.from : command.to);
+            break;
+        }
+    }
+
+    // A new command starts a new history, so anything undone can no longer be redone
+    void Log(const EditCommand& command) {
+        undoLog.push_back(command);
+        redoLog.clear();
+    }
+
+    void Undo(World& world) {
+        if (undoLog.empty()) { return; }
+
+        Apply(world, undoLog.back(), true);
+        redoLog.push_back(undoLog.back());
+        undoLog.pop_back();
+        selected = EditObject::NONE;
+    }
+
+    void Redo(World& world) {
+        if (redoLog.empty()) { return; }
+
+        Apply(world, redoLog.back(), false);
+        undoLog.push_back(redoLog.back());
+        redoLog.pop_back();
+        selected = EditObject::NONE;
+    }
+
+    void RenderOutlines(SDL_Renderer* renderer, Uint8 r, Uint8 g, Uint8 b) {
+        if (outlines.empty()) { return; }
+        SDL_SetRenderDrawColor(renderer, r, g, b, 255);
+        SDL_RenderDrawRects(renderer, outlines.data(), (int)outlines.size());
+        metrics.Increment(Counter::DRAW_CALLS);
+        outlines.clear();
+    }
+
+    bool active;
+    EditorTool tool;
+    EditObject selected;
+    int selectedIndex;
+    bool dragging;
+    SDL_Rect dragFrom;
+    SDL_Point grabOffset;
+
+    vector<EditCommand> undoLog;
+    vector<EditCommand> redoLog;
+    vector<SDL_Rect> outlines;
+};
+
+
+// Phases of a frame timed by a trace capture
+enum class TracePhase { INPUT, UPDATE, RENDER, COUNT };
+
+const char* const TRACE_PHASE_NAMES[] = { "HandleInput", "Update", "Render" };
+
+// Times each phase of the next few frames then saves them as a Chrome trace (open in chrome://tracing or Perfetto)
+// Frames are only kept while a capture is running, so it costs nothing the rest of the time
+class FrameTrace {
+public:
+    FrameTrace() :
+        remaining(0)
+    {
+    };
+
+    void Start(const string& file, int frames) {
+        fileName = file;
+        remaining = frames;
+        marks.clear();
+        drawCalls.clear();
+        marks.reserve((size_t)frames * ((int)TracePhase::COUNT + 1));
+        drawCalls.reserve(frames);
+    }
 
-                // Sync pos with body after collision
-                pos.y = body.y;
+    // Record one frame from performance counter readings at its start and the end of each phase, returns true once
+    // the last frame of the capture has been recorded and saved
+    bool AddFrame(const Uint64 (&frameMarks)[(int)TracePhase::COUNT + 1], uint64_t frameDrawCalls) {
+        if (remaining <= 0) { return false; }
 
-                // Reset vertical velocity
-                vel.y = 0.0f;
+        marks.insert(marks.end(), begin(frameMarks), end(frameMarks));
+        drawCalls.push_back(frameDrawCalls);
+        remaining--;
+        if (remaining > 0) { return false; }
+
+        Save();
+        return true;
+    }
+
+    // Getters
+    bool getActive() { return remaining > 0; }
+    const string& getFileName() { return fileName; }
+
+private:
+    // Complete ("X") events for every frame and its phases, plus a counter track for draw calls
+    void Save() {
+        const int stride = (int)TracePhase::COUNT + 1;
+        double toMicroseconds = 1000000.0 / SDL_GetPerformanceFrequency();
+        auto time = [&](Uint64 mark) { return (mark - marks[0]) * toMicroseconds; };
+
+        json events = json::array();
+        for (size_t frame = 0; frame < drawCalls.size(); frame++) {
+            const Uint64* mark = &marks[frame * stride];
+            events.push_back({ { "name", "Frame" }, { "ph", "X" }, { "pid", 1 }, { "tid", 1 },
+                { "ts", time(mark[0]) }, { "dur", time(mark[stride - 1]) - time(mark[0]) } });
+            for (int phase = 0; phase < (int)TracePhase::COUNT; phase++) {
+                events.push_back({ { "name", TRACE_PHASE_NAMES[phase] }, { "ph", "X" }, { "pid", 1 }, { "tid", 1 },
+                    { "ts", time(mark[phase]) }, { "dur", time(mark[phase + 1]) - time(mark[phase]) } });
             }
+            events.push_back({ { "name", "draw_calls" }, { "ph", "C" }, { "pid", 1 }, { "ts", time(mark[0]) },
+                { "args", { { "draw_calls", drawCalls[frame] } } } });
         }
 
-        // Allow player to still jump for a few frames after leaving the ground (makes movement feel smoother)
-        if (groundedThisFrame) {
-            isGrounded = true;
-            coyoteTimer = 0.05f;
-        }
-        else {
-            if (coyoteTimer > 0.0f) {
-                coyoteTimer -= deltaTime;
-                isGrounded = true;
-            }
-            else {
-                isGrounded = false;
-            }
+        ofstream file(fileName, ios::trunc);
+        if (!file.is_open()) {
+            cerr << "Trace failed to save." << endl;
+            return;
         }
+        file << json{ { "traceEvents", events } }.dump();
+    }
 
-        // Make camera follow player
-        camera.targetX = pos.x + body.w / 2.0f - camera.w / 2.0f;
-        camera.targetY = pos.y + body.h / 2.0f - camera.h / 1.8f;
+    string fileName;
+    int remaining;
+    vector<Uint64> marks;
+    vector<uint64_t> drawCalls;
+};
 
-        // Make attack hitbox follow player
-        if (isAttacking) {
-            switch (attackDirection) {
-            case AttackDirection::UP:
-                attackHitbox.x = pos.x;
-                attackHitbox.y = pos.y - attackHitbox.h;
-                break;
-            case AttackDirection::DOWN:
-                attackHitbox.x = pos.x;
-                attackHitbox.y = pos.y + body.h;
-                break;
-            case AttackDirection::LEFT:
-                attackHitbox.x = pos.x - attackHitbox.w;
-                attackHitbox.y = pos.y + attackHitbox.h / 2.0f;
-                break;
-            case AttackDirection::RIGHT:
-                attackHitbox.x = pos.x + attackHitbox.w;
-                attackHitbox.y = pos.y + attackHitbox.h / 2.0f;
-                break;
+
+enum class CaptureFormat { Y4M, PNG };
+
+// One captured frame, packed RGB24 rows
+struct CaptureFrame {
+    vector<uint8_t> pixels;
+    int number;
+};
+
+// Writes rendered frames to a Y4M video or a numbered PNG sequence on a background thread. Frames are copied into a
+// fixed pool of buffers and handed to the writer, if it has fallen behind and every buffer is queued the frame is
+// dropped and counted, so the game never waits on the disk
+class FrameCapture {
+public:
+    static constexpr int BUFFER_COUNT = 8;
+
+    FrameCapture() :
+        format(CaptureFormat::Y4M),
+        width(0),
+        height(0),
+        remaining(0),
+        frameNumber(0),
+        dropped(0),
+        written(0),
+        stopping(false)
+    {
+    };
+
+    ~FrameCapture() {
+        Stop();
+    }
+
+    // Capture the next frames (or until stopped if frames is 0), a path ending in ".png" writes path_000000.png and
+    // so on, anything else is one Y4M file
+    bool Start(const string& path, int w, int h, int frames, int framesPerSecond) {
+        Stop();
+        format = path.size() > 4 && path.compare(path.size() - 4, 4, ".png") == 0 ? CaptureFormat::PNG : CaptureFormat::Y4M;
+        fileName = format == CaptureFormat::PNG ? path.substr(0, path.size() - 4) : path;
+        width = w;
+        height = h;
+
+        if (format == CaptureFormat::Y4M) {
+            video.open(fileName, ios::binary | ios::trunc);
+            if (!video.is_open()) {
+                cerr << "Capture failed to open '" << fileName << "'." << endl;
+                return false;
             }
+            // Full chroma, so nothing is lost to subsampling before frames are compared
+            video << "YUV4MPEG2 W" << width << " H" << height << " F" << framesPerSecond << ":1 Ip A1:1 C444\n";
         }
 
-        // Apply cooldowns
-        if (dashCooldown > 0.0f) { dashCooldown -= deltaTime; }
-        if (attackCooldown > 0.0f) { attackCooldown -= deltaTime; }
-        if (damageCooldown > 0.0f) { damageCooldown -= deltaTime; }
-
-        // If player is grounded, allow them to dash again (can only dash once middair)
-        if (isGrounded && !canDash) {
-            canDash = true;
+        buffers.assign(BUFFER_COUNT, CaptureFrame{ vector<uint8_t>((size_t)width * height * 3), 0 });
+        freeFrames.clear();
+        queuedFrames.clear();
+        for (auto& frame : buffers) {
+            freeFrames.push_back(&frame);
         }
+        remaining = frames > 0 ? frames : -1;
+        frameNumber = 0;
+        dropped = 0;
+        written = 0;
+        stopping = false;
+        writer = thread(&FrameCapture::WriterLoop, this);
+        return true;
     }
 
-    void Render(SDL_Renderer* renderer, Camera camera, float alpha) {
-        if (isAttacking) {
-            SDL_SetRenderDrawColor(renderer, 204, 62, 146, 255);
-            // Draw attack relative to camera position
-            SDL_Rect drawAttack = {
-                (int)roundf((previousAttackPos.x * (1.0f - alpha) + attackHitbox.x * alpha) - camera.x),
-                (int)((previousAttackPos.y * (1.0f - alpha) + attackHitbox.y * alpha) - camera.y),
-                attackHitbox.w,
-                attackHitbox.h
-            };
-            SDL_RenderFillRect(renderer, &drawAttack);
+    // Finish writing whatever is queued then stop
+    void Stop() {
+        if (!writer.joinable()) { return; }
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
         }
+        queueCondition.notify_one();
+        writer.join();
+        remaining = 0;
+    }
 
-        // Change colour temporarily to show damage
-        if (damageCooldown > 0.25f) {
-            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
+    // Buffer for this frame's pixels, or nullptr if the frame is dropped because the writer is behind. Dropped frames
+    // still count towards the frames being captured, so a capture always covers the same stretch of the game
+    CaptureFrame* Acquire() {
+        if (remaining == 0) { return nullptr; }
+        if (remaining > 0) { remaining--; }
+
+        lock_guard<mutex> lock(queueMutex);
+        CaptureFrame* frame = nullptr;
+        if (!freeFrames.empty()) {
+            frame = freeFrames.back();
+            freeFrames.pop_back();
+            frame->number = frameNumber;
         }
         else {
-            SDL_SetRenderDrawColor(renderer, 62, 146, 204, 255);
+            dropped++;
+            FinishLocked();
         }
+        frameNumber++;
+        return frame;
+    }
 
-        // Draw player relative to camera position
-        SDL_Rect drawPlayer = {
-            (int)roundf((previousPos.x * (1.0f - alpha) + body.x * alpha) - camera.x),
-            (int)((previousPos.y * (1.0f - alpha) + body.y * alpha) - camera.y),
-            body.w,
-            body.h
-        };
-        SDL_RenderFillRect(renderer, &drawPlayer);
-
-        // Health icons
-        SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-        for (int i = 0; i < health; i++) {
-            SDL_Rect icon = { 10 + (60 * i), 10, 40, 40 };
-            SDL_RenderFillRect(renderer, &icon);
+    // Queue a filled buffer for writing
+    void Submit(CaptureFrame* frame) {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            queuedFrames.push_back(frame);
+            FinishLocked();
         }
-        // Damaged health icons
-        SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-        for (int i = 0; i < 10 - health; i++) {
-            SDL_Rect icon = { 550 - (60 * i), 10, 40, 40 };
-            SDL_RenderFillRect(renderer, &icon);
+        queueCondition.notify_one();
+    }
+
+    // Hand back a buffer that couldnt be filled, the frame counts as dropped
+    void Skip(CaptureFrame* frame) {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            freeFrames.push_back(frame);
+            dropped++;
+            FinishLocked();
         }
+        queueCondition.notify_one();
     }
 
-    void RespawnPlayer(Camera& camera, int x, int y, int hp) {
-        // Reset attributes on death
-        body.x = x; body.y = y;
-        pos.x = (float)x; pos.y = (float)y;
-        previousPos = pos;
-        vel.x = 0.0f; vel.y = 0.0f;
-        camera.x = 0.0f; camera.y = 0.0f;
+    // Getters
+    bool getActive() { return remaining != 0; }
+    int getWidth() { return width; }
+    int getHeight() { return height; }
+    int getDropped() { return dropped; }
+    int getWritten() { return written.load(); }
+    const string& getFileName() { return fileName; }
 
-        damageCooldown = 0.0f;
-        health = hp;
+private:
+    // After the last frame the writer finishes what is queued and exits by itself, so ending a capture never waits
+    void FinishLocked() {
+        if (remaining == 0) {
+            stopping = true;
+        }
     }
 
-    void DealDamage(vector<unique_ptr<Enemy>>& enemies, vector<Coin>& coins);
-    void TakeDamage(int damage, Vector2 damageLocation);
+    void WriterLoop() {
+        while (true) {
+            CaptureFrame* frame = nullptr;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this]() { return stopping || !queuedFrames.empty(); });
+                if (queuedFrames.empty()) {
+                    if (video.is_open()) { video.close(); }
+                    return;
+                }
+                frame = queuedFrames.front();
+                queuedFrames.erase(queuedFrames.begin());
+            }
 
-    // Getters and Setters
-    Vector2 getPos() { return pos; }
-    SDL_Rect getBody() { return body; }
-    int getHealth() { return health; }
-    void setPlayerData() {
-        PlayerData playerData = loadPlayerFile("Files/player.json");
-        body.x = playerData.x;
-        body.y = playerData.y;
-        pos.x = (float)playerData.x;
-        pos.y = (float)playerData.y;
-        health = playerData.health;
+            if (format == CaptureFormat::Y4M) {
+                WriteY4M(*frame);
+            }
+            else {
+                WritePng(*frame);
+            }
+            written++;
 
-        // If player quit game whilst respawning, take damage to retrigger death
-        if (health <= 0) {
-            TakeDamage(0, Vector2{ 0.0f, 0.0f });
+            lock_guard<mutex> lock(queueMutex);
+            freeFrames.push_back(frame);
         }
     }
 
-private:
-    Vector2 pos;
-    Vector2 previousPos;
-    Vector2 vel;
-    SDL_Rect body;
-    SDL_Rect attackHitbox;
-    Vector2 previousAttackPos;
-    Game* game;
+    // BT.601 studio range, the same conversion video tools assume for Y4M
+    void WriteY4M(const CaptureFrame& frame) {
+        size_t pixelCount = (size_t)width * height;
+        planes.resize(pixelCount * 3);
+        const uint8_t* rgb = frame.pixels.data();
+        for (size_t i = 0; i < pixelCount; i++) {
+            int r = rgb[i * 3], g = rgb[i * 3 + 1], b = rgb[i * 3 + 2];
+            planes[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            planes[pixelCount + i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            planes[pixelCount * 2 + i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+        video << "FRAME\n";
+        video.write((const char*)planes.data(), planes.size());
+    }
 
-    bool canDash;
-    bool isDashing;
-    bool dashPressedLastFrame;
-    float dashTimer;
-    float dashCooldown;
+    // Uncompressed PNG (stored deflate blocks), larger than a compressed one but needs no zlib and costs the writer
+    // almost nothing
+    void WritePng(const CaptureFrame& frame) {
+        char number[16];
+        snprintf(number, sizeof(number), "_%06d.png", frame.number);
+        ofstream file(fileName + number, ios::binary | ios::trunc);
+        if (!file.is_open()) {
+            cerr << "Capture failed to save frame " << frame.number << "." << endl;
+            return;
+        }
 
-    bool isAttacking;
-    bool attackPressedLastFrame;
-    AttackDirection attackDirection;
-    float attackTimer;
-    float attackCooldown;
+        // Every row starts with filter type 0 (none)
+        size_t rowSize = (size_t)width * 3 + 1;
+        rows.resize(rowSize * height);
+        for (int y = 0; y < height; y++) {
+            rows[y * rowSize] = 0;
+            memcpy(&rows[y * rowSize + 1], &frame.pixels[(size_t)y * width * 3], rowSize - 1);
+        }
 
-    bool isGrounded;
-    float coyoteTimer;
+        // Zlib stream of stored blocks of up to 65535 bytes, then the Adler-32 of the raw rows
+        chunk.clear();
+        chunk.insert(chunk.end(), { 0x78, 0x01 });
+        uint32_t a = 1, b = 0;
+        for (size_t offset = 0; offset < rows.size(); offset += 65535) {
+            uint16_t length = (uint16_t)min((size_t)65535, rows.size() - offset);
+            bool last = offset + length == rows.size();
+            chunk.insert(chunk.end(), { (uint8_t)last, (uint8_t)length, (uint8_t)(length >> 8), (uint8_t)~length, (uint8_t)(~length >> 8) });
+            chunk.insert(chunk.end(), rows.begin() + offset, rows.begin() + offset + length);
+            for (size_t i = offset; i < offset + length; i++) {
+                a = (a + rows[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+        }
+        AppendBigEndian(chunk, b << 16 | a);
+
+        static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        file.write((const char*)signature, sizeof(signature));
+
+        vector<uint8_t> header;
+        AppendBigEndian(header, (uint32_t)width);
+        AppendBigEndian(header, (uint32_t)height);
+        header.insert(header.end(), { 8, 2, 0, 0, 0 });     // 8 bit RGB, no interlacing
+        WritePngChunk(file, "IHDR", header);
+        WritePngChunk(file, "IDAT", chunk);
+        WritePngChunk(file, "IEND", vector<uint8_t>());
+    }
 
-    float damageCooldown;
-    float knockbackTimer;
+    static void AppendBigEndian(vector<uint8_t>& bytes, uint32_t value) {
+        bytes.insert(bytes.end(), { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value });
+    }
 
-    bool isJumping;
-    bool facingLeft;
-    float speed;
-    float jumpVelocity;
-    int health;
-};
+    // Length, type, data then the CRC-32 of the type and data
+    static void WritePngChunk(ofstream& file, const char* type, const vector<uint8_t>& data) {
+        static uint32_t crcTable[256];
+        static once_flag tableBuilt;
+        call_once(tableBuilt, []() {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                }
+                crcTable[n] = c;
+            }
+        });
+
+        vector<uint8_t> bytes;
+        AppendBigEndian(bytes, (uint32_t)data.size());
+        bytes.insert(bytes.end(), type, type + 4);
+        bytes.insert(bytes.end(), data.begin(), data.end());
+        uint32_t crc = 0xffffffff;
+        for (size_t i = 4; i < bytes.size(); i++) {
+            crc = crcTable[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+        }
+        AppendBigEndian(bytes, crc ^ 0xffffffff);
+        file.write((const char*)bytes.data(), bytes.size());
+    }
 
+    CaptureFormat format;
+    string fileName;
+    int width;
+    int height;
+    // Frames left to capture, -1 to carry on until stopped
+    int remaining;
+    int frameNumber;
+    int dropped;
+    atomic<int> written;
+
+    // Only the writer touches these
+    ofstream video;
+    vector<uint8_t> planes;
+    vector<uint8_t> rows;
+    vector<uint8_t> chunk;
+
+    // Shared with the writer
+    vector<CaptureFrame> buffers;
+    vector<CaptureFrame*> freeFrames;
+    vector<CaptureFrame*> queuedFrames;
+    thread writer;
+    mutex queueMutex;
+    condition_variable queueCondition;
+    bool stopping;
+};
 
-// Enemy Abstract Base Class
-class Enemy {
-public:
-    Enemy(Game* game, int x, int y, int width, int height, int health, bool isFlying) :
-        pos{ (float)x, (float)y },
-        vel{ 0.0f, 0.0f },
-        body{ x, y, width, height },
-        respawnPos{ (float)x, (float)y },
-        game(game),
-        damageCooldown(0.0f),
-        knockbackTimer(0.0f),
-        respawnTimer(0.0f),
-        health(health),
-        maxHealth(health),
-        onScreen(false),
-        isFlying(isFlying),
-        isAlive(true)
-    {
-    };
 
-    virtual ~Enemy() = default;
+enum class CvarType { BOOL, INT, FLOAT };
 
-    void Update(vector<SDL_Rect> platforms, float deltaTime, Vector2 playerPos, SDL_Rect playerBody) {
-        if (onScreen) {
-            // If not currently taking knockback
-            if (knockbackTimer <= 0.0f) {
-                TrackPlayer(playerPos, playerBody);
+// Setting changed from the console, held as a float whatever its type and handed to apply whenever it is set
+struct Cvar {
+    string name;
+    CvarType type;
+    float value;
+    float minValue;
+    float maxValue;
+    string description;
+    function<void(float)> apply;
+};
 
-                // Apply gravity
-                if (!isFlying) {
-                    vel.y += Constants::GRAVITY * deltaTime;
+struct ConsoleCommand {
+    string name;
+    string usage;
+    string description;
+    function<void(const vector<string>&)> run;
+};
 
-                    if (vel.y > Constants::TERMINAL_VELOCITY) {
-                        vel.y = Constants::TERMINAL_VELOCITY;
-                    }
-                }
+// Drop-down developer console (toggle with the key left of 1), each line is a cvar or command name followed by its
+// arguments. Cvars switch engine paths at runtime so they can be compared live without rebuilding, a cvar name on its
+// own prints its value and "help" lists everything registered
+class Console {
+public:
+    static constexpr int LOG_LINES = 128;
+    static constexpr int HISTORY_LINES = 32;
+    // Text is drawn from the 8 pixel test font at this scale
+    static constexpr int TEXT_SCALE = 2;
+    static constexpr int HEIGHT = Constants::WIN_HEIGHT / 2;
+
+    Console() :
+        open(false),
+        historyIndex(0)
+    {
+        AddCommand("help", "help [prefix]", "List cvars and commands, or only those starting with prefix", [this](const vector<string>& args) {
+            string prefix = args.empty() ? "" : args[0];
+            for (auto& cvar : cvars) {
+                if (cvar.name.compare(0, prefix.size(), prefix) != 0) { continue; }
+                Print(cvar.name + " = " + FormatValue(cvar) + "  " + cvar.description);
             }
-            else {
-                knockbackTimer -= deltaTime;
+            for (auto& command : commands) {
+                if (command.name.compare(0, prefix.size(), prefix) != 0) { continue; }
+                Print(command.usage + "  " + command.description);
             }
+        });
+        AddCommand("toggle", "toggle <cvar>", "Flip a true/false cvar", [this](const vector<string>& args) {
+            Cvar* cvar = args.empty() ? nullptr : FindCvar(args[0]);
+            if (!cvar || cvar->type != CvarType::BOOL) {
+                Print("toggle needs a true/false cvar");
+                return;
+            }
+            Set(*cvar, cvar->value != 0.0f ? 0.0f : 1.0f);
+        });
+        AddCommand("exec", "exec <file>", "Run every line of a file", [this](const vector<string>& args) {
+            if (args.empty() || !ExecuteFile(args[0])) {
+                Print("Could not open '" + (args.empty() ? string() : args[0]) + "'");
+            }
+        });
+        AddCommand("clear", "clear", "Clear the console", [this](const vector<string>&) {
+            log.clear();
+        });
+    };
 
-            // Apply horizontal velocity
-            pos.x += vel.x * deltaTime;
-            body.x = (int)pos.x;
-
-            for (auto& platform : platforms) {
-                // If enemy is colliding with platform
-                if (AABB(body, platform)) {
-                    // If moving left, allign enemys right edge with platforms left edge
-                    if (vel.x > 0.0f) {
-                        body.x = platform.x - body.w;
-                    }
-                    // If moving right, allign enemys left edge with platforms right edge
-                    else if (vel.x < 0.0f) {
-                        body.x = platform.x + platform.w;
-                    }
+    void AddBool(const string& name, bool initial, const string& description, function<void(bool)> apply) {
+        cvars.push_back({ name, CvarType::BOOL, initial ? 1.0f : 0.0f, 0.0f, 1.0f, description,
+            [apply](float value) { apply(value != 0.0f); } });
+    }
 
-                    // Sync pos with body after collision
-                    pos.x = body.x;
+    void AddInt(const string& name, int initial, int minValue, int maxValue, const string& description, function<void(int)> apply) {
+        cvars.push_back({ name, CvarType::INT, (float)initial, (float)minValue, (float)maxValue, description,
+            [apply](float value) { apply((int)value); } });
+    }
 
-                    // Reset horizontal velocity
-                    vel.x = 0.0f;
-                }
-            }
+    void AddFloat(const string& name, float initial, float minValue, float maxValue, const string& description, function<void(float)> apply) {
+        cvars.push_back({ name, CvarType::FLOAT, initial, minValue, maxValue, description, apply });
+    }
 
-            // Apply vertical velocity
-            pos.y += vel.y * deltaTime;
-            body.y = (int)pos.y;
+    void AddCommand(const string& name, const string& usage, const string& description, function<void(const vector<string>&)> run) {
+        commands.push_back({ name, usage, description, run });
+    }
 
-            for (auto& platform : platforms) {
-                // If enemy is colliding with platform
-                if (AABB(body, platform)) {
-                    // If moving down, allign enemys bottom edge with platforms top edge
-                    if (vel.y > 0.0f) {
-                        body.y = platform.y - body.h;
-                    }
-                    // If moving up, allign enemys top edge with platforms bottom edge
-                    else if (vel.y < 0.0f) {
-                        body.y = platform.y + platform.h;
-                    }
+    // Add text to the console log (and standard output), a line at a time
+    void Print(const string& text) {
+        cout << text << endl;
+        istringstream lines(text);
+        string line;
+        while (getline(lines, line)) {
+            log.push_back(line);
+        }
+        if (log.size() > LOG_LINES) {
+            log.erase(log.begin(), log.end() - LOG_LINES);
+        }
+    }
 
-                    // Sync pos with body after collision
-                    pos.y = body.y;
+    // Run one line, "name" prints a cvar, "name value" sets it and anything else runs a command
+    void Execute(const string& line) {
+        vector<string> words;
+        istringstream stream(line);
+        string word;
+        while (stream >> word) {
+            words.push_back(word);
+        }
+        if (words.empty() || words[0][0] == '#') { return; }
 
-                    // Reset vertical velocity
-                    vel.y = 0.0f;
-                }
+        vector<string> args(words.begin() + 1, words.end());
+        if (Cvar* cvar = FindCvar(words[0])) {
+            if (args.empty()) {
+                Print(cvar->name + " = " + FormatValue(*cvar) + "  " + cvar->description);
+                return;
+            }
+            float value;
+            if (!ParseValue(*cvar, args[0], value)) {
+                Print("'" + args[0] + "' is not a valid value for " + cvar->name);
+                return;
             }
+            Set(*cvar, value);
+            return;
         }
-        else if (!isAlive) {
-            respawnTimer -= deltaTime;
-            if (respawnTimer <= 0.0f) {
-                Respawn();
+        for (auto& command : commands) {
+            if (command.name == words[0]) {
+                command.run(args);
+                return;
             }
         }
-
-        // Apply cooldowns
-        if (damageCooldown > 0.0f) { damageCooldown -= deltaTime; }
+        Print("Unknown cvar or command '" + words[0] + "'");
     }
 
-    void Render(SDL_Renderer* renderer, Camera camera) {
-        if (onScreen) {
-            // Change colour temporarily to show damage
-            if (damageCooldown > 0.25f) {
-                SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-            }
-            else {
-                SDL_SetRenderDrawColor(renderer, 14, 201, 128, 255);
-            }
+    // Run every line of a file, returns false if it couldnt be opened
+    bool ExecuteFile(const string& fileName) {
+        ifstream file(fileName);
+        if (!file.is_open()) { return false; }
 
-            // Draw enemy relative to camera position
-            SDL_Rect drawEnemy = { (int)roundf(body.x - camera.x), (int)(body.y - camera.y), body.w, body.h };
-            SDL_RenderFillRect(renderer, &drawEnemy);
+        string line;
+        while (getline(file, line)) {
+            Execute(line);
         }
+        return true;
     }
 
-    void DealDamage(Player& player);
-    bool TakeDamage(int damage, Vector2 damageLocation);
-    virtual void TrackPlayer(Vector2 playerPos, SDL_Rect playerBody) = 0;
-
-    void Respawn() {
-        // Reset attributes on respawn
-        isAlive = true;
-        health = maxHealth;
-        knockbackTimer = 0.0f;
-
-        pos.x = respawnPos.x; pos.y = respawnPos.y;
-        body.x = (int)respawnPos.x; body.y = (int)respawnPos.y;
-    }
+    // Returns true if the event was used by the console, it takes all keyboard input while open
+    bool HandleEvent(const SDL_Event& event) {
+        if (event.type == SDL_KEYDOWN && event.key.keysym.scancode == SDL_SCANCODE_GRAVE) {
+            if (!event.key.repeat) {
+                open = !open;
+                if (open) { SDL_StartTextInput(); }
+                else { SDL_StopTextInput(); }
+            }
+            return true;
+        }
+        if (!open) { return false; }
 
-    void CheckOnScreen(SDL_Rect cameraRect) {
-        if (isAlive) {
-            // If enemy is colliding with the camera, then they are on screen
-            if (AABB(body, cameraRect)) {
-                onScreen = true;
+        if (event.type == SDL_TEXTINPUT) {
+            // The toggle key also arrives as text
+            for (const char* c = event.text.text; *c; c++) {
+                if (*c != '`' && *c != '~') { input += *c; }
             }
-            else {
-                onScreen = false;
+            return true;
+        }
+        if (event.type == SDL_KEYDOWN) {
+            switch (event.key.keysym.sym) {
+            case SDLK_RETURN:
+            case SDLK_KP_ENTER:
+                Print("> " + input);
+                if (!input.empty()) {
+                    history.push_back(input);
+                    if (history.size() > HISTORY_LINES) { history.erase(history.begin()); }
+                }
+                historyIndex = (int)history.size();
+                Execute(input);
+                input.clear();
+                break;
+            case SDLK_BACKSPACE:
+                if (!input.empty()) { input.pop_back(); }
+                break;
+            case SDLK_ESCAPE:
+                open = false;
+                SDL_StopTextInput();
+                break;
+            case SDLK_UP:
+            case SDLK_DOWN:
+                historyIndex = max(0, min((int)history.size(), historyIndex + (event.key.keysym.sym == SDLK_UP ? -1 : 1)));
+                input = historyIndex < (int)history.size() ? history[historyIndex] : "";
+                break;
+            case SDLK_TAB:
+                Complete();
+                break;
             }
+            return true;
         }
+        return event.type == SDL_KEYUP || event.type == SDL_TEXTEDITING;
     }
 
-    // Getters
-    bool getOnScreen() { return onScreen; }
-    SDL_Rect getBody() { return body; }
-
-protected:
-    Vector2 pos;
-    Vector2 vel;
-    SDL_Rect body;
-    Vector2 respawnPos;
-    Game* game;
+    // Draw the log and input line over the top of the screen
+    void Render(SDL_Renderer* renderer) {
+        if (!open) { return; }
+
+        SDL_RenderSetViewport(renderer, nullptr);
+        SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+        SDL_SetRenderDrawColor(renderer, 10, 12, 18, 220);
+        SDL_Rect panel = { 0, 0, Constants::WIN_WIDTH, HEIGHT };
+        renderFillRect(renderer, &panel);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+        // Newest lines at the bottom, just above the input line
+        SDL_RenderSetScale(renderer, (float)TEXT_SCALE, (float)TEXT_SCALE);
+        int inputY = HEIGHT / TEXT_SCALE - FONT_LINE_HEIGHT;
+        SDL_SetRenderDrawColor(renderer, 190, 200, 210, 255);
+        int y = inputY - FONT_LINE_HEIGHT;
+        for (int i = (int)log.size() - 1; i >= 0 && y >= 0; i--, y -= FONT_LINE_HEIGHT) {
+            renderText(renderer, 4, y, log[i]);
+        }
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        renderText(renderer, 4, inputY, "> " + input + "_");
+        SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+    }
 
-    float damageCooldown;
-    float knockbackTimer;
-    float respawnTimer;
+    // Getters
+    bool getOpen() { return open; }
 
-    int health;
-    int maxHealth;
-    bool onScreen;
-    bool isFlying;
-    bool isAlive;
-};
+private:
+    Cvar* FindCvar(const string& name) {
+        for (auto& cvar : cvars) {
+            if (cvar.name == name) { return &cvar; }
+        }
+        return nullptr;
+    }
 
-// Melee enemy class
-class MeleeEnemy : public Enemy {
-public:
-    MeleeEnemy(Game* game, int x, int y, int width, int height, int health) :
-        Enemy(game, x, y, width, height, health, false)
-    {
-    };
+    void Set(Cvar& cvar, float value) {
+        value = max(cvar.minValue, min(cvar.maxValue, value));
+        if (cvar.type != CvarType::FLOAT) { value = roundf(value); }
+        cvar.value = value;
+        cvar.apply(value);
+        Print(cvar.name + " = " + FormatValue(cvar));
+    }
 
-    // Only track player horizontally (cant fly)
-    void TrackPlayer(Vector2 playerPos, SDL_Rect playerBody) override {
-        if (playerPos.x + playerBody.w < pos.x + 1.0f) { vel.x = -150.0f; }
-        else if (playerPos.x > pos.x + body.w - 1.0f) { vel.x = 150.0f; }
-        else { vel.x = 0.0f; }
+    static bool ParseValue(const Cvar& cvar, const string& text, float& value) {
+        if (cvar.type == CvarType::BOOL) {
+            if (text == "1" || text == "true" || text == "on") { value = 1.0f; return true; }
+            if (text == "0" || text == "false" || text == "off") { value = 0.0f; return true; }
+            return false;
+        }
+        char* end = nullptr;
+        value = strtof(text.c_str(), &end);
+        return end != text.c_str() && *end == '\0' && isfinite(value);
     }
-};
 
-// Flying enemy class
-class FlyingEnemy : public Enemy {
-public:
-    FlyingEnemy(Game* game, int x, int y, int width, int height, int health) :
-        Enemy(game, x, y, width, height, health, true)
-    {
-    };
+    static string FormatValue(const Cvar& cvar) {
+        switch (cvar.type) {
+        case CvarType::BOOL:
+            return cvar.value != 0.0f ? "true" : "false";
+        case CvarType::INT:
+            return to_string((int)cvar.value);
+        default:
+            char text[32];
+            snprintf(text, sizeof(text), "%g", cvar.value);
+            return text;
+        }
+    }
 
-    // Track player horizontally and vertically (can fly)
-    void TrackPlayer(Vector2 playerPos, SDL_Rect playerBody) override {
-        if (playerPos.x + playerBody.w < pos.x + 1.0f) { vel.x = -100.0f; }
-        else if (playerPos.x > pos.x + body.w - 1.0f) { vel.x = 100.0f; }
-        else { vel.x = 0.0f; }
+    // Extend the input to the longest name shared by every cvar and command it starts, listing them if there are several
+    void Complete() {
+        vector<const string*> matches;
+        for (auto& cvar : cvars) {
+            if (cvar.name.compare(0, input.size(), input) == 0) { matches.push_back(&cvar.name); }
+        }
+        for (auto& command : commands) {
+            if (command.name.compare(0, input.size(), input) == 0) { matches.push_back(&command.name); }
+        }
+        if (matches.empty()) { return; }
 
-        if (playerPos.y + playerBody.h < pos.y + 1.0f) { vel.y = -100.0f; }
-        else if (playerPos.y > pos.y + body.h - 1.0f) { vel.y = 100.0f; }
-        else { vel.y = 0.0f; }
+        string common = *matches[0];
+        for (const string* match : matches) {
+            size_t length = 0;
+            while (length < common.size() && length < match->size() && common[length] == (*match)[length]) {
+                length++;
+            }
+            common.resize(length);
+        }
+        if (matches.size() == 1) {
+            input = common + " ";
+            return;
+        }
+        string names;
+        for (const string* match : matches) {
+            names += *match + "  ";
+        }
+        Print(names);
+        input = common;
     }
+
+    bool open;
+    string input;
+    vector<string> log;
+    vector<string> history;
+    int historyIndex;
+    vector<Cvar> cvars;
+    vector<ConsoleCommand> commands;
 };
 
 
-// Main game logic class
+// Main game logic class, owns the window, renderer and mixer and presents one world
 class Game {
 public:
-    Game() :
+    Game(int playerCount = 1) :
         window(nullptr),
         renderer(nullptr),
-        controller(nullptr),
+        framebuffer(nullptr),
+        headless(false),
+        controllers(playerCount, nullptr),
         backgroundMusic(nullptr),
+        currentMusic(nullptr),
         previousTick(0),
         isRunning(false),
         deltaTime(0.0f),
         accumulator(0.0f),
         alphaDT(0.0f),
-        camera({ 0.0f, 0.0f, 0.0f, 0.0f, Constants::WIN_WIDTH, Constants::WIN_HEIGHT }),
-        cameraRect({ 0, 0, Constants::WIN_WIDTH, Constants::WIN_HEIGHT }),
-        player(55, 100, this),
-        playerIsRespawning(false),
-        playerHasReset(false),
-        playerHasWon(false),
-        fadeAlpha(0.0f),
-        enemies(loadEnemies("Files/enemies.json", this)),
-        platforms(loadPlatforms("Files/platforms.json")),
-        coins(loadCoins("Files/coins.json"))
-        //platformTimer(0.0f)
+        inputs(playerCount),
+        world(loadLevel("Files"), &telemetry, playerCount),
+        bot(1),
+        runTick(0),
+        useLevelCache(true),
+        showBackground(true),
+        showLighting(true),
+        showMinimap(true),
+        showStats(false),
+        frameTime(0),
+        frameDrawCalls(0)
     {
     };
 
+    // Carry on past the end of the level into procedurally generated chunks, call before Initialise
+    void MakeEndless(uint32_t seed) {
+        endlessLevel = make_unique<EndlessLevel>(&world, seed);
+        cout << "Endless level seed " << seed << endl;
+    }
+
+    // Draw into a software framebuffer with no window or audio, call before Initialise. The first player is driven by
+    // a playtest bot and every frame is one fixed step, so a run always renders the same frames (ghosts and
+    // autoexec.cfg are skipped, and endless levels default to a fixed seed)
+    void MakeHeadless() {
+        headless = true;
+    }
+
+    // Write the next frames to a Y4M video or PNG sequence, call after Initialise (headless runs end with the capture)
+    void StartCapture(const string& fileName, int frames) {
+        int framesPerSecond = (int)lroundf(1.0f / world.getStepTime());
+        if (capture.Start(fileName, Constants::WIN_WIDTH, Constants::WIN_HEIGHT, frames, framesPerSecond)) {
+            console.Print("Capturing " + (frames > 0 ? to_string(frames) : string("all")) + " frames to " + fileName);
+        }
+    }
+
     void Initialise() {
-        // Initialise SDL, output error if fails
-        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER) < 0) {
+        // Initialise SDL, output error if fails (headless runs dont need a display)
+        if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER) < 0) {
             cerr << "SDL could not initialise. Error: " << SDL_GetError() << endl;
             return;
         }
 
-        // Initialise window, output error if fails
-        window = SDL_CreateWindow(
-            "Game",
-            SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-            Constants::WIN_WIDTH, Constants::WIN_HEIGHT,
-            SDL_WINDOW_SHOWN
-        );
-        if (!window) {
-            cerr << "Window could not initialise. Error: " << SDL_GetError() << endl;
-            return;
+        if (headless) {
+            // Software renderer drawing straight into a surface, which is then the frame capture reads
+            framebuffer = SDL_CreateRGBSurfaceWithFormat(0, Constants::WIN_WIDTH, Constants::WIN_HEIGHT, 32, SDL_PIXELFORMAT_RGB888);
+            renderer = framebuffer ? SDL_CreateSoftwareRenderer(framebuffer) : nullptr;
+            if (!renderer) {
+                cerr << "Software renderer could not initialise. Error: " << SDL_GetError() << endl;
+                return;
+            }
         }
+        else {
+            // Initialise window, output error if fails
+            window = SDL_CreateWindow(
+                "Game",
+                SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                Constants::WIN_WIDTH, Constants::WIN_HEIGHT,
+                SDL_WINDOW_SHOWN
+            );
+            if (!window) {
+                cerr << "Window could not initialise. Error: " << SDL_GetError() << endl;
+                return;
+            }
 
-        // Initialise renderer, output error if fails
-        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-        if (!renderer) {
-            cerr << "Renderer could not initialise. Error: " << SDL_GetError() << endl;
-            return;
+            // Initialise renderer, output error if fails
+            renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_TARGETTEXTURE);
+            if (!renderer) {
+                cerr << "Renderer could not initialise. Error: " << SDL_GetError() << endl;
+                return;
+            }
         }
+        spriteAtlas.Load(renderer, "Files/sprites.json");
+        spriteBatch.setAtlas(&spriteAtlas);
+        levelCache.Build(renderer, world.getPlatforms(), endlessLevel != nullptr, world.getPlayerCount());
+        minimap.Build(renderer, world);
+        background.Build(world.getBackgroundLayers());
 
         // Initialise audio mixer, output error if fails
-        if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
+        if (!headless && Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
             cerr << "Audio mixer could not initialise. Error: " << Mix_GetError() << endl;
             return;
         }
         Mix_AllocateChannels(32);
 
-        // Find controller
-        for (int i = 0; i < SDL_NumJoysticks(); i++) {
+        // Find a controller for each player, in the order they are connected
+        size_t player = 0;
+        for (int i = 0; i < SDL_NumJoysticks() && player < controllers.size(); i++) {
             if (SDL_IsGameController(i)) {
-                controller = SDL_GameControllerOpen(i);
-                cout << "Controller found: " << SDL_GameControllerName(controller) << endl;
-                break;
+                controllers[player] = SDL_GameControllerOpen(i);
+                cout << "Controller found for player " << player + 1 << ": " << SDL_GameControllerName(controllers[player]) << endl;
+                player++;
             }
         }
 
-        // Load player data from save file
-        player.setPlayerData();
+        // Load player data from save file, headless runs always start from the start of the level
+        if (!headless) {
+            world.getPlayer().setPlayerData();
+        }
 
         // Load sounds
-        backgroundMusic = Mix_LoadMUS("Files/music.ogg");
-        sfxList = loadSoundEffects();
-        Mix_PlayMusic(backgroundMusic, -1);
+        if (!headless) {
+            backgroundMusic = Mix_LoadMUS("Files/music.ogg");
+            currentMusic = backgroundMusic;
+            sfxList = loadSoundEffects();
+            Mix_PlayMusic(backgroundMusic, -1);
+        }
+
+        // Export metrics for external dashboards
+        metrics.OpenSharedMemory();
+        if (!headless) {
+            telemetry.Start("Files/telemetry.bin");
+        }
+
+        // Previously completed runs to race against, and settings kept between runs such as engine paths being
+        // compared on this machine. Both change as the game is played, so headless runs leave them out to render
+        // the same frames on every run of a build
+        RegisterConsole();
+        if (!headless) {
+            ghosts.Load("Files/ghosts.bin");
+            console.ExecuteFile("Files/autoexec.cfg");
+        }
 
         // If everything has been initialised without error, run game 
         isRunning = true;
     }
 
     void HandleInput() {
+        if (headless) {
+            inputs[0] = bot.Think(world);
+            return;
+        }
+
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 isRunning = false;
             }
+            // Console takes the keyboard while it is open
+            else if (console.HandleEvent(event)) {
+                continue;
+            }
+            // Streamed chunks would move objects under the editor's undo log, so endless levels cant be edited
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F1 && !event.key.repeat && !endlessLevel) {
+                editor.Toggle(world);
+            }
+            // Editor takes the mouse and its own keys while it is open
+            else if (editor.HandleEvent(event, world)) {
+                continue;
+            }
+            // Cached level textures need redrawing (or recreating) if the renderer lost them
+            else if (event.type == SDL_RENDER_TARGETS_RESET) {
+                levelCache.InvalidateAll();
+                minimap.InvalidateAll();
+            }
+            else if (event.type == SDL_RENDER_DEVICE_RESET) {
+                levelCache.Release();
+                minimap.Release();
+                background.Release();
+                lightmap.Release();
+                SDLTest_CleanupTextDrawing();
+                spriteAtlas.Load(renderer, "Files/sprites.json");
+            }
+            // Mouse wheel zooms the first player's view
+            else if (event.type == SDL_MOUSEWHEEL && event.wheel.y != 0) {
+                world.SetZoom(0, world.getZoom(0) * powf(1.1f, (float)event.wheel.y));
+            }
         }
 
-        // Get keyboard inputs
-        const Uint8* keystate = SDL_GetKeyboardState(nullptr);
-        player.HandleInput(keystate, controller);
-
-        // DEBUG code for adding new platforms
-        /*if (keystate[SDL_SCANCODE_R] && platformTimer <= 0.0f) {
-            platformTimer = 0.5f;
-            int x = player.getPos().x;
-            int y = player.getPos().y + 100;
-            int w = 125;
-            int h = 50;
+        // Get keyboard inputs, unless they are being typed into the console
+        const Uint8* keystate = console.getOpen() ? nullptr : SDL_GetKeyboardState(nullptr);
+        // Keyboard controls the first player alongside their controller
+        for (size_t i = 0; i < inputs.size(); i++) {
+            inputs[i] = readPlayerInput(i == 0 ? keystate : nullptr, controllers[i]);
+        }
+        if (keystate) {
+            editor.Update(keystate, deltaTime, world);
+        }
 
-            platforms.push_back(SDL_Rect{x, y, w, h});
-            cout << "    {\n" << "        \"x\": " << x << ",\n        \"y\": " << Constants::FLOOR_LEVEL - y
-            << ",\n        \"w\": " << w << ",\n        \"h\": " << h << "\n    }," << endl;
+        // Zoom out with minus or left shoulder, in with equals or right shoulder (doubling each second held)
+        for (size_t i = 0; i < controllers.size(); i++) {
+            bool zoomOut = i == 0 && keystate && keystate[SDL_SCANCODE_MINUS];
+            bool zoomIn = i == 0 && keystate && keystate[SDL_SCANCODE_EQUALS];
+            if (controllers[i]) {
+                zoomOut = zoomOut || SDL_GameControllerGetButton(controllers[i], SDL_CONTROLLER_BUTTON_LEFTSHOULDER);
+                zoomIn = zoomIn || SDL_GameControllerGetButton(controllers[i], SDL_CONTROLLER_BUTTON_RIGHTSHOULDER);
+            }
+            if (zoomOut != zoomIn) {
+                float factor = powf(2.0f, zoomIn ? deltaTime : -deltaTime);
+                world.SetZoom((int)i, world.getZoom((int)i) * factor);
+            }
         }
-        if (platformTimer > 0.0f) {
-            platformTimer -= deltaTime;
-        }*/
     }
 
     void Update() {
-        // Calculate deltaTime to normalise movement
+        // Calculate deltaTime to normalise movement (headless frames are exactly one step)
         Uint32 currentTick = SDL_GetTicks();
-        deltaTime = (currentTick - previousTick) / 1000.0f;
+        deltaTime = headless ? world.getStepTime() : (currentTick - previousTick) / 1000.0f;
         previousTick = currentTick;
 
         // Clamp deltaTime to avoid clipping at low FPS
@@ -920,113 +7706,198 @@ public:
             deltaTime = 0.05f;
         }
         accumulator += deltaTime;
+        metrics.Increment(Counter::FRAMES);
 
-        // Normal game logic
-        if (!playerIsRespawning) {
-            for (auto& enemy : enemies) {
-                enemy->CheckOnScreen(cameraRect);
-                enemy->Update(platforms, deltaTime, player.getPos(), player.getBody());
-                enemy->DealDamage(player);
-            }
+        // World is paused while editing
+        if (editor.getActive()) {
+            accumulator = 0.0f;
+            world.UpdateOnScreen();
+        }
 
-            // Use fixed timestep for physics calculations instead of delta time
-            while (accumulator >= Constants::FIXED_DT) {
-                player.Update(platforms, camera, Constants::FIXED_DT);
-                player.DealDamage(enemies, coins);
+        // Use fixed timestep for simulation instead of delta time
+        while (accumulator >= world.getStepTime()) {
+            world.Step(inputs.data());
 
-                accumulator -= Constants::FIXED_DT;
+            // Record this run for ghost playback (endless runs go further than ghost samples can store)
+            if (!world.getPlayerIsRespawning() && !endlessLevel) {
+                ghostRecording.push_back(world.getPlayer().getGhostSample(animation.getFrame(0)));
+                runTick++;
             }
-            alphaDT = accumulator / Constants::FIXED_DT;
 
-            cameraRect.x = (int)(camera.x);
-            cameraRect.y = (int)(camera.y);
+            accumulator -= world.getStepTime();
+            metrics.Increment(Counter::SUBSTEPS);
+        }
+        alphaDT = accumulator / world.getStepTime();
 
-            // Clamp camera to avoid out of bounds
-            if (camera.targetX < 0) {
-                camera.targetX = 0;
-            }
-            else if (camera.targetX > Constants::LEVEL_WIDTH - camera.w) {
-                camera.targetX = Constants::LEVEL_WIDTH - camera.w;
-            }
+        if (endlessLevel) {
+            endlessLevel->Update();
+        }
 
-            if (camera.targetY > 0.0f) {
-                camera.targetY = 0.0f;
+        // Play sounds and music for anything that happened during the simulation
+        for (auto event : world.getEvents()) {
+            switch (event) {
+            case WorldEvent::COIN_COLLECTED:
+                PlaySfx("coin");
+                break;
+            case WorldEvent::PLAYER_DAMAGED:
+            case WorldEvent::ENEMY_DAMAGED:
+            case WorldEvent::PLATFORM_BROKEN:
+                PlaySfx("damage");
+                break;
+            case WorldEvent::PLAYER_DIED:
+            case WorldEvent::ENEMY_KILLED:
+                PlaySfx("death");
+                break;
+            case WorldEvent::PLAYER_WON:
+                cout << "\n-=-=-=-=-=-=-=-=-=-=-=-=-=-\n Congratulations, you won! \n-=-=-=-=-=-=-=-=-=-=-=-=-=-\n\n";
+                // Only completed runs are kept as ghosts (bot runs arent worth racing)
+                if (!headless) {
+                    GhostRuns::Save("Files/ghosts.bin", ghostRecording);
+                }
+                break;
+            case WorldEvent::RESPAWN_STARTED:
+                Mix_FadeOutMusic(750);
+                break;
+            case WorldEvent::RESPAWN_FINISHED:
+                Mix_FadeInMusic(currentMusic, -1, 250);
+                // Start a new run, ghosts restart with it
+                ghostRecording.clear();
+                runTick = 0;
+                break;
+            case WorldEvent::CHECKPOINT_REACHED:
+                PlaySfx("coin");
+                break;
+            case WorldEvent::MUSIC_CHANGED:
+                currentMusic = world.getMusic().empty() ? backgroundMusic : LoadMusic(world.getMusic());
+                if (!world.getPlayerIsRespawning()) {
+                    Mix_FadeInMusic(currentMusic, -1, 500);
+                }
+                break;
+            case WorldEvent::ORIGIN_SHIFTED:
+                // Every cached column now shows a different part of the level
+                levelCache.InvalidateAll();
+                break;
             }
+        }
 
-            // Make camera move smoothly to avoid stuttering
-            camera.y += (camera.targetY - camera.y) * Constants::CAMERA_DELAY * deltaTime;
-            camera.x += (camera.targetX - camera.x) * Constants::CAMERA_DELAY * deltaTime;
+        // Only chunks touching broken or restored platforms are redrawn, however many changed this frame
+        for (int platform : world.getChangedPlatforms()) {
+            levelCache.Invalidate(world.getPlatforms()[platform]);
+            minimap.Invalidate(world.getPlatforms()[platform]);
         }
-        // If player is respawning (fading out)
-        else if (!playerHasReset) {
-            fadeAlpha += Constants::FADE_SPEED * deltaTime;
+        for (auto& area : world.getEditedAreas()) {
+            levelCache.Invalidate(area);
+            minimap.Invalidate(area);
+        }
+        world.ClearEvents();
 
-            if (fadeAlpha >= 255.0f) {
-                fadeAlpha = 255.0f;
+        // Close game if player has won
+        if (world.getIsFinished()) {
+            isRunning = false;
+        }
 
-                // Reset objects whilst screen is covered
-                player.RespawnPlayer(camera, 100, 450, 10);
-                playerHasReset = true;
+        Animate();
 
-                if (!playerHasWon) {
-                    // Respawn enemies and reset coins
-                    for (auto& enemy : enemies) {
-                        enemy->Respawn();
-                    }
-                    for (auto& coin : coins) {
-                        coin.collected = false;
-                    }
-                }
-                else {
-                    // Close game if player has won
-                    isRunning = false;
-                }
-            }
+        int enemiesActive = 0;
+        for (auto& enemy : world.getEnemies()) {
+            if (enemy->getOnScreen()) { enemiesActive++; }
         }
-        // If player is respawning (fading back in)
-        else {
-            fadeAlpha -= Constants::FADE_SPEED * deltaTime;
+        metrics.Set(Gauge::ENEMIES_ACTIVE, enemiesActive);
+        metrics.Set(Gauge::COINS_REMAINING, world.getCoinsRemaining());
+    }
 
-            if (fadeAlpha <= 0.0f) {
-                fadeAlpha = 0.0f;
-                playerIsRespawning = false;
-                Mix_FadeInMusic(backgroundMusic, -1, 250);
+    // Pick every player's and enemy's clip from their state, then advance all of them together
+    // Animation instances are the players followed by the enemies
+    void Animate() {
+        int playerCount = world.getPlayerCount();
+        vector<unique_ptr<Enemy>>& enemies = world.getEnemies();
+        if (animation.getCount() != playerCount + (int)enemies.size()) {
+            animation.Clear();
+            for (int i = 0; i < playerCount; i++) {
+                animation.Add(world.getPlayer(i).getAnimation());
             }
+            for (auto& enemy : enemies) {
+                animation.Add(enemy->getAnimation());
+            }
+        }
+
+        for (int i = 0; i < playerCount; i++) {
+            animation.Play(i, world.getPlayer(i).getAnimation());
         }
+        for (size_t i = 0; i < enemies.size(); i++) {
+            animation.Play(playerCount + (int)i, enemies[i]->getAnimation());
+        }
+        animation.Update(deltaTime);
     }
 
     void Render() {
+        int playerCount = world.getPlayerCount();
+        renderCameras.clear();
+        for (int i = 0; i < playerCount; i++) {
+            renderCameras.push_back(world.getRenderCamera(alphaDT, i));
+        }
+
         // Draw background
+        SDL_RenderSetViewport(renderer, nullptr);
         SDL_SetRenderDrawColor(renderer, 29, 62, 94, 255);
         SDL_RenderClear(renderer);
 
-        SDL_SetRenderDrawColor(renderer, 42, 98, 143, 255);
-        for (auto& platform : platforms) {
-            // Draw platforms relative to camera position
-            SDL_Rect drawPlatform = { (int)(platform.x - camera.x), (int)(platform.y - camera.y), platform.w, platform.h };
-            SDL_RenderFillRect(renderer, &drawPlatform);
-        }
-
-        for (auto& enemy : enemies) {
-            enemy->Render(renderer, camera);
+        // Work out what any camera can see once, then each view only draws from those lists
+        FindVisible();
+        bool levelCached = useLevelCache && levelCache.Prepare(renderer, spriteBatch, world, renderCameras);
+        GatherLights();
+
+        for (int i = 0; i < playerCount; i++) {
+            // Viewport is set unscaled, the view is then scaled by its camera's zoom
+            SDL_Rect viewport = splitScreenViewport(i, playerCount);
+            SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+            SDL_RenderSetViewport(renderer, &viewport);
+            if (showBackground) {
+                background.Render(renderer, renderCameras[i], viewport.w, viewport.h, world.getOriginX());
+            }
+            SDL_RenderSetScale(renderer, renderCameras[i].zoom, renderCameras[i].zoom);
+            RenderView(i, levelCached);
+
+            // Lighting is multiplied over the whole view, under the HUD
+            SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+            if (showLighting) {
+                lightmap.Accumulate(world, renderCameras[i], viewport.w, viewport.h);
+                lightmap.Render(renderer);
+            }
+            if (i == 0 && editor.getActive()) {
+                SDL_RenderSetScale(renderer, renderCameras[i].zoom, renderCameras[i].zoom);
+                editor.Render(renderer, world, renderCameras[i]);
+                SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+            }
+            world.getPlayer(i).RenderHealth(spriteBatch);
+            spriteBatch.Flush(renderer);
         }
-
-        SDL_SetRenderDrawColor(renderer, 251, 206, 43, 255);
-        for (auto& coin : coins) {
-            if (!coin.collected) {
-                SDL_Rect drawCoin = { (int)(coin.body.x - camera.x), (int)(coin.body.y - camera.y), coin.body.w, coin.body.h };
-                SDL_RenderFillRect(renderer, &drawCoin);
+        SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+        SDL_RenderSetViewport(renderer, nullptr);
+
+        // Dividers between split screen views
+        if (playerCount > 1) {
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+            SDL_Rect vertical = { Constants::WIN_WIDTH / 2 - 2, 0, 4, Constants::WIN_HEIGHT };
+            renderFillRect(renderer, &vertical);
+            if (playerCount > 2) {
+                SDL_Rect horizontal = { 0, Constants::WIN_HEIGHT / 2 - 2, Constants::WIN_WIDTH, 4 };
+                renderFillRect(renderer, &horizontal);
             }
         }
 
-        player.Render(renderer, camera, alphaDT);
+        // Minimap only covers the fixed level
+        if (showMinimap && !endlessLevel) {
+            minimap.Render(renderer, world);
+        }
 
         // Respawning fade in/out
+        float fadeAlpha = world.getFadeAlpha();
         if (fadeAlpha > 0.0f) {
             SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
 
             // Fade to black if player died
-            if (!playerHasWon) {
+            if (!world.getPlayerHasWon()) {
                 SDL_SetRenderDrawColor(renderer, 0, 0, 0, fadeAlpha);
             }
             // Fade to white if player won
@@ -1035,24 +7906,215 @@ public:
             }
 
             SDL_Rect screen = { 0, 0, Constants::WIN_WIDTH, Constants::WIN_HEIGHT };
-            SDL_RenderFillRect(renderer, &screen);
+            renderFillRect(renderer, &screen);
+        }
+
+        if (showStats) {
+            RenderStats();
         }
+        console.Render(renderer);
 
+        // Read back before presenting, as the back buffer is undefined afterwards
+        ReadBackFrame();
         SDL_RenderPresent(renderer);
     }
 
-    void TriggerPlayerDeath() {
-        playerIsRespawning = true;
-        playerHasReset = false;
-        fadeAlpha = 0.0f;
-        Mix_FadeOutMusic(750);
+    // Copy the finished frame into a capture buffer, the capture's writer thread does the rest. If every buffer is
+    // still queued the frame is dropped rather than waiting
+    void ReadBackFrame() {
+        if (!capture.getActive()) { return; }
+
+        CaptureFrame* frame = capture.Acquire();
+        if (frame) {
+            // Headless frames are already in memory, otherwise they are read back from the renderer
+            int pitch = capture.getWidth() * 3;
+            int result = headless
+                ? SDL_ConvertPixels(framebuffer->w, framebuffer->h, framebuffer->format->format, framebuffer->pixels, framebuffer->pitch,
+                    SDL_PIXELFORMAT_RGB24, frame->pixels.data(), pitch)
+                : SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_RGB24, frame->pixels.data(), pitch);
+            if (result == 0) {
+                capture.Submit(frame);
+            }
+            else {
+                capture.Skip(frame);
+            }
+        }
+
+        if (!capture.getActive()) {
+            console.Print("Capture saved to " + capture.getFileName() + " (" + to_string(capture.getDropped()) + " frames dropped)");
+            if (headless) {
+                cout << "Capture saved to " << capture.getFileName() << " (" << capture.getDropped() << " frames dropped)" << endl;
+                isRunning = false;
+            }
+        }
     }
 
-    void TriggerWin() {
-        playerHasWon = true;
-        cout << "\n-=-=-=-=-=-=-=-=-=-=-=-=-=-\n Congratulations, you won! \n-=-=-=-=-=-=-=-=-=-=-=-=-=-\n\n";
-        // Reuse player death fade out for victory fade out (this also resets the player for next game)
-        TriggerPlayerDeath();
+    // True if rect overlaps any player's camera
+    bool IsVisible(const SDL_Rect& rect) {
+        for (auto& camera : renderCameras) {
+            SDL_Rect cameraRect = { (int)camera.x, (int)camera.y, camera.w, camera.h };
+            if (AABB(rect, cameraRect)) { return true; }
+        }
+        return false;
+    }
+
+    // Build the lists of moving platforms, enemies and coins visible to at least one camera
+    void FindVisible() {
+        visibleMovingPlatforms.clear();
+        visibleEnemies.clear();
+        visibleCoins.clear();
+
+        // One tree query covers every camera, then anything between the views is dropped
+        SDL_Rect bounds = { (int)renderCameras[0].x, (int)renderCameras[0].y, renderCameras[0].w, renderCameras[0].h };
+        for (auto& camera : renderCameras) {
+            bounds = unionRect(bounds, SDL_Rect{ (int)camera.x, (int)camera.y, camera.w, camera.h });
+        }
+        world.QueryMovingPlatforms(bounds, [&](const MovingPlatform& platform) {
+            if (IsVisible(platform.body)) { visibleMovingPlatforms.push_back(&platform); }
+        });
+
+        // Enemies awake around a camera are visible, zoomed out views also see enemies past that area
+        vector<unique_ptr<Enemy>>& enemies = world.getEnemies();
+        for (size_t i = 0; i < enemies.size(); i++) {
+            if (enemies[i]->getOnScreen() || (enemies[i]->getIsAlive() && IsVisible(enemies[i]->getBody()))) {
+                visibleEnemies.push_back((int)i);
+            }
+        }
+
+        vector<Coin>& coins = world.getCoins();
+        for (size_t i = 0; i < coins.size(); i++) {
+            if (!coins[i].collected && IsVisible(coins[i].body)) { visibleCoins.push_back((int)i); }
+        }
+    }
+
+    // Lights for this frame in level coordinates, shared by every view
+    void GatherLights() {
+        lightmap.Clear();
+        for (int i = 0; i < world.getPlayerCount(); i++) {
+            Player& player = world.getPlayer(i);
+            SDL_Rect body = player.getBody();
+            lightmap.AddLight({ { body.x + body.w / 2.0f, body.y + body.h / 2.0f }, 320.0f, 0.75f, 0.7f, 0.6f });
+
+            // Attacks flash briefly
+            if (player.getIsAttacking()) {
+                SDL_Rect attack = player.getAttackHitbox();
+                lightmap.AddLight({ { attack.x + attack.w / 2.0f, attack.y + attack.h / 2.0f }, 200.0f, 0.8f, 0.25f, 0.55f });
+            }
+        }
+
+        vector<Coin>& coins = world.getCoins();
+        for (int coin : visibleCoins) {
+            const SDL_Rect& body = coins[coin].body;
+            lightmap.AddLight({ { body.x + body.w / 2.0f, body.y + body.h / 2.0f }, 110.0f, 0.5f, 0.4f, 0.1f });
+        }
+    }
+
+    // Draw one player's view into the current viewport
+    // Every sprite in the view goes into one batch, drawn with a single call at the end
+    void RenderView(int view, bool levelCached) {
+        Camera camera = renderCameras[view];
+        // Draw static platforms from cache, or directly if render targets are unsupported
+        if (levelCached) {
+            levelCache.Render(renderer, camera, view);
+        }
+        else {
+            const vector<SDL_Rect>& platforms = world.getPlatforms();
+            for (size_t i = 0; i < platforms.size(); i++) {
+                if (world.getPlatformBroken((int)i)) { continue; }
+
+                // Draw platforms relative to camera position
+                SDL_Rect drawPlatform = { (int)(platforms[i].x - camera.x), (int)(platforms[i].y - camera.y), platforms[i].w, platforms[i].h };
+                addPlatform(spriteBatch, drawPlatform, world.getPlatformBreakable((int)i));
+            }
+        }
+
+        for (const MovingPlatform* platform : visibleMovingPlatforms) {
+            SDL_Rect drawPlatform = {
+                (int)roundf((platform->previousPos.x * (1.0f - alphaDT) + platform->pos.x * alphaDT) - camera.x),
+                (int)roundf((platform->previousPos.y * (1.0f - alphaDT) + platform->pos.y * alphaDT) - camera.y),
+                platform->body.w,
+                platform->body.h
+            };
+            addPlatform(spriteBatch, drawPlatform, false);
+        }
+
+        vector<unique_ptr<Enemy>>& enemies = world.getEnemies();
+        if (camera.zoom < StaticLevelCache::LOD_ZOOM) {
+            AddLodMarkers(camera, visibleEnemies, [&](int enemy) { return enemies[enemy]->getBody(); }, SpriteId::MELEE_ENEMY, SDL_Color{ 14, 201, 128, 255 });
+        }
+        else {
+            for (int enemy : visibleEnemies) {
+                enemies[enemy]->Render(spriteBatch, camera, alphaDT, animation.getFrame(world.getPlayerCount() + enemy));
+            }
+        }
+
+        const SDL_Color coinColour = { 251, 206, 43, 255 };
+        vector<Coin>& coins = world.getCoins();
+        if (camera.zoom < StaticLevelCache::LOD_ZOOM) {
+            AddLodMarkers(camera, visibleCoins, [&](int coin) { return coins[coin].body; }, SpriteId::COIN, coinColour);
+        }
+        else {
+            for (int coin : visibleCoins) {
+                SDL_Rect drawCoin = { (int)(coins[coin].body.x - camera.x), (int)(coins[coin].body.y - camera.y), coins[coin].body.w, coins[coin].body.h };
+                spriteBatch.Add(SpriteId::COIN, drawCoin, coinColour);
+            }
+        }
+
+        if (!endlessLevel) {
+            SDL_Rect playerBody = world.getPlayer().getBody();
+            ghosts.Render(spriteBatch, camera, runTick, alphaDT, playerBody.w, playerBody.h);
+        }
+
+        for (int i = 0; i < world.getPlayerCount(); i++) {
+            world.getPlayer(i).Render(spriteBatch, camera, alphaDT, animation.getFrame(i));
+        }
+        spriteBatch.Flush(renderer);
+        RenderHazards(camera);
+    }
+
+    // Draw water and lava over everything else, each run of tiles in a row is one rect and each fluid one call
+    void RenderHazards(Camera camera) {
+        const HazardGrid& hazards = world.getHazards();
+        if (!hazards.getEnabled()) { return; }
+
+        const SDL_Color colours[(int)HazardType::COUNT] = { { 40, 110, 220, 150 }, { 240, 90, 20, 230 } };
+        SDL_Rect view = { (int)camera.x, (int)camera.y, camera.w, camera.h };
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+        for (int type = 0; type < (int)HazardType::COUNT; type++) {
+            hazardRuns.clear();
+            hazards.ForEachRun((HazardType)type, view, [&](SDL_Rect run) {
+                hazardRuns.push_back(SDL_Rect{ (int)(run.x - camera.x), (int)(run.y - camera.y), run.w, run.h });
+            });
+            if (hazardRuns.empty()) { continue; }
+
+            SDL_SetRenderDrawColor(renderer, colours[type].r, colours[type].g, colours[type].b, colours[type].a);
+            SDL_RenderFillRects(renderer, hazardRuns.data(), (int)hazardRuns.size());
+            metrics.Increment(Counter::DRAW_CALLS);
+        }
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    }
+
+    // Far out, coins and enemies are merged into one marker per cell, so the cost is capped by the cells in view
+    // Columns are counted from just left of the view, so they stay positive wherever the origin is
+    template<typename GetBody>
+    void AddLodMarkers(Camera camera, const vector<int>& visible, GetBody getBody, SpriteId sprite, SDL_Color colour) {
+        lodCells.clear();
+        int firstCellX = (int)floorf(camera.x / LOD_CELL) - 1;
+        for (int index : visible) {
+            SDL_Rect body = getBody(index);
+            int cellX = (int)floorf((float)body.x / LOD_CELL) - firstCellX;
+            int cellY = (body.y - StaticLevelCache::TOP) / LOD_CELL;
+            lodCells.push_back(cellY * 1024 + cellX);
+        }
+        sort(lodCells.begin(), lodCells.end());
+        lodCells.erase(unique(lodCells.begin(), lodCells.end()), lodCells.end());
+
+        for (int cell : lodCells) {
+            int x = (firstCellX + cell % 1024) * LOD_CELL + (LOD_CELL - LOD_MARKER) / 2;
+            int y = StaticLevelCache::TOP + (cell / 1024) * LOD_CELL + (LOD_CELL - LOD_MARKER) / 2;
+            SDL_Rect drawMarker = { (int)(x - camera.x), (int)(y - camera.y), LOD_MARKER, LOD_MARKER };
+            spriteBatch.Add(sprite, drawMarker, colour);
+        }
     }
 
     void PlaySfx(string name) {
@@ -1066,89 +8128,276 @@ public:
 
     void Run() {
         while (isRunning) {
+            Uint64 marks[(int)TracePhase::COUNT + 1];
+            marks[0] = SDL_GetPerformanceCounter();
+            Uint64 drawCallsBefore = metrics.Get(Counter::DRAW_CALLS);
+
             HandleInput();
+            marks[1] = SDL_GetPerformanceCounter();
             Update();
+            marks[2] = SDL_GetPerformanceCounter();
             Render();
+            marks[3] = SDL_GetPerformanceCounter();
+
+            // Record frame metrics then publish them in one go
+            frameTime = (marks[3] - marks[0]) * 1000000 / SDL_GetPerformanceFrequency();
+            frameDrawCalls = metrics.Get(Counter::DRAW_CALLS) - drawCallsBefore;
+            metrics.Record(Histogram::FRAME_TIME, frameTime);
+            metrics.Set(Gauge::DRAW_CALLS_PER_FRAME, frameDrawCalls);
+            metrics.Publish();
+
+            if (trace.AddFrame(marks, frameDrawCalls)) {
+                console.Print("Trace saved to " + trace.getFileName());
+            }
         }
     }
 
-    void CleanUp() {
-        // Save player data to json file
-        savePlayerFile("Files/player.json", player.getPos(), player.getHealth());
+    // Cvars switching engine paths, and commands for capturing what they change
+    void RegisterConsole() {
+        console.AddBool("r_vsync", true, "Wait for vertical sync when presenting", [this](bool enabled) {
+            if (SDL_RenderSetVSync(renderer, enabled ? 1 : 0) != 0) {
+                console.Print(string("Vsync could not be changed: ") + SDL_GetError());
+            }
+        });
+        console.AddBool("r_batching", spriteBatch.getBatching(), "Draw sprites in one call per batch instead of one per sprite", [this](bool enabled) {
+            spriteBatch.setBatching(enabled);
+        });
+        console.AddBool("r_level_cache", useLevelCache, "Draw static platforms from cached chunk textures", [this](bool enabled) {
+            useLevelCache = enabled;
+        });
+        console.AddBool("r_background", showBackground, "Draw parallax background layers", [this](bool enabled) {
+            showBackground = enabled;
+        });
+        console.AddBool("r_lighting", showLighting, "Accumulate and draw the lightmap", [this](bool enabled) {
+            showLighting = enabled;
+        });
+        console.AddBool("r_minimap", showMinimap, "Draw the minimap", [this](bool enabled) {
+            showMinimap = enabled;
+        });
+        console.AddBool("r_stats", showStats, "Show frame time and draw call overlay", [this](bool enabled) {
+            showStats = enabled;
+        });
+        console.AddBool("phys_broadphase", world.getBroadphase(), "Gather nearby platforms through the platform tree instead of testing all of them", [this](bool enabled) {
+            world.setBroadphase(enabled);
+        });
+        console.AddInt("ai_los_interval", world.getLineOfSightInterval(), 1, 60, "Ticks between each enemy's line of sight checks", [this](int ticks) {
+            world.setLineOfSightInterval(ticks);
+        });
+        console.AddFloat("sim_step", world.getStepTime(), 0.002f, 0.033f, "Seconds simulated per fixed step", [this](float seconds) {
+            world.setStepTime(seconds);
+            accumulator = 0.0f;
+        });
+
+        console.AddCommand("trace", "trace [frames] [file]", "Time the phases of the next frames into a Chrome trace", [this](const vector<string>& args) {
+            int frames = args.size() > 0 ? max(1, atoi(args[0].c_str())) : 300;
+            string fileName = args.size() > 1 ? args[1] : "Files/trace.json";
+            trace.Start(fileName, frames);
+            console.Print("Tracing " + to_string(frames) + " frames");
+        });
+        console.AddCommand("capture", "capture [frames|stop] [file]", "Write the next frames to a .y4m video or .png sequence", [this](const vector<string>& args) {
+            if (!args.empty() && args[0] == "stop") {
+                capture.Stop();
+                console.Print(to_string(capture.getWritten()) + " frames written, " + to_string(capture.getDropped()) + " dropped");
+                return;
+            }
+            int frames = args.size() > 0 ? max(0, atoi(args[0].c_str())) : 600;
+            StartCapture(args.size() > 1 ? args[1] : "Files/capture.y4m", frames);
+        });
+        console.AddCommand("replay", "replay [file]", "Load recorded runs for ghost playback", [this](const vector<string>& args) {
+            ghosts.Load(args.empty() ? "Files/ghosts.bin" : args[0]);
+            console.Print(to_string(ghosts.getTrackCount()) + " runs loaded");
+        });
+        console.AddCommand("stats", "stats", "Print the metrics recorded so far", [this](const vector<string>&) {
+            ostringstream text;
+            metrics.Write(text);
+            text << "platforms = " << world.getPlatforms().size() << ", enemies = " << world.getEnemies().size() << "\n";
+            console.Print(text.str());
+        });
+        console.AddCommand("quit", "quit", "Close the game", [this](const vector<string>&) {
+            isRunning = false;
+        });
+    }
+
+    // Last frame's time and draw calls in the top right corner
+    void RenderStats() {
+        char text[64];
+        snprintf(text, sizeof(text), "%.2f ms  %d draws", frameTime / 1000.0, (int)frameDrawCalls);
+        int width = (int)strlen(text) * FONT_CHARACTER_SIZE;
+
+        SDL_RenderSetViewport(renderer, nullptr);
+        SDL_RenderSetScale(renderer, (float)Console::TEXT_SCALE, (float)Console::TEXT_SCALE);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        renderText(renderer, Constants::WIN_WIDTH / Console::TEXT_SCALE - width - 4, 4, text);
+
+        // How far the player has travelled, as a chunk and offset so it stays exact
+        if (endlessLevel) {
+            ChunkPosition position = world.ToChunkPosition(world.getPlayer().getPos());
+            snprintf(text, sizeof(text), "chunk %d + %.0f", position.chunk, position.offset.x);
+            width = (int)strlen(text) * FONT_CHARACTER_SIZE;
+            renderText(renderer, Constants::WIN_WIDTH / Console::TEXT_SCALE - width - 4, 8 + FONT_CHARACTER_SIZE, text);
+        }
+        // Regions of the hazard grid still being stepped
+        else if (world.getHazards().getEnabled()) {
+            const HazardGrid& hazards = world.getHazards();
+            snprintf(text, sizeof(text), "water %d  lava %d", hazards.getActiveRegions(HazardType::WATER), hazards.getActiveRegions(HazardType::LAVA));
+            width = (int)strlen(text) * FONT_CHARACTER_SIZE;
+            renderText(renderer, Constants::WIN_WIDTH / Console::TEXT_SCALE - width - 4, 8 + FONT_CHARACTER_SIZE, text);
+        }
+        SDL_RenderSetScale(renderer, 1.0f, 1.0f);
+    }
 
+    void CleanUp() {
+        // Save player data to json file (endless positions are relative to a moving origin, so only the fixed level saves)
+        if (!endlessLevel && !headless) {
+            savePlayerFile("Files/player.json", world.getPlayer().getPos(), world.getPlayer().getHealth());
+        }
+        telemetry.Stop();
+        capture.Stop();
+
+        levelCache.Release();
+        minimap.Release();
+        background.Release();
+        lightmap.Release();
+        spriteAtlas.Release();
+        SDLTest_CleanupTextDrawing();
         SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
+        if (window) {
+            SDL_DestroyWindow(window);
+        }
+        if (framebuffer) {
+            SDL_FreeSurface(framebuffer);
+        }
         SDL_Quit();
     }
 
 private:
     SDL_Window* window;
     SDL_Renderer* renderer;
-    SDL_GameController* controller;
+    // Headless runs draw into this instead of a window
+    SDL_Surface* framebuffer;
+    bool headless;
+    vector<SDL_GameController*> controllers;
 
     Mix_Music* backgroundMusic;
+    Mix_Music* currentMusic;
+    vector<pair<string, Mix_Music*>> regionMusic;
     vector<SoundEffect> sfxList;
 
+    // Music regions load their track the first time they are entered and keep it for the rest of the game
+    Mix_Music* LoadMusic(const string& fileName) {
+        // Headless runs have no mixer
+        if (headless) { return nullptr; }
+
+        for (auto& music : regionMusic) {
+            if (music.first == fileName) { return music.second; }
+        }
+
+        Mix_Music* music = Mix_LoadMUS(("Files/" + fileName).c_str());
+        if (!music) {
+            cerr << "Failed to load music '" << fileName << "': " << Mix_GetError() << endl;
+            music = backgroundMusic;
+        }
+        regionMusic.push_back({ fileName, music });
+        return music;
+    }
+
     Uint32 previousTick;
     bool isRunning;
     float deltaTime;
     float accumulator;
     float alphaDT;
-    Camera camera;
-    SDL_Rect cameraRect;
-    Player player;
-
-    bool playerIsRespawning;
-    bool playerHasReset;
-    bool playerHasWon;
-    float fadeAlpha;
-
-    vector<unique_ptr<Enemy>> enemies;
-    vector<SDL_Rect> platforms;
-    vector<Coin> coins;
-
-    //float platformTimer;
+    vector<PlayerInput> inputs;
+
+    Telemetry telemetry;
+    World world;
+    unique_ptr<EndlessLevel> endlessLevel;
+    SpriteAtlas spriteAtlas;
+    SpriteBatch spriteBatch;
+    AnimationSystem animation;
+    Lightmap lightmap;
+    StaticLevelCache levelCache;
+    Minimap minimap;
+    ParallaxBackground background;
+
+    LevelEditor editor;
+    Console console;
+    FrameTrace trace;
+    FrameCapture capture;
+    // Plays headless runs
+    PlaytestBot bot;
+
+    GhostRuns ghosts;
+    vector<GhostSample> ghostRecording;
+    int runTick;
+
+    vector<Camera> renderCameras;
+    vector<const MovingPlatform*> visibleMovingPlatforms;
+    vector<int> visibleEnemies;
+    vector<int> visibleCoins;
+
+    // Coins and enemies are merged into cells this size when zoomed out past the level of detail zoom
+    static constexpr int LOD_CELL = 256;
+    static constexpr int LOD_MARKER = 64;
+    vector<int> lodCells;
+    // Runs of hazard tiles gathered for one fill call
+    vector<SDL_Rect> hazardRuns;
+
+    // Changed from the console
+    bool useLevelCache;
+    bool showBackground;
+    bool showLighting;
+    bool showMinimap;
+    bool showStats;
+    // Last frame's time in microseconds and draw calls
+    Uint64 frameTime;
+    uint64_t frameDrawCalls;
 };
 
 
 // Some class functions need to be defined after to avoid forward-declare errors
 void Player::TakeDamage(int damage, Vector2 damageLocation) {
-    if (damageCooldown <= 0.0f) {
-        knockbackTimer = 0.1f;
-        damageCooldown = 0.75f;
-        dashTimer = 0.0f;
+    if (state.damageCooldown <= 0.0f) {
+        state.knockbackTimer = 0.1f;
+        state.damageCooldown = 0.75f;
+        state.dashTimer = 0.0f;
 
         // Apply knockback
-        calcKnockback(pos, vel, damageLocation);
+        calcKnockback(state.pos, state.vel, damageLocation);
+        world->RecordTelemetry(Heatmap::DAMAGE, state.pos);
 
         // Apply damage
         health -= damage;
         if (health <= 0) {
-            game->PlaySfx("death");
-            game->TriggerPlayerDeath();
+            world->PushEvent(WorldEvent::PLAYER_DIED);
+            world->TriggerPlayerDeath();
         }
         else {
-            game->PlaySfx("damage");
+            world->PushEvent(WorldEvent::PLAYER_DAMAGED);
         }
     }
 }
 
 void Player::DealDamage(vector<unique_ptr<Enemy>>& enemies, vector<Coin>& coins) {
     // Only check if player is attacking
-    if (!isAttacking) { return; }
+    if (!state.isAttacking) { return; }
+
+    world->BreakPlatforms(attackHitbox);
 
     for (auto& enemy : enemies) {
         // Only check enemies that are visible
         if (!enemy->getOnScreen()) { continue; }
 
         if (AABB(enemy->getBody(), attackHitbox)) {
-            bool tookDamage = enemy->TakeDamage(2, pos);
-            if (tookDamage && !isJumping) {
-                switch (attackDirection) {
+            bool tookDamage = enemy->TakeDamage(2, state.pos);
+            if (tookDamage) {
+                world->PushEvent(enemy->getIsAlive() ? WorldEvent::ENEMY_DAMAGED : WorldEvent::ENEMY_KILLED);
+            }
+            if (tookDamage && !state.isJumping) {
+                switch (state.attackDirection) {
                 case AttackDirection::DOWN:
                     // Player bounce on enemy on hit
-                    vel.y = jumpVelocity * 1.5f;
-                    attackCooldown = 0.0f;
+                    state.vel.y = jumpVelocity * 1.5f;
+                    state.attackCooldown = 0.0f;
                 default:
                     break;
                 }
@@ -1162,43 +8411,57 @@ void Player::DealDamage(vector<unique_ptr<Enemy>>& enemies, vector<Coin>& coins)
 
         if (AABB(coin.body, attackHitbox)) {
             coin.collected = true;
-            game->PlaySfx("coin");
+            world->PushEvent(WorldEvent::COIN_COLLECTED);
+            world->RecordTelemetry(Heatmap::COIN_PICKUP, Vector2{ (float)coin.body.x, (float)coin.body.y });
             // Coins heal player
             health = 10;
 
-            // When coin collected, check if all coins collected (more efficient than checking every update)
-            bool allCollected = true;
-            for (auto& checkCoin : coins) {
-                if (!checkCoin.collected) {
-                    allCollected = false;
-                    break;
-                }
-            }
-            if (allCollected) {
-                game->TriggerWin();
-            }
+            // Goals needing every coin are only checked when one is collected, not every update
+            world->CheckGoals();
         }
     }
 }
 
+void Player::Kill() {
+    health = 0;
+    world->PushEvent(WorldEvent::PLAYER_DIED);
+    world->TriggerPlayerDeath();
+}
+
+SlabAllocator<Enemy::SLOT_SIZE> enemySlab;
+
+void* Enemy::operator new(size_t size) {
+    return size <= SLOT_SIZE ? enemySlab.Allocate() : ::operator new(size);
+}
+
+void* Enemy::operator new(size_t size, align_val_t alignment) {
+    if (size <= SLOT_SIZE && (size_t)alignment <= SLOT_SIZE) { return enemySlab.Allocate(); }
+    return ::operator new(size, alignment);
+}
+
+void Enemy::operator delete(void* memory, size_t size) {
+    if (size <= SLOT_SIZE) { enemySlab.Free(memory); }
+    else { ::operator delete(memory); }
+}
+
+void Enemy::operator delete(void* memory, size_t size, align_val_t alignment) {
+    if (size <= SLOT_SIZE && (size_t)alignment <= SLOT_SIZE) { enemySlab.Free(memory); }
+    else { ::operator delete(memory, alignment); }
+}
+
+// Returns true if the enemy took damage, whoever dealt it raises the damaged or killed event
 bool Enemy::TakeDamage(int damage, Vector2 damageLocation) {
-    if (damageCooldown <= 0.0f) {
-        knockbackTimer = 0.1f;
-        damageCooldown = 0.75f;
+    if (state.damageCooldown <= 0.0f) {
+        state.knockbackTimer = 0.1f;
+        state.damageCooldown = 0.75f;
 
         // Apply knockback
-        calcKnockback(pos, vel, damageLocation);
+        calcKnockback(state.pos, state.vel, damageLocation);
 
         // Apply damage
-        health -= damage;
-        if (health <= 0) {
-            game->PlaySfx("death");
-            isAlive = false;
-            onScreen = false;
-            respawnTimer = 10.0f;
-        }
-        else {
-            game->PlaySfx("damage");
+        state.health -= damage;
+        if (state.health <= 0) {
+            Kill();
         }
 
         return true;
@@ -1208,42 +8471,37 @@ bool Enemy::TakeDamage(int damage, Vector2 damageLocation) {
     }
 }
 
+void Enemy::Kill() {
+    state.isAlive = false;
+    state.onScreen = false;
+    state.respawnTimer = 10.0f;
+}
+
 void Enemy::DealDamage(Player& player) {
-    if (onScreen) {
-        if (AABB(player.getBody(), body)) {
-            player.TakeDamage(1, pos);
+    if (state.onScreen) {
+        if (AABB(player.getBody(), state.body)) {
+            player.TakeDamage(1, state.pos);
         }
     }
 }
 
-vector<unique_ptr<Enemy>> loadEnemies(const string& fileName, Game* game) {
-    ifstream file(fileName);
-    if (!file.is_open()) {
-        cerr << "File '" << fileName << "' could not be opened. Closing program..." << endl;
-        exit(EXIT_FAILURE);
+unique_ptr<Enemy> createEnemy(const EnemySpawn& spawn) {
+    if (spawn.behaviour) {
+        return make_unique<ScriptedEnemy>(spawn.x, spawn.y, spawn.w, spawn.h, spawn.health, spawn.behaviour->getFlying());
     }
+    if (spawn.type == "Flying") {
+        return make_unique<FlyingEnemy>(spawn.x, spawn.y, spawn.w, spawn.h, spawn.health);
+    }
+    // Default to Melee
+    return make_unique<MeleeEnemy>(spawn.x, spawn.y, spawn.w, spawn.h, spawn.health);
+}
 
-    json data;
-    file >> data;
-
+vector<unique_ptr<Enemy>> createEnemies(const vector<EnemySpawn>& spawns) {
     vector<unique_ptr<Enemy>> enemies;
-    enemies.reserve(data.size());
-
-    for (auto& entry : data) {
-        string type = entry["type"].get<string>();
-        int x = entry["x"].get<int>();
-        int y = Constants::FLOOR_LEVEL - entry["y"].get<int>();
-        int w = entry["w"].get<int>();
-        int h = entry["h"].get<int>();
-        int health = entry["health"].get<int>();
+    enemies.reserve(spawns.size());
 
-        if (type == "Flying") {
-            enemies.push_back(make_unique<FlyingEnemy>(game, x, y, w, h, health));
-        }
-        else {
-            // Default to Melee
-            enemies.push_back(make_unique<MeleeEnemy>(game, x, y, w, h, health));
-        }
+    for (auto& spawn : spawns) {
+        enemies.push_back(createEnemy(spawn));
     }
 
     return enemies;
@@ -1252,8 +8510,105 @@ vector<unique_ptr<Enemy>> loadEnemies(const string& fileName, Game* game) {
 
 // Run game
 int main(int argc, char* argv[]) {
-    Game game;
+    // Watch a running game's metrics instead of playing
+    if (argc > 1 && string(argv[1]) == "--metrics") {
+        return watchMetrics();
+    }
+    // Benchmark headless batch simulation instead of playing
+    if (argc > 3 && string(argv[1]) == "--batch") {
+        return runBatchBenchmark(max(1, atoi(argv[2])), max(1, atoi(argv[3])));
+    }
+    // Benchmark line of sight raycasts instead of playing
+    if (argc > 2 && string(argv[1]) == "--los") {
+        return runLineOfSightBenchmark(atoi(argv[2]));
+    }
+    // Benchmark animation playback instead of playing
+    if (argc > 2 && string(argv[1]) == "--anim") {
+        return runAnimationBenchmark(max(1, atoi(argv[2])));
+    }
+    // Benchmark the enemy update loop instead of playing
+    if (argc > 2 && string(argv[1]) == "--enemies") {
+        return runEnemyBenchmark(max(1, atoi(argv[2])));
+    }
+    // Benchmark enemy behaviour scripts instead of playing
+    if (argc > 2 && string(argv[1]) == "--behaviours") {
+        return runBehaviourBenchmark(max(1, atoi(argv[2])));
+    }
+    // Benchmark water and lava stepping instead of playing
+    if (argc > 2 && string(argv[1]) == "--hazards") {
+        return runHazardBenchmark(max(1, atoi(argv[2])));
+    }
+    // Benchmark lightmap accumulation instead of playing
+    if (argc > 2 && string(argv[1]) == "--lights") {
+        return runLightmapBenchmark(atoi(argv[2]));
+    }
+    // Benchmark endless level streaming instead of playing
+    if (argc > 2 && string(argv[1]) == "--stream") {
+        return runStreamBenchmark(max(1, atoi(argv[2])));
+    }
+    // Run reachability analysis instead of playing
+    if (argc > 1 && string(argv[1]) == "--reach") {
+        return runReachability(argc > 2 ? (float)atof(argv[2]) : 60.0f);
+    }
+    // Run headless playtest bots instead of playing
+    if (argc > 2 && string(argv[1]) == "--bot") {
+        return runPlaytestBots(max(1, atoi(argv[2])), argc > 3 ? (float)atof(argv[3]) : 300.0f);
+    }
+
+    // Local split screen multiplayer (run with "--players <count>"), endless levels (run with "--endless [seed]"),
+    // frame capture (run with "--capture <file> [frames]") and headless bot runs (run with "--headless"), which can
+    // all be combined
+    int playerCount = 1;
+    bool endless = false;
+    bool headless = false;
+    bool seeded = false;
+    uint32_t seed = 0;
+    string captureFile;
+    int captureFrames = 600;
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--players" && i + 1 < argc) {
+            playerCount = max(1, min(Constants::MAX_PLAYERS, atoi(argv[++i])));
+        }
+        else if (option == "--endless") {
+            endless = true;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) {
+                seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+                seeded = true;
+            }
+        }
+        else if (option == "--capture" && i + 1 < argc) {
+            captureFile = argv[++i];
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) {
+                captureFrames = atoi(argv[++i]);
+            }
+        }
+        else if (option == "--headless") {
+            headless = true;
+        }
+    }
+
+    // Headless runs without a seed use a fixed one so captures can be repeated
+    if (!seeded) {
+        seed = headless ? 1 : random_device{}();
+    }
+
+    Game game(playerCount);
+    if (endless) {
+        game.MakeEndless(seed);
+    }
+    // Headless runs only end with their capture, so they always capture something
+    if (headless) {
+        game.MakeHeadless();
+        if (captureFile.empty()) {
+            captureFile = "Files/capture.y4m";
+        }
+        captureFrames = max(1, captureFrames);
+    }
     game.Initialise();
+    if (!captureFile.empty()) {
+        game.StartCapture(captureFile, captureFrames);
+    }
 
     game.Run();
 